@@ -24,7 +24,13 @@
 #define MIN_HUM_DELTA_BETWEEN_REPORTS 1.0
 #define TEMP_REPORT_NOCHANGE_PERIOD (60 * 1000)
 
-#define NUM_SAMPLES_FOR_TEMP_AVG 10
+// temperature / humidity sensor, ThermConfig::sensor_type
+#define SENSOR_TYPE_DHT11 0
+#define SENSOR_TYPE_SHT3X 1  // on the display's I2C bus
+#define SENSOR_TYPE_BME280 2 // on the display's I2C bus
+
+// the outdoor temperature comes in over MQTT. Without an update for this long it's unknown
+#define OUT_TEMP_MAX_AGE_MIN 60
 
 ///////////////////////////////////////////////////////////////////////////////////////
 // radar
@@ -47,6 +53,7 @@ struct ThermConfig
   String mqtt_pass;
   float calibration_offset_temp, calibration_offset_hum;
   bool relays_available;
+  uint8 sensor_type;
 
   ThermConfig();
   ~ThermConfig();
@@ -64,7 +71,8 @@ struct ThermState
   uint8 fan_relay = 0, heat_relay = 0;
   uint8 presence = 0;
   float
-      cur_temp = NAN,           // current temperature (calibrated)
+      cur_temp = NAN,           // current temperature (calibrated), estimated
+      cur_temp_rate = NAN,      // how fast it is changing, F per hour
       cur_hum = NAN,            // current humidity(calibrated)
       uncal_cur_temp = NAN,     // current temperature (uncalibrated, do not use directly)
       uncal_cur_hum = NAN,      // current humidity(uncalibrated, do not use directly)
@@ -73,6 +81,9 @@ struct ThermState
       last_reported_hum = NAN;  // to not spam MQTT for very tiny changes
   uint64 last_reported_ts = 0;
   uint8 local_mode = 0;
+  float out_temp = NAN; // outdoor temperature, from MQTT
+  int64_t out_temp_ts = -1;
+  uint8 wifi_connected = 0, mqtt_connected = 0; // link status, for the status icons
 };
 
 extern ThermState therm_state;
@@ -0,0 +1,102 @@
+#ifndef __CORO_H_
+#define __CORO_H_
+
+#include <type_traits>
+
+#include "tasks.h"
+
+// stackless coroutines on top of the scheduler, so that a multi-step sequence (do something, wait a minute, do the
+// next thing unless something happened in the meantime) can be written as one function instead of a chain of
+// one-shot tasks and global timestamps.
+//
+// a coroutine is an ordinary task that takes a pointer to its frame:
+//
+//   struct my_frame_t : coro_t
+//   {
+//       int counter; // anything that has to survive an await lives in the frame
+//   } my_frame;
+//
+//   void my_coro(my_frame_t *co)
+//   {
+//       CORO_BEGIN(co);
+//       ...
+//       CORO_AWAIT_DELAY(co, MS_FROM_SECONDS(5));
+//       ...
+//       CORO_END(co);
+//   }
+//
+//   start_coro<my_coro>(0, &my_frame, 0);
+//
+// it resumes at the last await every time it runs. It is scheduled by the same (func, id) as any other task:
+// sched.notify_task<my_coro>(0) / defer_notify_task signals it, sched.remove_task<my_coro>(0) cancels it.
+// the usual protothread rules apply: local variables don't survive an await, and awaits can't be used inside a
+// switch statement or from functions the coroutine calls.
+
+#define CORO_FOREVER UINT32_MAX // CORO_AWAIT_SIGNAL timeout: wait for the signal only, however long that takes
+
+struct coro_t
+{
+    uint16_t line = 0;  // where to resume: source line of the last await, 0 = from the top
+    sched_ts_t wake_ts; // when the current wait times out
+};
+
+// when a CORO_AWAIT_SIGNAL started now times out
+inline sched_ts_t coro_signal_deadline(uint32_t timeout_ms)
+{
+    return timeout_ms == CORO_FOREVER ? SCHED_TS_NEVER : get_ts() + US_FROM_MS(timeout_ms);
+}
+
+#define CORO_BEGIN(co)     \
+    switch ((co)->line)    \
+    {                      \
+    case 0:
+
+// the coroutine has finished: it will be removed from the schedule, like a one shot task
+#define CORO_END(co)       \
+    }                      \
+    (co)->line = 0
+
+#define CORO_EXIT(co)      \
+    do                     \
+    {                      \
+        (co)->line = 0;    \
+        return;            \
+    } while (0)
+
+// sleeps for at least ms. A signal in the meantime doesn't cut the delay short
+#define CORO_AWAIT_DELAY(co, ms)                                \
+    do                                                          \
+    {                                                           \
+        (co)->wake_ts = get_ts() + US_FROM_MS(ms);              \
+        (co)->line = __LINE__;                                  \
+    case __LINE__:                                              \
+        if (get_ts() < (co)->wake_ts)                           \
+        {                                                       \
+            sched.requeue_current_task((co)->wake_ts);          \
+            return;                                             \
+        }                                                       \
+    } while (0)
+
+// sleeps until the coroutine is notified, or timeout_ms (CORO_FOREVER for none) passes. Check which one it was with CORO_TIMED_OUT
+#define CORO_AWAIT_SIGNAL(co, timeout_ms)                       \
+    do                                                          \
+    {                                                           \
+        (co)->wake_ts = coro_signal_deadline(timeout_ms);       \
+        (co)->line = __LINE__;                                  \
+        sched.requeue_current_task((co)->wake_ts);              \
+        return;                                                 \
+    case __LINE__:;                                             \
+    } while (0)
+
+#define CORO_TIMED_OUT(co) (get_ts() >= (co)->wake_ts)
+
+// starts Func from the top (restarting it if it was already running) with the given frame, which must outlive it
+template <auto Func>
+bool start_coro(int id, TASK_CONTEXT_T(Func) * frame, int priority)
+{
+    static_assert(std::is_base_of<coro_t, TASK_CONTEXT_T(Func)>::value, "a coroutine takes a frame derived from coro_t");
+    frame->line = 0;
+    return sched.add_or_update_task<Func>(id, frame, priority, 0, 0);
+}
+
+#endif
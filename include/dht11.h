@@ -1,6 +0,0 @@
-#ifndef __DHT11_H__
-#define __DHT11_H__
-
-void setup_dht();
-
-#endif // __DHT11_H__
\ No newline at end of file
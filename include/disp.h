@@ -1,17 +1,57 @@
 #ifndef __DISP_H__
 #define __DISP_H__
 
+#include <stdint.h>
+
 void init_disp();
 void set_bright_mode(bool);
-void draw_current_temp();
-void draw_humidity();
-void draw_target_temp();
-
-void draw_icon_heat(bool);
-void draw_icon_fan(bool);
-void draw_icon_person(bool);
-void draw_icon_wifi(bool);
-void draw_icon_homeassistant(bool);
-void draw_icon_local_mode(bool);
+
+// the screen shows therm_state. There is nothing to draw: widgets pick up changed fields on the next frame
+
+enum disp_screen_t
+{
+    SCREEN_MAIN,    // readouts and status icons
+    SCREEN_HISTORY, // temperature and relay history of the last few hours
+};
+
+// a frame is going out over I2C, a chunk per scheduler slot
+bool is_disp_flushing();
+
+// takes effect on the next frame
+void set_disp_screen(disp_screen_t screen);
+disp_screen_t get_disp_screen();
+
+// shows state changed by user input right away, instead of on the next refresh tick, ahead of the rest of a frame
+// that is going out. A pending screen switch is left to the refresh task, on the next pass. input_cycles is
+// ESP.getCycleCount() when the input happened (in the ISR), for measuring input-to-photon latency
+void refresh_display_for_input(uint32_t input_cycles);
+
+// input-to-photon latency histogram: bucket upper bounds, the last bucket is for everything above
+#define DISP_LATENCY_NUM_BUCKETS 8
+static const uint16_t disp_latency_bucket_ms[DISP_LATENCY_NUM_BUCKETS] = {5, 10, 15, 20, 30, 50, 100, 250};
+
+struct disp_stats_t
+{
+    uint32_t num_frames;       // frames sent to the panel
+    uint64_t bytes_sent;       // I2C bytes, including addressing overhead
+    uint32_t last_frame_bytes, max_frame_bytes;
+    uint32_t max_chunk_us;     // longest the loop was blocked by a display transfer
+    uint32_t widget_renders;   // widgets re-rendered into the framebuffer
+    uint64_t total_render_us;  // time spent rendering them
+    uint32_t max_render_us;    // longest time one frame's rendering took
+
+    // from user input to the end of the transfer that shows its result
+    uint32_t latency_buckets[DISP_LATENCY_NUM_BUCKETS + 1];
+    uint32_t num_latencies;
+    uint64_t total_latency_us;
+    uint32_t max_latency_us;
+};
+
+const disp_stats_t &get_disp_stats();
+// upper bound of the bucket the percentile falls in, 0 if nothing was measured yet
+uint32_t get_disp_latency_percentile_ms(int percentile);
+
+// the framebuffer as a PBM (P4) image: fills the 8 rows of one page, SCREEN_WIDTH / 8 bytes each
+void get_screen_pbm_rows(int page, uint8_t *rows);
 
 #endif // __DISP_H__
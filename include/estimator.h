@@ -0,0 +1,36 @@
+#ifndef __ESTIMATOR_H__
+#define __ESTIMATOR_H__
+
+#include <stdint.h>
+
+#include "filter.h"
+#include "tasks.h"
+
+// room temperature estimator: a two state (temperature, rate of change) Kalman filter in fixed point.
+// unlike an average over the last readings it doesn't lag behind a trend, and it can say where the temperature is
+// headed. The relays are its input: each relay state has its own trend (the furnace heats, the room cools without
+// it), which the estimator learns and switches to when the relays do
+struct temp_estimator_t
+{
+    bool initialized;
+    q8_t temp;       // F
+    int32_t rate;    // F per hour, Q8
+    int64_t p00, p01, p11; // error covariance, in the squared units above
+    int64_t r;       // measurement noise variance
+    q8_t half_step;  // half the sensor's resolution: a reading only says the temperature is within this of it
+    q8_t last_temp;  // the previous reading
+    sched_ts_t last_ts;
+    uint8_t last_relays;    // heat | fan << 1
+    sched_ts_t relays_ts;   // when they last switched
+    int32_t relay_rates[4]; // the trend at the end of the last stretch in each relay state, F per hour, Q8
+    uint8_t relay_rates_known; // bit per relay state
+};
+
+// noise: standard deviation of a sensor reading on top of its resolution (F, Q8). resolution: the step between
+// readings (F, Q8)
+void estimator_init(temp_estimator_t &estimator, q8_t noise, q8_t resolution);
+
+// adds a reading taken at ts, with the relays in the given state. Readings must be outlier free
+void estimator_update(temp_estimator_t &estimator, q8_t temp, sched_ts_t ts, bool heat, bool fan);
+
+#endif // __ESTIMATOR_H__
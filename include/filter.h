@@ -0,0 +1,34 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <stdint.h>
+#include <math.h>
+
+// sensor values in Q8 fixed point: 1/256 of a degree or %RH. There is no FPU, so the per sample math stays in integers
+typedef int32_t q8_t;
+#define Q8_ONE 256
+#define Q8_FROM_FLOAT(f) ((q8_t)lroundf((f) * Q8_ONE))
+#define Q8_FROM_INT(i) ((q8_t)(i) * Q8_ONE)
+#define Q8_TO_FLOAT(q) ((float)(q) / Q8_ONE)
+
+#define FILTER_WINDOW 10      // raw readings the filter looks at
+#define FILTER_MIN_SAMPLES 3  // readings needed before there is an output
+
+// sliding window filter with Hampel outlier rejection: the output is the mean of the readings in the window that are
+// within a few (scaled) median absolute deviations of the window median. A single spike is ignored, while a real step
+// in the signal takes over once it makes up half the window
+struct sample_filter_t
+{
+    q8_t samples[FILTER_WINDOW]; // ring buffer of raw readings
+    uint8_t num_samples, next;
+    q8_t min_threshold; // outlier threshold floor. Quantized sensors often read the same value over and over, a MAD of 0
+    uint32_t num_outliers; // readings that were outliers when they came in
+    bool last_outlier;     // the latest one was
+};
+
+void filter_init(sample_filter_t &filter, q8_t min_threshold);
+
+// adds a raw reading. Returns false until there are enough readings for an output
+bool filter_add(sample_filter_t &filter, q8_t sample, q8_t &filtered);
+
+#endif // __FILTER_H__
@@ -3,12 +3,27 @@
 
 #include <PubSubClient.h>
 
+// cost of the publish path: from measuring the payload to the end of the TCP writes
+struct mqtt_stats_t
+{
+  uint32_t num_publishes;
+  uint32_t num_publish_failures;
+  uint64_t payload_bytes;
+  uint64_t total_publish_cycles;
+  uint32_t max_publish_cycles;
+  uint32_t min_free_heap; // lowest free heap seen while publishing, i.e. with the payload queued in the TCP stack
+};
+
 void send_mqtt_state_relays();
 void send_mqtt_state_presence();
 void send_mqtt_state_cur_temp();
 void send_mqtt_state_target_temp();
-void announce_devices_to_homeassistant();
+void send_mqtt_stall_record();
+// retained discovery configs. Unless forced, only sent if they changed since they were last announced
+void announce_devices_to_homeassistant(bool force);
 void init_mqtt();
 
+const mqtt_stats_t &get_mqtt_stats();
+
 
 #endif // __MQTT_H__
\ No newline at end of file
@@ -0,0 +1,11 @@
+#ifndef __PSYCHRO_H__
+#define __PSYCHRO_H__
+
+#include "filter.h"
+
+// dew point (F) of air at temp (F) and relative humidity hum (%RH), all Q8. Magnus formula, in integers: ln(RH)
+// comes from a table, the rest is a couple of divisions. Within 0.05 F of the formula from 1 %RH up (-20..120 F,
+// test_psychro)
+q8_t dew_point(q8_t temp, q8_t hum);
+
+#endif // __PSYCHRO_H__
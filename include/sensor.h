@@ -0,0 +1,86 @@
+#ifndef __SENSOR_H__
+#define __SENSOR_H__
+
+#include <stdint.h>
+
+#include "coro.h"
+#include "filter.h"
+
+// temperature / humidity sensor drivers. A read is split in two, so nothing blocks while the sensor converts:
+// trigger() starts a measurement, and collect() is called conversion_ms later, then every poll_ms (or whenever the
+// driver signals with sensor_notify_from_isr()) for as long as it returns SENSOR_BUSY, up to timeout_ms.
+// the shared part (sensor.cc) runs the reads, filters the readings and reports them.
+// the backend is picked by ThermConfig::sensor_type
+
+enum sensor_status_t
+{
+    SENSOR_OK,
+    SENSOR_BUSY,     // not done yet, call again
+    SENSOR_TIMEOUT,  // no answer
+    SENSOR_BAD_DATA, // an answer, but the checksum didn't match
+};
+
+struct sensor_reading_t
+{
+    q8_t temperature; // C
+    q8_t humidity;    // %RH
+};
+
+struct sensor_driver_t
+{
+    const char *name;
+    bool on_display_bus; // I2C, shared with the display: bus access waits for display frames to finish going out
+    q8_t min_outlier_temp, min_outlier_hum; // outlier filter threshold floors, F and %RH. About the sensor's resolution
+    q8_t temp_noise; // standard deviation of a temperature reading on top of its resolution, F. Tells the estimator how much to trust one
+    q8_t temp_resolution; // step between temperature readings, F
+    unsigned int conversion_ms;
+    unsigned int poll_ms;
+    unsigned int timeout_ms; // from the first collect()
+
+    bool (*init)(); // false if the sensor isn't there
+    bool (*trigger)();
+    // last_call is set once timeout_ms is up: the driver must clean up and can't return SENSOR_BUSY
+    sensor_status_t (*collect)(sensor_reading_t &reading, bool last_call);
+};
+
+extern const sensor_driver_t dht11_driver;
+extern const sensor_driver_t sht3x_driver;
+extern const sensor_driver_t bme280_driver;
+
+void setup_sensor();
+// the furnace or the fan switched: the read period adapts now rather than at the next reading, which could be up to a
+// minute away. The estimator sees the switch with the first reading after it
+void sensor_relays_changed();
+
+struct sensor_stats_t
+{
+    uint32_t num_reads;
+    uint32_t num_timeouts;        // the sensor didn't answer (completely)
+    uint32_t num_checksum_errors; // it did, but the data was garbled
+    uint32_t num_outliers_temp, num_outliers_hum; // readings the outlier filter rejected when they came in
+    uint32_t filter_max_cycles;   // longest the filtering of one reading took
+    uint32_t read_period_ms;      // current, it adapts to how fast the temperature changes
+};
+
+const sensor_stats_t &get_sensor_stats();
+const char *get_sensor_name();
+
+// for drivers: a read in progress, so that an ISR can have it collect right away
+struct sensor_frame_t : coro_t
+{
+    sched_ts_t collect_deadline;
+    sensor_reading_t reading;
+};
+void sensor_read_coro(sensor_frame_t *co);
+
+__attribute__((always_inline)) inline void sensor_notify_from_isr()
+{
+    sched.defer_notify_task<sensor_read_coro>(0);
+}
+
+// for I2C drivers: whole transactions, false if the device didn't acknowledge or sent less than asked for
+bool sensor_i2c_write(uint8_t address, const uint8_t *data, int num_bytes);
+bool sensor_i2c_read(uint8_t address, uint8_t *data, int num_bytes);
+bool sensor_i2c_read_register(uint8_t address, uint8_t reg, uint8_t *data, int num_bytes);
+
+#endif // __SENSOR_H__
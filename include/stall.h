@@ -0,0 +1,33 @@
+#ifndef __STALL_H__
+#define __STALL_H__
+
+#include <arduino.h>
+
+// a scheduler task that runs longer than this is recorded as a stall
+#ifndef STALL_BUDGET_MS
+#define STALL_BUDGET_MS 500
+#endif
+
+#define STALL_STACK_WORDS 16 // code addresses found on the stack of the stalled task
+
+// what the stall detector saves to RTC user memory. It survives a (soft WDT) reset, but not a power cycle
+struct stall_record_t
+{
+    uint32_t magic;
+    uint32_t check;
+    uint32_t task_func; // function address of the task (its scheduler trampoline), resolve with addr2line
+    int32_t task_id;
+    uint32_t start_ms;    // since boot, truncated to 32 bits
+    uint32_t duration_ms; // how long the task had been running when last seen by the detector
+    uint32_t num_stack_words;
+    uint32_t stack[STALL_STACK_WORDS];
+};
+
+void setup_stall_detector();
+
+// the most recent stall, NULL if there was none. from_previous_boot is set when the stall ended in a reset
+const stall_record_t *get_last_stall(bool &from_previous_boot);
+String get_last_stall_reset_reason();
+uint32_t get_num_stalls();
+
+#endif // __STALL_H__
@@ -3,46 +3,313 @@
 
 #include <arduino.h>
 
-#define get_ts millis
-#define MAX_NUM_TASKS 20
+// per task execution time profiling (ESP.getCycleCount() around every run). Build with -DSCHED_PROFILING=0 to compile it out
+#ifndef SCHED_PROFILING
+#define SCHED_PROFILING 1
+#endif
+
+// scheduler timebase: 64-bit microseconds since boot. Unlike millis() this does not wrap
+// (~49.7 days) during the lifetime of a unit, so deadlines can be compared directly.
+typedef uint64_t sched_ts_t;
+#define get_ts micros64
+#define get_ts_ms() ((int64_t)(get_ts() / 1000))
+#define US_FROM_MS(ms) ((sched_ts_t)(ms) * 1000)
+#define SCHED_TS_NEVER UINT64_MAX // a deadline that never comes: the task only runs when it is notified
+
+#define INITIAL_NUM_TASKS 20 // initial capacity of a heap allocated scheduler; it grows beyond this on demand
+#define SCHED_MAX_TASKS 32   // capacity of the firmware's statically allocated scheduler (see 'sched' below)
+#define ISR_QUEUE_SIZE 16     // deferred ISR requests between two scheduler runs. Must be a power of 2
+#define SCHED_MAX_BATCH 16    // tasks run per wakeup; any left over run on the next pass
+
+// every task runs through this signature. Don't cast functions to it, register them with the
+// templated add_or_update_task<func>() etc. which generate a type-correct trampoline at compile time.
+typedef void (*task_func_t)(void *);
+
+// adapts 'R func()' and 'R func(T *)' to task_func_t. context_t is the type of the params pointer the task expects
+template <typename FuncPtr>
+struct task_traits;
+
+template <typename R>
+struct task_traits<R (*)()>
+{
+    typedef void context_t;
+    template <R (*Func)()>
+    static void call(void *) { Func(); }
+};
+
+template <typename R, typename T>
+struct task_traits<R (*)(T *)>
+{
+    typedef T context_t;
+    template <R (*Func)(T *)>
+    static void call(void *params) { Func(static_cast<T *>(params)); }
+};
+
+template <auto Func>
+void task_thunk(void *params)
+{
+    task_traits<decltype(Func)>::template call<Func>(params);
+}
+
+#define TASK_CONTEXT_T(Func) typename task_traits<decltype(Func)>::context_t
 
 class scheduler
 {
+public:
+    // how late (in us) a task ran compared to its deadline
+    struct task_timing_t
+    {
+        uint32_t num_runs;
+        uint32_t num_notifies;       // wakeups by notify_task(), as opposed to reaching the deadline
+        uint32_t num_overruns;       // periodic deadlines skipped because the task fell a whole period behind
+        uint32_t last_lateness;
+        uint32_t max_lateness;
+        uint64_t total_lateness;
+        uint32_t jitter;             // smoothed variation of lateness between consecutive runs (RFC 3550 style)
+#if SCHED_PROFILING
+        uint32_t max_cycles;         // execution time, in CPU cycles
+        uint64_t total_cycles;
+#endif
+    };
 
-    struct task_t
+    struct task_info_t
     {
         void *func_ptr;
         int id;
+        int priority;
+        sched_ts_t next_ts;
+        sched_ts_t period;
+        sched_ts_t slack;
+        task_timing_t timing;
+    };
+
+    typedef void (*task_visitor_t)(const task_info_t &info, void *ctx);
+
+    // the task run() is executing, for watchdogs that look at it from an ISR.
+    // seq changes every time a task starts or returns
+    struct running_task_t
+    {
+        volatile uint32_t seq;
+        volatile task_func_t func_ptr; // NULL between tasks
+        volatile int id;
+        volatile uint32_t start_ms;   // get_ts_ms() when the task started, truncated
+    };
+
+    // a task slot. Public only so that static_scheduler can size its storage
+    struct task_t
+    {
+        task_func_t func_ptr;
+        int id;
         void *params;
         int priority;
 
-        unsigned long next_ts;
+        sched_ts_t next_ts;          // deadline, i.e. the earliest the task may run
+        sched_ts_t period;           // us, 0 = one shot
+        sched_ts_t slack;            // us the task may be postponed past next_ts, so that it can share a wakeup with other tasks
+        sched_ts_t latest_ts;        // next_ts + slack, the latest the task may run
+
+        task_timing_t timing;
+
+        int heap_pos;        // position in the deadline heap, -1 when not queued
+        int next_free;       // free list link, only meaningful while the slot is unused
+        uint16_t generation; // bumped every time the slot is freed, so stale slot references can be detected
+        bool in_use;
+    };
+
+    // hash table size for a given number of slots: a power of 2, at most half full
+    static constexpr int index_size_for(int max_tasks)
+    {
+        int index_size = 1;
+        while (index_size < 2 * max_tasks)
+        {
+            index_size <<= 1;
+        }
+        return index_size;
+    }
+
+private:
+    enum deferred_op_type_t : uint8_t
+    {
+        DEFERRED_ADD_OR_UPDATE,
+        DEFERRED_REMOVE,
+        DEFERRED_NOTIFY,
+    };
+
+    // add/update/remove/notify request queued by an ISR, applied by run() on the main loop
+    struct deferred_op_t
+    {
+        task_func_t func_ptr;
+        int id;
+        void *params;
+        int priority;
         unsigned int period;
+        unsigned int start_delay;
+        deferred_op_type_t type;
     };
 
-    task_t *tasks;
-    int num_tasks = 0, max_tasks;
+    // single producer (GPIO ISRs, which don't nest) / single consumer (run()) ring
+    deferred_op_t isr_queue[ISR_QUEUE_SIZE];
+    volatile uint8_t isr_queue_head = 0, isr_queue_tail = 0;
+    volatile uint32_t isr_queue_overflows = 0;
+    uint8_t isr_queue_high_water = 0;
+
+    uint32_t num_runs = 0, num_task_runs = 0, num_add_failures = 0;
+    uint32_t num_wakeups = 0, num_coalesced_runs = 0;
+    sched_ts_t idle_time = 0;
+    sched_ts_t max_slack = 0; // largest slack ever registered, bounds the search for tasks that can join a wakeup
+
+    bool defer(task_func_t func, int id, void *params, int priority, unsigned int period, unsigned int start_delay, deferred_op_type_t type);
+    void drain_isr_queue();
+    void idle(unsigned int max_idle_ms);
+    bool must_run_now(const task_t &task, sched_ts_t ts);
+
+    task_t *tasks;  // task slots. A slot index stays valid for the lifetime of a task
+    int *heap;      // binary min-heap of slot indices, ordered by (latest_ts, priority)
+    int *index;     // open addressing hash table (func_ptr, id) -> slot index, -1 = empty
+    int num_tasks = 0, heap_size = 0, max_tasks, index_mask, free_head;
+    int current_task = -1; // slot of the task run() is executing, -1 outside of tasks
+    running_task_t running = {0, NULL, 0, 0};
+    bool owns_storage; // heap allocated storage can grow, static storage can't
+
+    static unsigned int hash_key(task_func_t func, int id);
+
+    void init_storage();
+    bool grow();
+    void rebuild_index();
+
+    int find_task(task_func_t func, int id);
+    int alloc_slot(task_func_t func, int id);
+    void free_slot(int task_idx);
 
-    int find_task(void *func, int id);
+    bool is_before(int task_a, int task_b);
+    void heap_swap(int pos_a, int pos_b);
+    void heap_sift_up(int pos);
+    void heap_sift_down(int pos);
+    void heap_push(int task_idx);
+    void heap_remove(int task_idx);
+    void collect_due(int pos, sched_ts_t ts, int *due, int &num_due);
 
-    void update_task(int task_idx, void *params, int priority, unsigned int period, unsigned int start_delay);
+    void update_task(int task_idx, void *params, int priority, unsigned int period, unsigned int start_delay, unsigned int slack);
 
-    void rearm_task(int task_idx);
+    void rearm_task(int task_idx, sched_ts_t deadline);
+
+    void record_timing(int task_idx, sched_ts_t deadline, sched_ts_t start_ts);
+#if SCHED_PROFILING
+    void record_exec_time(int task_idx, uint16_t generation, uint32_t cycles);
+#endif
 
     bool remove_task(int task_idx);
 
+    bool add_or_update_task(task_func_t func, int id, void *params, int priority, unsigned int period, unsigned int start_delay, unsigned int slack);
+    bool remove_task(task_func_t func, int id);
+    bool notify_task(task_func_t func, int id);
+    bool get_task_timing(task_func_t func, int id, task_timing_t &timing);
+
+protected:
+    // uses caller provided storage of max_tasks slots and an index of index_size_for(max_tasks) entries
+    scheduler(task_t *tasks, int *heap, int *index, int max_tasks);
+
 public:
     scheduler(int max_tasks);
 
     ~scheduler();
 
-    bool add_or_update_task(void *func, int id, void *params, int priority, unsigned int period, unsigned int start_delay);
+    // period, start_delay and slack are in ms. params must point to whatever Func takes (nothing for 'R Func()').
+    // a task with slack runs anywhere between its deadline and deadline + slack: whenever some other task wakes the
+    // loop up within that window, it runs in the same pass. Periodic tasks stay anchored to their nominal deadlines.
+    template <auto Func>
+    bool add_or_update_task(int id, TASK_CONTEXT_T(Func) *params, int priority, unsigned int period, unsigned int start_delay, unsigned int slack = 0)
+    {
+        return add_or_update_task(&task_thunk<Func>, id, (void *)params, priority, period, start_delay, slack);
+    }
+
+    template <auto Func>
+    bool remove_task(int id)
+    {
+        return remove_task(&task_thunk<Func>, id);
+    }
+
+    // ISR safe versions of add_or_update_task / remove_task / notify_task. The request is queued and applied at the start of the next run().
+    // returns false (and counts an overflow) if the queue is full.
+    // always inlined, so that the calling ISR doesn't end up calling into flash
+    template <auto Func>
+    __attribute__((always_inline)) inline bool defer_add_or_update_task(int id, TASK_CONTEXT_T(Func) *params, int priority, unsigned int period, unsigned int start_delay)
+    {
+        return defer(&task_thunk<Func>, id, (void *)params, priority, period, start_delay, DEFERRED_ADD_OR_UPDATE);
+    }
+
+    template <auto Func>
+    __attribute__((always_inline)) inline bool defer_remove_task(int id)
+    {
+        return defer(&task_thunk<Func>, id, NULL, 0, 0, 0, DEFERRED_REMOVE);
+    }
+
+    // signalled tasks: a task registered with a (low rate, fallback) period can be made runnable right away by its
+    // event source. Returns false if the task isn't scheduled. Notifying a task that is already due is a no-op
+    template <auto Func>
+    bool notify_task(int id)
+    {
+        return notify_task(&task_thunk<Func>, id);
+    }
+
+    template <auto Func>
+    __attribute__((always_inline)) inline bool defer_notify_task(int id)
+    {
+        return defer(&task_thunk<Func>, id, NULL, 0, 0, 0, DEFERRED_NOTIFY);
+    }
+
+    __attribute__((always_inline)) inline const running_task_t &get_running_task() { return running; }
+
+    uint32_t get_isr_queue_overflows() { return isr_queue_overflows; }
+    uint8_t get_isr_queue_high_water() { return isr_queue_high_water; }
+
+    template <auto Func>
+    bool get_task_timing(int id, task_timing_t &timing)
+    {
+        return get_task_timing(&task_thunk<Func>, id, timing);
+    }
 
-    bool remove_task(void *func, int id);
+    // queues the task that is running right now to run again at ts, instead of being rearmed or freed when it
+    // returns. This is what coroutines (coro.h) await with. A task that got notified while running stays due.
+    // SCHED_TS_NEVER parks it until it is notified. returns false when not called from a task
+    bool requeue_current_task(sched_ts_t ts);
 
-    void run(int notask_delay);
+    // calls visit for every scheduled task. The visitor must not add or remove tasks
+    void for_each_task(task_visitor_t visit, void *ctx);
+
+    int get_num_tasks() { return num_tasks; }
+    int get_max_tasks() { return max_tasks; }
+    uint32_t get_num_runs() { return num_runs; }                 // calls to run()
+    uint32_t get_num_task_runs() { return num_task_runs; }       // task invocations over all tasks
+    uint32_t get_num_add_failures() { return num_add_failures; } // tasks dropped because the table was full
+    sched_ts_t get_idle_time() { return idle_time; }             // us spent sleeping in run(), for CPU duty cycle
+    uint32_t get_num_wakeups() { return num_wakeups; }           // passes of run() that ran at least one task
+    uint32_t get_num_coalesced_runs() { return num_coalesced_runs; } // task runs that joined an earlier wakeup instead of needing their own
+
+    // once some task reaches its latest run time, runs it along with every other task whose window is open.
+    // If none had to run, sleeps until the next latest run time (but at most max_idle_ms),
+    // waking up early when an ISR defers work
+    void run(unsigned int max_idle_ms);
+};
+
+// storage for static_scheduler, kept in a separate base so it is constructed before the scheduler base
+template <int N>
+struct static_scheduler_storage
+{
+    scheduler::task_t storage_tasks[N];
+    int storage_heap[N];
+    int storage_index[scheduler::index_size_for(N)];
+};
+
+// a scheduler with a fixed, statically allocated task table. Its size shows up in .bss at link time, and
+// running out of slots is reported (get_num_add_failures(), /metrics) instead of silently dropping tasks
+template <int N>
+class static_scheduler : private static_scheduler_storage<N>, public scheduler
+{
+public:
+    static_scheduler() : scheduler(this->storage_tasks, this->storage_heap, this->storage_index, N) {}
 };
 
-extern scheduler sched;
+extern static_scheduler<SCHED_MAX_TASKS> sched;
 
 #endif
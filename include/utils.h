@@ -10,5 +10,10 @@
 
 void trim_string(String& str);
 String get_chip_id();
+String uint64_to_string(uint64_t value);
+
+#define UINT64_MAX_DIGITS 20
+// decimal digits of value, written to the end of buf (UINT64_MAX_DIGITS + 1 bytes). Returns where they start
+char *format_uint64(uint64_t value, char *buf);
 
 #endif //__UTILS_H__
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "sensor.h"
+
+// Bosch BME280 on the display's I2C bus, in forced mode: one measurement per trigger, asleep in between.
+// pressure isn't used and is skipped. Compensation is the datasheet's integer version (section 4.2.3)
+#define BME280_I2C_ADDRESS 0x76 // SDO low
+#define BME280_I2C_ADDRESS_ALT 0x77 // SDO high
+#define BME280_CHIP_ID 0x60
+
+#define BME280_REG_CALIB_T_P 0x88 // dig_T1 .. dig_P9, 24 bytes, then dig_H1 at 0xA1
+#define BME280_REG_CALIB_H1 0xA1
+#define BME280_REG_CHIP_ID 0xD0
+#define BME280_REG_CALIB_H 0xE1 // dig_H2 .. dig_H6, 7 bytes
+#define BME280_REG_CTRL_HUM 0xF2
+#define BME280_REG_STATUS 0xF3
+#define BME280_REG_CTRL_MEAS 0xF4
+#define BME280_REG_DATA_TEMP 0xFA // temperature (3 bytes) and humidity (2 bytes)
+
+#define BME280_CTRL_HUM_X1 0x01
+#define BME280_CTRL_MEAS_FORCED_T_X1 (0x01 << 5 | 0x01) // temperature oversampling x1, pressure skipped, forced mode
+#define BME280_STATUS_MEASURING 0x08
+#define BME280_ADC_SKIPPED 0x80000
+
+#define BME280_CONVERSION_MS 8 // 6.4 ms max with temperature and humidity at x1
+#define BME280_POLL_MS 2
+#define BME280_TIMEOUT_MS 20
+
+struct
+{
+    uint16_t dig_T1;
+    int16_t dig_T2, dig_T3;
+    uint8_t dig_H1, dig_H3;
+    int16_t dig_H2, dig_H4, dig_H5;
+    int8_t dig_H6;
+} bme280_calib;
+
+uint8_t bme280_address = BME280_I2C_ADDRESS;
+
+bool bme280_write_register(uint8_t reg, uint8_t value)
+{
+    uint8_t data[2] = {reg, value};
+    return sensor_i2c_write(bme280_address, data, sizeof(data));
+}
+
+// true if a BME280 answers at address
+bool bme280_probe(uint8_t address)
+{
+    uint8_t chip_id = 0;
+    return sensor_i2c_read_register(address, BME280_REG_CHIP_ID, &chip_id, 1) && chip_id == BME280_CHIP_ID;
+}
+
+bool bme280_init()
+{
+    // both addresses, in order, every time: the sensor may have been swapped or rewired since the last init. The
+    // address is only kept once a chip answers with the right ID
+    uint8_t address = BME280_I2C_ADDRESS;
+    if (!bme280_probe(address))
+    {
+        address = BME280_I2C_ADDRESS_ALT;
+        if (!bme280_probe(address))
+            return false;
+    }
+    bme280_address = address;
+
+    // little endian, except for the 12 bit dig_H4 / dig_H5 which share a byte
+    uint8_t calib_t[6], calib_h[7];
+    if (!sensor_i2c_read_register(bme280_address, BME280_REG_CALIB_T_P, calib_t, sizeof(calib_t)) ||
+        !sensor_i2c_read_register(bme280_address, BME280_REG_CALIB_H1, &bme280_calib.dig_H1, 1) ||
+        !sensor_i2c_read_register(bme280_address, BME280_REG_CALIB_H, calib_h, sizeof(calib_h)))
+        return false;
+    bme280_calib.dig_T1 = calib_t[1] << 8 | calib_t[0];
+    bme280_calib.dig_T2 = calib_t[3] << 8 | calib_t[2];
+    bme280_calib.dig_T3 = calib_t[5] << 8 | calib_t[4];
+    bme280_calib.dig_H2 = calib_h[1] << 8 | calib_h[0];
+    bme280_calib.dig_H3 = calib_h[2];
+    bme280_calib.dig_H4 = (int16_t)((int8_t)calib_h[3] * 16 | (calib_h[4] & 0x0F));
+    bme280_calib.dig_H5 = (int16_t)((int8_t)calib_h[5] * 16 | calib_h[4] >> 4);
+    bme280_calib.dig_H6 = calib_h[6];
+
+    // humidity settings only take effect with the next write to ctrl_meas, i.e. every trigger
+    return bme280_write_register(BME280_REG_CTRL_HUM, BME280_CTRL_HUM_X1);
+}
+
+bool bme280_trigger()
+{
+    return bme280_write_register(BME280_REG_CTRL_MEAS, BME280_CTRL_MEAS_FORCED_T_X1);
+}
+
+// returns t_fine, the temperature the humidity compensation needs. The temperature is t_fine * 5 / 256 in 0.01 C
+int32_t bme280_compensate_t_fine(int32_t adc_T)
+{
+    int32_t var1 = ((((adc_T >> 3) - ((int32_t)bme280_calib.dig_T1 << 1))) * ((int32_t)bme280_calib.dig_T2)) >> 11;
+    int32_t var2 = (((((adc_T >> 4) - ((int32_t)bme280_calib.dig_T1)) * ((adc_T >> 4) - ((int32_t)bme280_calib.dig_T1))) >> 12) * ((int32_t)bme280_calib.dig_T3)) >> 14;
+    return var1 + var2;
+}
+
+// %RH in Q22.10
+uint32_t bme280_compensate_h(int32_t adc_H, int32_t t_fine)
+{
+    int32_t v_x1_u32r = t_fine - ((int32_t)76800);
+    v_x1_u32r = (((((adc_H << 14) - (((int32_t)bme280_calib.dig_H4) << 20) - (((int32_t)bme280_calib.dig_H5) * v_x1_u32r)) + ((int32_t)16384)) >> 15) *
+                 (((((((v_x1_u32r * ((int32_t)bme280_calib.dig_H6)) >> 10) * (((v_x1_u32r * ((int32_t)bme280_calib.dig_H3)) >> 11) + ((int32_t)32768))) >> 10) + ((int32_t)2097152)) * ((int32_t)bme280_calib.dig_H2) + 8192) >> 14));
+    v_x1_u32r = (v_x1_u32r - (((((v_x1_u32r >> 15) * (v_x1_u32r >> 15)) >> 7) * ((int32_t)bme280_calib.dig_H1)) >> 4));
+    v_x1_u32r = (v_x1_u32r < 0 ? 0 : v_x1_u32r);
+    v_x1_u32r = (v_x1_u32r > 419430400 ? 419430400 : v_x1_u32r);
+    return (uint32_t)(v_x1_u32r >> 12);
+}
+
+sensor_status_t bme280_collect(sensor_reading_t &reading, bool last_call)
+{
+    uint8_t status;
+    if (!sensor_i2c_read_register(bme280_address, BME280_REG_STATUS, &status, 1))
+        return SENSOR_TIMEOUT;
+    if (status & BME280_STATUS_MEASURING)
+        return last_call ? SENSOR_TIMEOUT : SENSOR_BUSY;
+
+    uint8_t data[5];
+    if (!sensor_i2c_read_register(bme280_address, BME280_REG_DATA_TEMP, data, sizeof(data)))
+        return SENSOR_TIMEOUT;
+    int32_t adc_T = (int32_t)data[0] << 12 | data[1] << 4 | data[2] >> 4;
+    int32_t adc_H = data[3] << 8 | data[4];
+    // there is no checksum. A skipped value is the best there is to tell that the measurement didn't happen
+    if (adc_T == BME280_ADC_SKIPPED)
+        return SENSOR_BAD_DATA;
+
+    int32_t t_fine = bme280_compensate_t_fine(adc_T);
+    reading.temperature = (((t_fine * 5 + 128) >> 8) * Q8_ONE + 50) / 100;
+    reading.humidity = bme280_compensate_h(adc_H, t_fine) >> 2;
+    return SENSOR_OK;
+}
+
+const sensor_driver_t bme280_driver = {
+    "bme280",
+    true,
+    Q8_FROM_INT(1) / 2, // F
+    Q8_FROM_INT(2),     // its humidity is less accurate than the temperature
+    Q8_FROM_INT(1) / 10,
+    Q8_ONE / 50, // 0.01 C
+    BME280_CONVERSION_MS,
+    BME280_POLL_MS,
+    BME280_TIMEOUT_MS,
+    bme280_init,
+    bme280_trigger,
+    bme280_collect,
+};
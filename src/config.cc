@@ -18,6 +18,7 @@ ThermConfig::ThermConfig() : ssid(""), pass("")
     calibration_offset_temp = 0;
     calibration_offset_hum = 0;
     relays_available = false;
+    sensor_type = SENSOR_TYPE_DHT11;
 }
 
 ThermConfig::~ThermConfig()
@@ -72,6 +73,13 @@ bool ThermConfig::read(const char *filePath)
         trim_string(val_str);
         relays_available = val_str.toInt();
     }
+
+    {
+        // missing in config files from before there was a choice, which is the DHT11
+        String val_str = configFile.readStringUntil('\n');
+        trim_string(val_str);
+        sensor_type = val_str.toInt();
+    }
     
     configFile.close();
     return true;
@@ -113,6 +121,12 @@ bool ThermConfig::write(const char *filePath)
     configFile.write(relays_available ? "1" : "0", 1);
     configFile.write('\n');
 
+    {
+        String val_str = String(sensor_type);
+        configFile.write(val_str.c_str(), val_str.length());
+        configFile.write('\n');
+    }
+
     configFile.close();
     return true;
 }
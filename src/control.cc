@@ -4,8 +4,10 @@
 
 #include "config.h"
 #include "tasks.h"
+#include "coro.h"
 #include "mqtt.h"
 #include "disp.h"
+#include "sensor.h"
 #include "utils.h"
 
 int64_t last_fan_off_ts = -1;
@@ -37,14 +39,14 @@ bool fan_off()
 
       therm_state.fan_relay = 0;
       digitalWrite(RELAY_FAN_PIN, LOW);
-      /* bool was_fan_off_task_removed = */ sched.remove_task((void *)fan_off, 0);
+      /* bool was_fan_off_task_removed = */ sched.remove_task<fan_off>(0);
       // Serial.println(String("fan turned off. scheduled task removed = ") + was_fan_off_task_removed);
-      last_fan_off_ts = millis();
+      last_fan_off_ts = get_ts_ms();
+      sensor_relays_changed();
       ret = true;
     }
   }
-  sched.add_or_update_task((void *)send_mqtt_state_relays, 0, NULL, 0, 0, 100);
-  draw_icon_fan(therm_state.fan_relay);
+  sched.add_or_update_task<send_mqtt_state_relays>(0, NULL, 0, 0, 100);
   return ret;
 }
 
@@ -66,7 +68,7 @@ bool fan_on()
   {
     // check for cooldown. We don't want to turn the fan on immediately after it was turned off
     // but if the heat is on, we'd honor the fan_on request even in the cooldown period
-    if ((!therm_state.heat_relay) && (last_fan_off_ts > 0 && millis() - last_fan_off_ts < MS_FROM_MINUTES(5)))
+    if ((!therm_state.heat_relay) && (last_fan_off_ts > 0 && get_ts_ms() - last_fan_off_ts < MS_FROM_MINUTES(5)))
     {
       ret = false;
       // Serial.println(String("fan in cooldown mode, not turning back on"));
@@ -76,21 +78,33 @@ bool fan_on()
       therm_state.fan_relay = 1;
       digitalWrite(RELAY_FAN_PIN, HIGH);
       // Serial.println(String("fan turned on. scheduled Off task = ") + was_fan_off_task_added);
-      /* bool was_fan_off_task_added = */ sched.add_or_update_task((void *)fan_off, 0, NULL, 0, 0, MS_FROM_MINUTES(120)); // safety task: fan can't run continuously for too long
+      /* bool was_fan_off_task_added = */ sched.add_or_update_task<fan_off>(0, NULL, 0, 0, MS_FROM_MINUTES(120)); // safety task: fan can't run continuously for too long
       // fan is now on, no need to hold on to the last 'off' timestamp
       last_fan_off_ts = -1;
+      sensor_relays_changed();
       ret = true;
     }
   }
-  /* bool was_fan_on_task_removed = */ sched.remove_task((void *)fan_on, 0);
-  // Serial.println(String("scheduled Fan On task removed = ") + was_fan_on_task_removed);
-
-  sched.add_or_update_task((void *)send_mqtt_state_relays, 0, NULL, 0, 0, 100);
-  draw_icon_fan(therm_state.fan_relay);
+  sched.add_or_update_task<send_mqtt_state_relays>(0, NULL, 0, 0, 100);
   return ret;
 }
 
 int64_t last_heat_off_ts = -1, last_heat_on_ts = -1;
+
+// safety sequence for a heating session, started by heat_on() and cancelled by heat_off()
+coro_t heat_session_frame;
+void heat_session_coro(coro_t *co)
+{
+  CORO_BEGIN(co);
+  // fan must come on few seconds after heat does, even if we don't hear anything from the controller
+  CORO_AWAIT_DELAY(co, MS_FROM_MINUTES(1));
+  fan_on();
+  // heat can not run for for too long
+  CORO_AWAIT_DELAY(co, MS_FROM_MINUTES(30) - MS_FROM_MINUTES(1));
+  heat_off();
+  CORO_END(co);
+}
+
 bool heat_off()
 {
   // Serial.println("heat off called");
@@ -107,7 +121,7 @@ bool heat_off()
   else
   {
     // enforce minimum running time for a heating session
-    if (last_heat_on_ts > 0 && millis() - last_heat_on_ts < MS_FROM_MINUTES(5))
+    if (last_heat_on_ts > 0 && get_ts_ms() - last_heat_on_ts < MS_FROM_MINUTES(5))
     {
       // Serial.println(String("heating hasn't been running long enough. Not stopping."));
       ret = false;
@@ -116,17 +130,16 @@ bool heat_off()
     {
       therm_state.heat_relay = 0;
       digitalWrite(RELAY_HEAT_PIN, LOW);
-      /* bool was_heat_on_task_removed = */ sched.remove_task((void *)fan_on, 0);
-      /* bool was_heat_off_task_removed = */ sched.remove_task((void *)heat_off, 0);
-      // Serial.println(String("heat turned off. scheduled task removed status: fan on = ") + was_heat_on_task_removed + String(", heat off = ") + was_heat_off_task_removed);
+      /* bool was_heat_session_removed = */ sched.remove_task<heat_session_coro>(0);
+      // Serial.println(String("heat turned off. heat session removed = ") + was_heat_session_removed);
 
-      last_heat_off_ts = millis();
+      last_heat_off_ts = get_ts_ms();
       last_heat_on_ts = -1; // heat is now off, no need to hold on to the last 'on' timestamp
+      sensor_relays_changed();
       ret = true;
     }
   }
-  sched.add_or_update_task((void *)send_mqtt_state_relays, 0, NULL, 0, 0, 100);
-  draw_icon_heat(therm_state.heat_relay);
+  sched.add_or_update_task<send_mqtt_state_relays>(0, NULL, 0, 0, 100);
   return ret;
 }
 
@@ -147,7 +160,7 @@ bool heat_on()
   else
   {
     // check for cooldown. We don't want to turn the heat on immediately after it was turned off
-    if (last_heat_off_ts > 0 && millis() - last_heat_off_ts < MS_FROM_MINUTES(5))
+    if (last_heat_off_ts > 0 && get_ts_ms() - last_heat_off_ts < MS_FROM_MINUTES(5))
     {
       // Serial.println(String("heat won't turn on. in cooldown"));
 
@@ -157,19 +170,18 @@ bool heat_on()
     {
       therm_state.heat_relay = 1;
       digitalWrite(RELAY_HEAT_PIN, HIGH);
-      /* bool was_fan_on_task_added = */ sched.add_or_update_task((void *)fan_on, 0, NULL, 0, 0, MS_FROM_MINUTES(1));      // safety task: fan must come on few seconds after heat does, even if we don't hear anything from the controller
-      /* bool was_heat_off_task_added = */ sched.add_or_update_task((void *)heat_off, 0, NULL, 0, 0, MS_FROM_MINUTES(30)); // safety task: heat can not run for for too long
+      /* bool was_heat_session_started = */ start_coro<heat_session_coro>(0, &heat_session_frame, 0);
 
-      // Serial.println(String("heat turned on. scheduled task added: fan on = ") + was_fan_on_task_added + String(" , heat off = ") + was_heat_off_task_added);
+      // Serial.println(String("heat turned on. heat session started = ") + was_heat_session_started);
 
-      last_heat_on_ts = millis();
+      last_heat_on_ts = get_ts_ms();
       last_heat_off_ts = -1; // heat is now on, no need to hold on to the last 'off' timestamp
+      sensor_relays_changed();
 
       ret = true;
     }
   }
-  sched.add_or_update_task((void *)send_mqtt_state_relays, 0, NULL, 0, 0, 100);
-  draw_icon_heat(therm_state.heat_relay);
+  sched.add_or_update_task<send_mqtt_state_relays>(0, NULL, 0, 0, 100);
   return ret;
 }
 
@@ -177,6 +189,5 @@ void update_target_temp(float target)
 {
   // Serial.println(String("set temp = ") + target);
   therm_state.tgt_temp = target;
-  draw_target_temp();
-  sched.add_or_update_task((void *)send_mqtt_state_target_temp, 0, NULL, 0, 0, 100);
+  sched.add_or_update_task<send_mqtt_state_target_temp>(0, NULL, 0, 0, 100);
 }
@@ -1,117 +1,113 @@
-#include <ctype.h>
-
-#include "dht11.h"
+#include "sensor.h"
 #include "config.h"
-#include "tasks.h"
-#include "mqtt.h"
-#include "disp.h"
-#include "utils.h"
 
-#include <Adafruit_Sensor.h>
-#include <DHT.h>
-#include <DHT_U.h>
+// DHT11 single wire protocol, decoded from interrupts instead of bit-banged with interrupts off:
+// the host pulls the line low for DHT11_START_LOW_MS and releases it. The sensor answers with 80 us low, 80 us high,
+// then sends 40 bits as 50 us low followed by 26-28 us (0) or 70 us (1) high, and ends with 50 us low.
+// the ISR timestamps every falling edge, so each bit is the time between two falling edges: ~78 us or ~120 us.
+// that is 42 falling edges per frame: the response, the start of each bit, and the end of the last one
+#define DHT11_START_LOW_MS 20
+#define DHT11_FRAME_TIMEOUT_MS 10 // a frame takes about 5 ms
+#define DHT11_NUM_EDGES 42
+#define DHT11_BIT_THRESHOLD_US 100 // falling to falling edge, longer is a 1
+#define DHT11_BIT_MAX_US 200
 
-struct
-{
-    float temp_window_sum = NAN, hum_window_sum = NAN;
-    uint8 temp_sample_counts = 0, hum_sample_counts = 0;
-} dht11_avg_storage;
+volatile uint32_t dht11_edges[DHT11_NUM_EDGES]; // ESP.getCycleCount() at every falling edge of the frame
+volatile uint8_t dht11_num_edges = 0;
+bool dht11_listening = false;
 
-DHT_Unified dht_sensor(DHT11_PIN, DHT11); // DHT temp sensor (adafruit library)
+ICACHE_RAM_ATTR void dht11_interrupt_handler()
+{
+    uint8_t num_edges = dht11_num_edges;
+    if (num_edges >= DHT11_NUM_EDGES)
+        return;
+    dht11_edges[num_edges] = ESP.getCycleCount();
+    dht11_num_edges = ++num_edges;
+    if (num_edges == DHT11_NUM_EDGES)
+        sensor_notify_from_isr();
+}
 
-void dht11_sensor_read_task(void *)
+// turns the edge timestamps into the 5 bytes of the frame. Returns false on a malformed frame or a checksum mismatch
+bool dht11_decode(uint8_t *data)
 {
-    // Get temperature event and print its value.
-    sensors_event_t event;
-    dht_sensor.temperature().getEvent(&event);
-    if (isnan(event.temperature))
+    uint32_t cycles_per_us = ESP.getCpuFreqMHz();
+    memset(data, 0, 5);
+    for (int bit = 0; bit < 40; bit++)
     {
-        Serial.println(F("Error reading temperature!"));
+        uint32_t bit_us = (dht11_edges[bit + 2] - dht11_edges[bit + 1]) / cycles_per_us;
+        if (bit_us > DHT11_BIT_MAX_US)
+            return false;
+        data[bit / 8] = data[bit / 8] << 1 | (bit_us > DHT11_BIT_THRESHOLD_US);
     }
-    else
-    {
-        float temperature = event.temperature * 1.8 + 32;
-
-        // Serial.print(F("Temperature: "));
-        // Serial.print(temperature);
-        // Serial.println(F("°F"));
+    return (uint8_t)(data[0] + data[1] + data[2] + data[3]) == data[4];
+}
 
-        if (dht11_avg_storage.temp_sample_counts == 0)
-        {
-            dht11_avg_storage.temp_window_sum = temperature;
-        }
-        else
-        {
-            while (dht11_avg_storage.temp_sample_counts >= NUM_SAMPLES_FOR_TEMP_AVG)
-            {
-                therm_state.uncal_cur_temp = dht11_avg_storage.temp_window_sum / dht11_avg_storage.temp_sample_counts;
-                dht11_avg_storage.temp_window_sum -= therm_state.uncal_cur_temp;
-                therm_state.cur_temp = therm_state.uncal_cur_temp + therm_conf.calibration_offset_temp;
-                --dht11_avg_storage.temp_sample_counts;
-            }
+bool dht11_init()
+{
+    // idle high between reads
+    pinMode(DHT11_PIN, INPUT_PULLUP);
+    return true;
+}
 
-            dht11_avg_storage.temp_window_sum += temperature;
-        }
-        ++dht11_avg_storage.temp_sample_counts;
-    }
-    // Get humidity event and print its value.
-    dht_sensor.humidity().getEvent(&event);
-    if (isnan(event.relative_humidity))
-    {
-        Serial.println(F("Error reading humidity!"));
-    }
-    else
+// start signal
+bool dht11_trigger()
+{
+    if (dht11_listening)
     {
-        // Serial.print(F("Humidity: "));
-        // Serial.print(event.relative_humidity);
-        // Serial.println(F("%"));
-
-        if (dht11_avg_storage.hum_sample_counts == 0)
-        {
-            dht11_avg_storage.hum_window_sum = event.relative_humidity;
-        }
-        else
-        {
-            while (dht11_avg_storage.hum_sample_counts >= NUM_SAMPLES_FOR_TEMP_AVG)
-            {
-                therm_state.uncal_cur_hum = dht11_avg_storage.hum_window_sum / dht11_avg_storage.hum_sample_counts;
-                dht11_avg_storage.hum_window_sum -= therm_state.uncal_cur_hum;
-                therm_state.cur_hum = therm_state.uncal_cur_hum + therm_conf.calibration_offset_hum;
-                --dht11_avg_storage.hum_sample_counts;
-            }
-
-            dht11_avg_storage.hum_window_sum += event.relative_humidity;
-        }
-        ++dht11_avg_storage.hum_sample_counts;
+        // the previous read was cut short
+        detachInterrupt(digitalPinToInterrupt(DHT11_PIN));
+        dht11_listening = false;
     }
+    pinMode(DHT11_PIN, OUTPUT);
+    digitalWrite(DHT11_PIN, LOW);
+    return true;
 }
 
-void dht11_sensor_report_task()
+// ends the start signal on the first call, then waits for the ISR to collect the frame
+sensor_status_t dht11_collect(sensor_reading_t &reading, bool last_call)
 {
-    if (isnan(therm_state.cur_temp) || isnan(therm_state.cur_hum))
+    if (!dht11_listening)
     {
-        return;
+        dht11_num_edges = 0;
+        attachInterrupt(digitalPinToInterrupt(DHT11_PIN), dht11_interrupt_handler, FALLING);
+        pinMode(DHT11_PIN, INPUT_PULLUP);
+        dht11_listening = true;
     }
+    if (dht11_num_edges < DHT11_NUM_EDGES && !last_call)
+        return SENSOR_BUSY;
+    detachInterrupt(digitalPinToInterrupt(DHT11_PIN));
+    dht11_listening = false;
 
-    if (isnan(therm_state.last_reported_temp) ||
-        (abs(therm_state.last_reported_temp - therm_state.cur_temp) >= MIN_TEMP_DELTA_BETWEEN_REPORTS || abs(therm_state.last_reported_hum - therm_state.cur_hum) >= MIN_HUM_DELTA_BETWEEN_REPORTS || millis() - therm_state.last_reported_ts > TEMP_REPORT_NOCHANGE_PERIOD))
+    if (dht11_num_edges < DHT11_NUM_EDGES)
     {
-        therm_state.last_reported_temp = therm_state.cur_temp;
-        therm_state.last_reported_hum = therm_state.cur_hum;
-        therm_state.last_reported_ts = millis();
-        send_mqtt_state_cur_temp();
+        Serial.println(String("dht11: ") + dht11_num_edges + " edges");
+        return SENSOR_TIMEOUT;
     }
 
-    draw_current_temp();
-    draw_humidity();
-}
+    uint8_t data[5];
+    if (!dht11_decode(data))
+        return SENSOR_BAD_DATA;
 
-void setup_dht()
-{
-    // Initialize device.
-    dht_sensor.begin();
-
-    const int temp_read_n_seconds = 5;
-    sched.add_or_update_task((void *)&dht11_sensor_read_task, 0, NULL, 1, MS_FROM_SECONDS(temp_read_n_seconds), 0 /*5000*/);
-    sched.add_or_update_task((void *)&dht11_sensor_report_task, 0, NULL, 1, MS_FROM_SECONDS(temp_read_n_seconds), MS_FROM_SECONDS(NUM_SAMPLES_FOR_TEMP_AVG * temp_read_n_seconds));
+    // integer and tenths. Sensors that report below zero set the top bit of the tenths
+    reading.temperature = Q8_FROM_INT(data[2]) + Q8_FROM_INT(data[3] & 0x7F) / 10;
+    if (data[3] & 0x80)
+        reading.temperature = -reading.temperature;
+    reading.humidity = Q8_FROM_INT(data[0]) + Q8_FROM_INT(data[1]) / 10;
+    return SENSOR_OK;
 }
+
+// the DHT11 reads whole degrees C and %RH, so readings that differ by less than a couple of steps are never outliers
+const sensor_driver_t dht11_driver = {
+    "dht11",
+    false,
+    Q8_FROM_INT(2), // F, a bit over one step of the sensor
+    Q8_FROM_INT(2),
+    Q8_FROM_INT(8) / 10, // F, on top of rounding to whole degrees C
+    Q8_FROM_INT(9) / 5,  // 1 C
+    DHT11_START_LOW_MS,
+    DHT11_FRAME_TIMEOUT_MS,
+    DHT11_FRAME_TIMEOUT_MS,
+    dht11_init,
+    dht11_trigger,
+    dht11_collect,
+};
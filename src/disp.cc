@@ -1,21 +1,58 @@
 #include "disp.h"
 #include "config.h"
+#include "glyphs.h"
 #include "tasks.h"
+#include "utils.h"
 
 #include <SPI.h>
 #include <Wire.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
-#include <Fonts/FreeMono9pt7b.h>
-#include <Fonts/FreeMono12pt7b.h>
-#include <Fonts/FreeMono24pt7b.h>
-#include <Fonts/FreeMonoBold12pt7b.h>
-#include <Fonts/FreeMonoBold24pt7b.h>
+
+// I2C bus clock. 400 kHz is the SSD1306 spec; most modules work well beyond that, which shortens every transfer.
+// Adafruit's transactions leave the bus at this clock too, and the SHT3x and BME280 share it, so it is their clock
+// as well: both are fine up to it and well beyond (SHT3x 1 MHz, BME280 3.4 MHz). Raising it past 1 MHz with an
+// SHT3x attached needs the sensor's clock restored around its transfers
+#ifndef DISP_I2C_CLOCK_HZ
+#define DISP_I2C_CLOCK_HZ 400000UL
+#endif
+
+#define DISP_I2C_ADDRESS 0x3C
+#define DISP_NUM_PAGES (SCREEN_HEIGHT / 8) // the controller addresses its memory in pages of 8 rows, one byte per column
+// data bytes per I2C transaction, leaving room for the control byte in the Wire buffer. This is also what is sent per
+// scheduler slot, about 3 ms at 400 kHz
+#define DISP_I2C_MAX_CHUNK (BUFFER_LENGTH - 1)
+// what user input changed is sent right away, without going through the scheduler, up to this many bytes. That
+// covers the setpoint readout; anything beyond goes a chunk per slot as usual
+#define DISP_INPUT_MAX_SYNC_BYTES 192
 
 // screen related
-// Declaration for an SSD1306 display connected to I2C (SDA, SCL pins)
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire);
-bool bright_mode = false;
+// Declaration for an SSD1306 display connected to I2C (SDA, SCL pins).
+Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, -1, DISP_I2C_CLOCK_HZ, DISP_I2C_CLOCK_HZ);
+bool bright_mode = false, applied_bright_mode = true;
+
+// columns [col_min, col_max] of every page that was drawn to since the last flush. col_min > col_max = clean
+struct dirty_range_t
+{
+    uint8_t col_min, col_max;
+};
+dirty_range_t dirty_pages[DISP_NUM_PAGES];
+
+// the frame being sent. Dirty areas are copied here when a flush starts, so drawing can go on while the transfer
+// is spread over several scheduler slots without the panel ever showing half of an update. The one exception is
+// input: what it changed is copied in and sent ahead of whatever is left of the frame going out
+uint8_t tx_buffer[SCREEN_WIDTH * DISP_NUM_PAGES];
+dirty_range_t tx_pages[DISP_NUM_PAGES]; // what is left to send of each page
+int tx_page = DISP_NUM_PAGES;           // first page with something left to send, DISP_NUM_PAGES when idle
+dirty_range_t tx_input[DISP_NUM_PAGES]; // what input drew that is still to be sent. It goes first
+
+disp_stats_t disp_stats = {};
+uint32_t tx_frame_bytes = 0; // sent so far of the frame that is going out
+
+// input-to-photon latency: the oldest input the next frame answers, and the one answered by the frame going out.
+// timestamps are ESP.getCycleCount(), which can be taken in an ISR
+bool input_pending = false, tx_input_pending = false;
+uint32_t input_cycles = 0, tx_input_cycles = 0;
 
 ///////////////////////////////////////////////////////////////////////////////////////
 // graphics
@@ -52,189 +89,798 @@ const unsigned char bmp_local_mode[] PROGMEM = {
 
 ///////////////////////////////////////////////////////////////////////////////////////
 
+void update_screen();
+bool is_screen_switch_pending();
+
+// every draw into the framebuffer must report the area it touched, or it won't make it to the panel
+void mark_dirty(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+    if (x < 0)
+    {
+        w += x;
+        x = 0;
+    }
+    if (y < 0)
+    {
+        h += y;
+        y = 0;
+    }
+    w = min<int16_t>(w, SCREEN_WIDTH - x);
+    h = min<int16_t>(h, SCREEN_HEIGHT - y);
+    if (w <= 0 || h <= 0)
+        return;
+
+    for (int page = y / 8; page <= (y + h - 1) / 8; page++)
+    {
+        dirty_pages[page].col_min = min<int16_t>(dirty_pages[page].col_min, x);
+        dirty_pages[page].col_max = max<int16_t>(dirty_pages[page].col_max, x + w - 1);
+    }
+}
+
+void clear_dirty(int page)
+{
+    dirty_pages[page].col_min = UINT8_MAX;
+    dirty_pages[page].col_max = 0;
+}
+
+// sends num_bytes of page, starting at col, through the controller's addressing window.
+// every chunk sets its own window, so a transfer can stop and resume anywhere
+void send_chunk(int page, uint8_t col, int num_bytes)
+{
+    // Co = 0, D/C = 0: the rest of the transaction is commands
+    Wire.beginTransmission(DISP_I2C_ADDRESS);
+    Wire.write((uint8_t)0x00);
+    Wire.write((uint8_t)SSD1306_PAGEADDR);
+    Wire.write((uint8_t)page);
+    Wire.write((uint8_t)page);
+    Wire.write((uint8_t)SSD1306_COLUMNADDR);
+    Wire.write(col);
+    Wire.write((uint8_t)(col + num_bytes - 1));
+    Wire.endTransmission();
+
+    // Co = 0, D/C = 1: the rest of the transaction is display data
+    Wire.beginTransmission(DISP_I2C_ADDRESS);
+    Wire.write((uint8_t)0x40);
+    Wire.write(tx_buffer + page * SCREEN_WIDTH + col, num_bytes);
+    Wire.endTransmission();
+
+    // data, plus the window command and the address / control bytes
+    disp_stats.bytes_sent += num_bytes + 10;
+    tx_frame_bytes += num_bytes + 10;
+}
+
+// skips tx_page past pages that have been sent completely. Returns false once the whole frame is out
+bool tx_pending()
+{
+    while (tx_page < DISP_NUM_PAGES && tx_pages[tx_page].col_min > tx_pages[tx_page].col_max)
+    {
+        tx_page++;
+    }
+    return tx_page < DISP_NUM_PAGES;
+}
+
+void record_input_latency(uint32_t latency_us)
+{
+    int bucket = 0;
+    while (bucket < DISP_LATENCY_NUM_BUCKETS && latency_us > disp_latency_bucket_ms[bucket] * 1000U)
+    {
+        bucket++;
+    }
+    ++disp_stats.latency_buckets[bucket];
+    ++disp_stats.num_latencies;
+    disp_stats.total_latency_us += latency_us;
+    disp_stats.max_latency_us = max(disp_stats.max_latency_us, latency_us);
+}
+
+// the input the frame answers is on the panel
+void input_shown()
+{
+    if (tx_input_pending)
+        record_input_latency((ESP.getCycleCount() - tx_input_cycles) / ESP.getCpuFreqMHz());
+    tx_input_pending = false;
+}
+
+// first page with input left to send, DISP_NUM_PAGES if there is none
+int next_input_page()
+{
+    int page = 0;
+    while (page < DISP_NUM_PAGES && tx_input[page].col_min > tx_input[page].col_max)
+    {
+        page++;
+    }
+    return page;
+}
+
+// data bytes in the next chunk of range
+int next_chunk_size(const dirty_range_t &range)
+{
+    return min(range.col_max + 1 - range.col_min, DISP_I2C_MAX_CHUNK);
+}
+
+// sends the next chunk of what is left of range, on page. Returns the bytes it took, as send_chunk() counts them
+int send_next_chunk(int page, dirty_range_t &range)
+{
+    int num_bytes = next_chunk_size(range);
+    uint32_t start_us = micros();
+    send_chunk(page, range.col_min, num_bytes);
+    disp_stats.max_chunk_us = max(disp_stats.max_chunk_us, (uint32_t)(micros() - start_us));
+    range.col_min += num_bytes;
+    return num_bytes + 10;
+}
+
+// sends the next chunk of the input, cutting it off the rest of the page unless it sits in the middle of it
+int send_next_input_chunk(int page)
+{
+    dirty_range_t &range = tx_pages[page];
+    uint8_t sent_min = tx_input[page].col_min;
+    int num_bytes = send_next_chunk(page, tx_input[page]);
+    uint8_t sent_max = tx_input[page].col_min - 1;
+    if (range.col_min <= range.col_max)
+    {
+        if (range.col_min >= sent_min && range.col_min <= sent_max)
+            range.col_min = sent_max + 1;
+        else if (range.col_max >= sent_min && range.col_max <= sent_max)
+            range.col_max = sent_min - 1;
+    }
+
+    if (next_input_page() == DISP_NUM_PAGES)
+        input_shown();
+    return num_bytes;
+}
+
+void end_frame()
+{
+    ++disp_stats.num_frames;
+    disp_stats.last_frame_bytes = tx_frame_bytes;
+    disp_stats.max_frame_bytes = max(disp_stats.max_frame_bytes, tx_frame_bytes);
+    input_shown();
+}
+
+bool start_flush();
+
+// sends one chunk per scheduler slot, so a frame never holds up the loop for longer than one chunk takes
+void disp_flush_task()
+{
+    if (!tx_pending())
+        return;
+
+    int input_page = next_input_page();
+    if (input_page < DISP_NUM_PAGES)
+        send_next_input_chunk(input_page);
+    else
+        send_next_chunk(tx_page, tx_pages[tx_page]);
+
+    if (tx_pending())
+    {
+        // come back on the next pass, after whatever else is due
+        sched.add_or_update_task<disp_flush_task>(0, NULL, 0, 0, 0);
+    }
+    else
+    {
+        end_frame();
+
+        // input that came in while this frame was going out doesn't wait for the next refresh tick
+        if (input_pending)
+        {
+            update_screen();
+            if (start_flush())
+                sched.add_or_update_task<disp_flush_task>(0, NULL, 0, 0, 0);
+        }
+    }
+}
+
+// copies what was drawn since the last snapshot into tx_buffer and adds it to what is left to send, starting a
+// frame if none is going out. Returns false if nothing was drawn
+bool snapshot_dirty()
+{
+    if (!tx_pending())
+        tx_frame_bytes = 0;
+
+    // only what changed goes over the bus. Most frames nothing did
+    bool is_dirty = false;
+    const uint8_t *buffer = display.getBuffer();
+    for (int page = 0; page < DISP_NUM_PAGES; page++)
+    {
+        dirty_range_t &dirty = dirty_pages[page];
+        if (dirty.col_min > dirty.col_max)
+            continue;
+        int offset = page * SCREEN_WIDTH + dirty.col_min;
+        memcpy(tx_buffer + offset, buffer + offset, dirty.col_max + 1 - dirty.col_min);
+
+        dirty_range_t &range = tx_pages[page];
+        if (range.col_min > range.col_max)
+        {
+            range = dirty;
+        }
+        else
+        {
+            range.col_min = min(range.col_min, dirty.col_min);
+            range.col_max = max(range.col_max, dirty.col_max);
+        }
+        clear_dirty(page);
+        is_dirty = true;
+    }
+    if (is_dirty)
+        tx_page = 0;
+    return is_dirty;
+}
+
+// sets up what was drawn since the last frame to be sent. Returns false if nothing was.
+// only input adds to a frame that is still going out; the refresh tick waits for it to finish
+bool start_flush()
+{
+    bool is_dirty = snapshot_dirty();
+
+    // input that didn't change anything on screen has nothing to wait for. The latency runs from the oldest input
+    // the frame answers
+    if (input_pending && is_dirty && !tx_input_pending)
+    {
+        tx_input_pending = true;
+        tx_input_cycles = input_cycles;
+    }
+    input_pending = false;
+    return is_dirty;
+}
+
 void refresh_display()
 {
-    display.dim(!bright_mode);
-    display.display();
+    update_screen();
+
+    if (bright_mode != applied_bright_mode)
+    {
+        display.dim(!bright_mode);
+        applied_bright_mode = bright_mode;
+    }
+
+    // the previous frame is still going out. Whatever got drawn since waits for the next one
+    if (tx_pending())
+        return;
+
+    if (start_flush())
+        disp_flush_task();
 }
 
-void init_disp()
+void refresh_display_for_input(uint32_t cycles)
 {
-    // SSD1306_SWITCHCAPVCC = generate display voltage from 3.3V internally
-    if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C))
-    { // Address 0x3D for 128x64
-        Serial.println(F("SSD1306 allocation failed"));
-        for (;;)
-            ; // Don't proceed, loop forever
+    if (!input_pending)
+    {
+        input_pending = true;
+        input_cycles = cycles;
     }
 
-    // no need to display the default adafruit logo, clear it.
-    display.clearDisplay();
-    set_bright_mode(false);
+    // a screen switch redraws the whole screen, a full frame of chunks. That's for the refresh task to render and
+    // send; it runs on the next pass instead of its next tick, and its frame answers this input
+    if (is_screen_switch_pending())
+    {
+        sched.notify_task<refresh_display>(0);
+        return;
+    }
+
+    // whatever was drawn before this input is queued in its turn, so that only what the input draws goes ahead of
+    // the rest, even of a frame that is going out: every chunk sets its own window, so that frame carries on where
+    // it left off. For a knob turn it's the setpoint readout
+    snapshot_dirty();
+    update_screen();
+    dirty_range_t input_pages[DISP_NUM_PAGES];
+    memcpy(input_pages, dirty_pages, sizeof(input_pages));
+    if (!start_flush())
+    {
+        if (tx_pending())
+            sched.add_or_update_task<disp_flush_task>(0, NULL, 0, 0, 0);
+        return;
+    }
+    for (int page = 0; page < DISP_NUM_PAGES; page++)
+    {
+        dirty_range_t &input = tx_input[page];
+        if (input.col_min > input.col_max)
+        {
+            input = input_pages[page];
+        }
+        else if (input_pages[page].col_min <= input_pages[page].col_max)
+        {
+            input.col_min = min(input.col_min, input_pages[page].col_min);
+            input.col_max = max(input.col_max, input_pages[page].col_max);
+        }
+    }
+
+    // sent right away up to DISP_INPUT_MAX_SYNC_BYTES, the rest first thing on the next passes
+    int sync_bytes = 0;
+    for (int page = next_input_page(); page < DISP_NUM_PAGES; page = next_input_page())
+    {
+        if (sync_bytes + next_chunk_size(tx_input[page]) + 10 > DISP_INPUT_MAX_SYNC_BYTES)
+            break;
+        sync_bytes += send_next_input_chunk(page);
+    }
 
-    sched.add_or_update_task((void *)refresh_display, 0, NULL, 0, 40, 0); // about 25 FPS
+    if (tx_pending())
+        sched.add_or_update_task<disp_flush_task>(0, NULL, 0, 0, 0);
+    else
+        end_frame();
 }
 
-void set_bright_mode(bool bright)
+bool is_disp_flushing()
 {
-    bright_mode = bright;
+    return tx_pending();
+}
+
+const disp_stats_t &get_disp_stats()
+{
+    return disp_stats;
+}
+
+uint32_t get_disp_latency_percentile_ms(int percentile)
+{
+    if (!disp_stats.num_latencies)
+        return 0;
+
+    uint32_t rank = ((uint64_t)disp_stats.num_latencies * percentile + 99) / 100;
+    uint32_t count = 0;
+    for (int bucket = 0; bucket < DISP_LATENCY_NUM_BUCKETS; bucket++)
+    {
+        count += disp_stats.latency_buckets[bucket];
+        if (count >= rank)
+            return disp_latency_bucket_ms[bucket];
+    }
+    return (disp_stats.max_latency_us + 999) / 1000;
 }
 
-void draw_current_temp()
+void get_screen_pbm_rows(int page, uint8_t *rows)
 {
-    GFXcanvas1 canvas(54, 48);
-    canvas.setTextColor(SSD1306_WHITE); // Draw white text
+    // PBM: one bit per pixel, leftmost pixel in the MSB, 1 = black. Lit pixels come out white, like on the panel
+    const uint8_t *columns = display.getBuffer() + page * SCREEN_WIDTH;
+    memset(rows, 0xFF, 8 * SCREEN_WIDTH / 8);
+    for (int col = 0; col < SCREEN_WIDTH; col++)
+    {
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (columns[col] & (1 << bit))
+                rows[bit * SCREEN_WIDTH / 8 + col / 8] &= ~(0x80 >> (col % 8));
+        }
+    }
+}
 
-    // write heading
-    canvas.setCursor(0, 0); // Start at top-left corner
-    canvas.write("Inside:");
+///////////////////////////////////////////////////////////////////////////////////////
+// glyphs for the numeric readouts.
+// the value widgets only ever show a couple of characters out of GLYPH_CHARS. tools/gen_glyphs.py takes those out
+// of GFX's FreeMonoBold fonts at build time into glyphs.h, in flash, straight in the controller's memory layout
+// (pages of 8 rows, one byte per column), so drawing a value is a few hundred byte copies instead of rasterizing a
+// font pixel by pixel.
+// the widgets sit on page boundaries: a label on their first page, the value on the pages below it
+
+struct glyph_set_t
+{
+    const uint8_t *cells; // PROGMEM, [GLYPH_NUM_CHARS][num_pages][width]
+    uint8_t width, num_pages;
+};
 
-    // write value
-    canvas.setTextSize(1);               // Normal 1:1 pixel scale
-    canvas.setFont(&FreeMonoBold24pt7b); // set custom font
-    canvas.setCursor(0, 42);             // this depends on the font
+const glyph_set_t big_glyphs = {big_glyph_cells, BIG_GLYPH_WIDTH, BIG_GLYPH_PAGES};
+const glyph_set_t small_glyphs = {small_glyph_cells, SMALL_GLYPH_WIDTH, SMALL_GLYPH_PAGES};
 
-    String temp_str = "??";
-    if (!isnan(therm_state.cur_temp))
+// copies a glyph out of flash into the framebuffer at column x (clipped to x_end), starting at page first_page
+void blit_glyph(const glyph_set_t &glyphs, char ch, int x, int x_end, int first_page)
+{
+    const char *char_pos = strchr(GLYPH_CHARS, ch);
+    if (!char_pos || x >= x_end)
+        return;
+    int width = min<int>(glyphs.width, x_end - x);
+    const uint8_t *cell = glyphs.cells + (char_pos - GLYPH_CHARS) * glyphs.num_pages * glyphs.width;
+    uint8_t *buffer = display.getBuffer();
+    for (int page = 0; page < glyphs.num_pages; page++)
     {
-        int truncated_temp = therm_state.cur_temp;
-        temp_str.clear();
-        temp_str += truncated_temp % 100;
+        memcpy_P(buffer + (first_page + page) * SCREEN_WIDTH + x, cell + page * glyphs.width, width);
+    }
+}
+
+// the labels above the value readouts never change
+void draw_labels()
+{
+    display.setFont();
+    display.setTextColor(WHITE);
+    display.setCursor(0, 16);
+    display.print("Inside:");
+    display.setCursor(56, 32);
+    display.print("Set:");
+    display.setCursor(90, 32);
+    display.print("Hum:");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// retained widgets. Each one is bound to a ThermState field and remembers what it last put on screen.
+// update_widgets() runs once per frame and re-renders only the widgets whose output would change, so state changes
+// elsewhere in the code don't have to push redraws, and setting a field to the value it already has costs nothing
 
-        // draw fraction bar
-        // canvas.drawPixel(0, 47, WHITE);
-        // canvas.drawPixel(canvas.width() - 1, 47, WHITE);
-        canvas.drawRect(0, 46, (int)(canvas.width() * (therm_state.cur_temp - truncated_temp)), 2, WHITE);
+#define WIDGET_NOT_RENDERED INT32_MIN
 
-        if (truncated_temp >= 100)
+struct icon_widget_t
+{
+    const uint8 *shown; // bound field: the icon is shown while it's non-zero
+    const unsigned char *bitmap;
+    int16_t x, y;
+    int32_t last_key;
+};
+
+// value readout: the integer part (last two digits) and a bar along the bottom that is as long as the fractional part
+struct value_widget_t
+{
+    const float *value; // bound field, NAN shows "??"
+    const glyph_set_t *glyphs;
+    int16_t x, y, width;
+    int16_t marker_y, marker_width, marker_height; // marks a 3 digit value, relative to the widget
+    int32_t last_key;
+};
+
+icon_widget_t icon_widgets[] = {
+    {&therm_state.heat_relay, bmp_flame, 112, 0, WIDGET_NOT_RENDERED},
+    {&therm_state.fan_relay, bmp_fan, 112, 16, WIDGET_NOT_RENDERED},
+    {&therm_state.presence, bmp_person, 96, 0, WIDGET_NOT_RENDERED},
+    {&therm_state.wifi_connected, bmp_wifi, 80, 0, WIDGET_NOT_RENDERED},
+    {&therm_state.mqtt_connected, bmp_homeassistant, 64, 0, WIDGET_NOT_RENDERED},
+    {&therm_state.local_mode, bmp_local_mode, 64, 16, WIDGET_NOT_RENDERED},
+};
+
+value_widget_t value_widgets[] = {
+    {&therm_state.cur_temp, &big_glyphs, 0, 16, 54, 20, 2, 16, WIDGET_NOT_RENDERED},
+    {&therm_state.tgt_temp, &small_glyphs, 56, 32, 32, 12, 1, 10, WIDGET_NOT_RENDERED},
+    {&therm_state.cur_hum, &small_glyphs, 90, 32, 32, 12, 1, 10, WIDGET_NOT_RENDERED},
+};
+
+// identifies what a value widget shows: integer part and bar length
+int32_t value_widget_key(const value_widget_t &widget)
+{
+    float value = *widget.value;
+    if (isnan(value))
+        return WIDGET_NOT_RENDERED + 1;
+    int truncated = value;
+    int bar_width = widget.width * (value - truncated);
+    return truncated * 256 + max(bar_width, 0);
+}
+
+void render_icon_widget(const icon_widget_t &widget, bool show)
+{
+    display.fillRect(widget.x, widget.y, 16, 16, BLACK);
+    if (show)
+        display.drawBitmap(widget.x, widget.y, widget.bitmap, 16, 16, WHITE);
+    mark_dirty(widget.x, widget.y, 16, 16);
+}
+
+void render_value_widget(const value_widget_t &widget)
+{
+    const glyph_set_t &glyphs = *widget.glyphs;
+    int first_page = widget.y / 8 + 1;
+    uint8_t *buffer = display.getBuffer();
+    for (int page = 0; page < glyphs.num_pages; page++)
+    {
+        memset(buffer + (first_page + page) * SCREEN_WIDTH + widget.x, 0, widget.width);
+    }
+
+    float value = *widget.value;
+    char text[4] = "??";
+    int truncated = 0;
+    if (!isnan(value))
+    {
+        truncated = value;
+        snprintf(text, sizeof(text), "%d", truncated % 100);
+    }
+    for (int idx = 0; text[idx]; idx++)
+    {
+        blit_glyph(glyphs, text[idx], widget.x + idx * glyphs.width, widget.x + widget.width, first_page);
+    }
+
+    // the glyph cells cover the whole value area, so anything drawn on top of them goes after them
+    if (!isnan(value))
+    {
+        int bar_width = widget.width * (value - truncated);
+        if (bar_width > 0)
+            display.fillRect(widget.x, (first_page + glyphs.num_pages) * 8 - 2, bar_width, 2, WHITE);
+
+        if (truncated >= 100)
         {
             // for 3 digit temperatures
-            canvas.drawRect(0, 20, 2, 16, WHITE);
+            display.fillRect(widget.x, widget.y + widget.marker_y, widget.marker_width, widget.marker_height, WHITE);
         }
     }
-    canvas.write(temp_str.c_str());
 
-    display.drawBitmap(0, 16, canvas.getBuffer(), canvas.width(), canvas.height(), WHITE, BLACK);
+    mark_dirty(widget.x, first_page * 8, widget.width, glyphs.num_pages * 8);
 }
 
-void draw_target_temp()
+void update_widgets()
 {
-    GFXcanvas1 canvas(32, 32);
-    canvas.setTextColor(SSD1306_WHITE); // Draw white text
+    uint32_t start_us = micros();
+    uint32_t num_renders = 0;
 
-    // write heading
-    canvas.setCursor(0, 0); // Start at top-left corner
-    canvas.write("Set:");
+    for (icon_widget_t &widget : icon_widgets)
+    {
+        int32_t key = *widget.shown != 0;
+        if (key == widget.last_key)
+            continue;
+        render_icon_widget(widget, key);
+        widget.last_key = key;
+        ++num_renders;
+    }
 
-    // write value
-    canvas.setTextSize(1);               // Normal 1:1 pixel scale
-    canvas.setFont(&FreeMonoBold12pt7b); // set custom font
-    canvas.setCursor(0, 26);             // depends on the font
+    for (value_widget_t &widget : value_widgets)
+    {
+        int32_t key = value_widget_key(widget);
+        if (key == widget.last_key)
+            continue;
+        render_value_widget(widget);
+        widget.last_key = key;
+        ++num_renders;
+    }
 
-    String temp_str = "??";
-    if (!isnan(therm_state.tgt_temp))
+    if (num_renders)
     {
-        int truncated_temp = therm_state.tgt_temp;
-        temp_str.clear();
-        temp_str += truncated_temp % 100;
+        uint32_t render_us = micros() - start_us;
+        disp_stats.widget_renders += num_renders;
+        disp_stats.total_render_us += render_us;
+        disp_stats.max_render_us = max(disp_stats.max_render_us, render_us);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// history screen: cur_temp (solid) and tgt_temp (dotted) over the last few hours, one column per sample, newest on
+// the right, with the times the heat and fan relays were on as bars underneath.
+// when a sample comes in, the chart is shifted left by a column in the framebuffer and only the new column is drawn,
+// so the cost per sample doesn't depend on how much history there is. Everything is redrawn only on a screen
+// switch, or when a sample falls outside the current scale
+
+#define HISTORY_NUM_SAMPLES SCREEN_WIDTH
+#define HISTORY_SAMPLE_PERIOD_MS MS_FROM_SECONDS(120) // 128 samples: a bit over 4 hours
+#define HISTORY_HOURS (HISTORY_NUM_SAMPLES * HISTORY_SAMPLE_PERIOD_MS / MS_FROM_HOURS(1))
+#define HISTORY_FRAC_BITS 4 // samples are in 1/16 degrees
+#define HISTORY_NO_VALUE INT16_MIN
+#define HISTORY_MIN_SPAN (2 << HISTORY_FRAC_BITS) // the scale covers at least this many degrees, in whole degrees
+
+#define HISTORY_CHART_TOP 8 // rows: header on page 0, chart down to the relay bars on the last page
+#define HISTORY_CHART_BOTTOM 54
+#define HISTORY_HEAT_BAR_Y 57
+#define HISTORY_FAN_BAR_Y 61
+#define HISTORY_BAR_HEIGHT 3
+
+#define HISTORY_HEAT 1
+#define HISTORY_FAN 2
+
+struct history_sample_t
+{
+    int16_t cur_temp, tgt_temp;
+    uint8_t relays; // HISTORY_HEAT / HISTORY_FAN: relay was on at some point during the sample period
+};
+
+history_sample_t history[HISTORY_NUM_SAMPLES];
+uint32_t history_num_samples = 0;     // ever taken. The newest sample is at (history_num_samples - 1) % HISTORY_NUM_SAMPLES
+uint32_t history_num_drawn = 0;       // samples the chart in the framebuffer is up to date with
+uint8_t history_relays = 0;           // relays seen on during the sample period so far
+int16_t history_scale_min = 0, history_scale_max = 0; // in 1/16 degrees, both whole degrees
+
+disp_screen_t current_screen = SCREEN_MAIN, requested_screen = SCREEN_MAIN;
+
+int16_t to_history_value(float value)
+{
+    if (isnan(value))
+        return HISTORY_NO_VALUE;
+    return constrain(lroundf(value * (1 << HISTORY_FRAC_BITS)), INT16_MIN + 1, INT16_MAX);
+}
+
+void history_sample_task()
+{
+    history_sample_t &sample = history[history_num_samples % HISTORY_NUM_SAMPLES];
+    sample.cur_temp = to_history_value(therm_state.cur_temp);
+    sample.tgt_temp = to_history_value(therm_state.tgt_temp);
+    sample.relays = history_relays;
+    history_relays = 0;
+    ++history_num_samples;
+}
+
+// the relays can go on and off between two samples. The display refresh looks at them often enough to catch that
+void track_history_relays()
+{
+    history_relays |= (therm_state.heat_relay ? HISTORY_HEAT : 0) | (therm_state.fan_relay ? HISTORY_FAN : 0);
+}
+
+const history_sample_t &get_history_sample(uint32_t sample_num)
+{
+    return history[sample_num % HISTORY_NUM_SAMPLES];
+}
+
+// first sample shown when the chart is up to date with history_num_drawn samples
+uint32_t history_first_shown()
+{
+    return history_num_drawn > HISTORY_NUM_SAMPLES ? history_num_drawn - HISTORY_NUM_SAMPLES : 0;
+}
 
-        // draw fraction bar
-        // canvas.drawPixel(0, 47, WHITE);
-        // canvas.drawPixel(canvas.width() - 1, 47, WHITE);
-        canvas.drawRect(0, 30, (int)(canvas.width() * (therm_state.tgt_temp - truncated_temp)), 2, WHITE);
+bool history_in_scale(int16_t value)
+{
+    return value == HISTORY_NO_VALUE || (value >= history_scale_min && value <= history_scale_max);
+}
 
-        if (truncated_temp >= 100)
+// fits the scale to the samples on screen, rounded out to whole degrees
+void history_rescale()
+{
+    int32_t lo = INT16_MAX, hi = INT16_MIN;
+    for (uint32_t sample_num = history_first_shown(); sample_num < history_num_drawn; sample_num++)
+    {
+        const history_sample_t &sample = get_history_sample(sample_num);
+        for (int16_t value : {sample.cur_temp, sample.tgt_temp})
         {
-            // for 3 digit temperatures
-            canvas.drawFastVLine(0, 12, 10, WHITE);
+            if (value == HISTORY_NO_VALUE)
+                continue;
+            lo = min<int32_t>(lo, value);
+            hi = max<int32_t>(hi, value);
         }
     }
-    canvas.write(temp_str.c_str());
+    if (lo > hi)
+    {
+        lo = 68 << HISTORY_FRAC_BITS; // nothing to show yet: somewhere around room temperature
+        hi = lo;
+    }
 
-    display.drawBitmap(56, 32, canvas.getBuffer(), canvas.width(), canvas.height(), WHITE, BLACK);
+    const int32_t one = 1 << HISTORY_FRAC_BITS;
+    lo = lo >> HISTORY_FRAC_BITS << HISTORY_FRAC_BITS; // floor
+    hi = (hi + one - 1) >> HISTORY_FRAC_BITS << HISTORY_FRAC_BITS; // ceiling
+    if (hi - lo < HISTORY_MIN_SPAN)
+    {
+        lo -= (HISTORY_MIN_SPAN - (hi - lo)) / 2 / one * one;
+        hi = lo + HISTORY_MIN_SPAN;
+    }
+    history_scale_min = lo;
+    history_scale_max = hi;
+}
+
+int16_t history_row(int16_t value)
+{
+    int32_t span = history_scale_max - history_scale_min;
+    return HISTORY_CHART_BOTTOM - (int32_t)(value - history_scale_min) * (HISTORY_CHART_BOTTOM - HISTORY_CHART_TOP) / span;
 }
 
-void draw_humidity()
+// draws the sample into column x. The cur_temp line is joined to the previous sample's
+void draw_history_column(int16_t x, uint32_t sample_num)
 {
-    GFXcanvas1 canvas(32, 32);
-    canvas.setTextColor(SSD1306_WHITE); // Draw white text
+    const history_sample_t &sample = get_history_sample(sample_num);
+    display.drawFastVLine(x, HISTORY_CHART_TOP, SCREEN_HEIGHT - HISTORY_CHART_TOP, BLACK);
 
-    // write heading
-    canvas.setCursor(0, 0); // Start at top-left corner
-    canvas.write("Hum:");
+    if (sample.cur_temp != HISTORY_NO_VALUE)
+    {
+        int16_t row = history_row(sample.cur_temp), prev_row = row;
+        if (sample_num > history_first_shown() && get_history_sample(sample_num - 1).cur_temp != HISTORY_NO_VALUE)
+            prev_row = history_row(get_history_sample(sample_num - 1).cur_temp);
+        display.drawFastVLine(x, min(row, prev_row), abs(row - prev_row) + 1, WHITE);
+    }
+    if (sample.tgt_temp != HISTORY_NO_VALUE && sample_num % 2 == 0)
+        display.drawPixel(x, history_row(sample.tgt_temp), WHITE);
 
-    // write value
-    canvas.setTextSize(1);               // Normal 1:1 pixel scale
-    canvas.setFont(&FreeMonoBold12pt7b); // set custom font
-    canvas.setCursor(0, 26);             // depends on the font
+    if (sample.relays & HISTORY_HEAT)
+        display.drawFastVLine(x, HISTORY_HEAT_BAR_Y, HISTORY_BAR_HEIGHT, WHITE);
+    if (sample.relays & HISTORY_FAN)
+        display.drawFastVLine(x, HISTORY_FAN_BAR_Y, HISTORY_BAR_HEIGHT, WHITE);
+}
 
-    String temp_str = "??";
-    if (!isnan(therm_state.cur_hum))
+void draw_history()
+{
+    history_rescale();
+    display.fillRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, BLACK);
+
+    char text[24];
+    display.setFont();
+    display.setTextColor(WHITE);
+    display.setCursor(0, 0);
+    snprintf(text, sizeof(text), "Last %dh", (int)HISTORY_HOURS);
+    display.print(text);
+    snprintf(text, sizeof(text), "%d-%dF", history_scale_min >> HISTORY_FRAC_BITS, history_scale_max >> HISTORY_FRAC_BITS);
+    display.setCursor(SCREEN_WIDTH - 6 * strlen(text), 0);
+    display.print(text);
+
+    uint32_t first_shown = history_first_shown();
+    for (uint32_t sample_num = first_shown; sample_num < history_num_drawn; sample_num++)
     {
-        int truncated_hum = therm_state.cur_hum;
-        temp_str.clear();
-        temp_str += truncated_hum % 100;
+        draw_history_column(HISTORY_NUM_SAMPLES - (history_num_drawn - sample_num), sample_num);
+    }
+    mark_dirty(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
 
-        // draw fraction bar
-        // canvas.drawPixel(0, 47, WHITE);
-        // canvas.drawPixel(canvas.width() - 1, 47, WHITE);
-        canvas.drawRect(0, 30, (int)(canvas.width() * (therm_state.cur_hum - truncated_hum)), 2, WHITE);
+// brings the chart up to date with the samples taken since the last frame
+void update_history()
+{
+    while (history_num_drawn < history_num_samples)
+    {
+        const history_sample_t &sample = get_history_sample(history_num_drawn);
+        ++history_num_drawn;
+        if (!history_in_scale(sample.cur_temp) || !history_in_scale(sample.tgt_temp))
+        {
+            draw_history();
+            continue;
+        }
 
-        if (truncated_hum >= 100)
+        // shift every page of the chart one column to the left, then draw the new sample into the last column
+        uint8_t *buffer = display.getBuffer();
+        for (int page = HISTORY_CHART_TOP / 8; page < DISP_NUM_PAGES; page++)
         {
-            // for 3 digit temperatures
-            canvas.drawFastVLine(0, 12, 10, WHITE);
+            memmove(buffer + page * SCREEN_WIDTH, buffer + page * SCREEN_WIDTH + 1, SCREEN_WIDTH - 1);
         }
+        draw_history_column(SCREEN_WIDTH - 1, history_num_drawn - 1);
+        mark_dirty(0, HISTORY_CHART_TOP, SCREEN_WIDTH, SCREEN_HEIGHT - HISTORY_CHART_TOP);
     }
-    canvas.write(temp_str.c_str());
+}
 
-    display.drawBitmap(90, 32, canvas.getBuffer(), canvas.width(), canvas.height(), WHITE, BLACK);
+void show_screen(disp_screen_t screen)
+{
+    display.clearDisplay();
+    if (screen == SCREEN_HISTORY)
+    {
+        history_num_drawn = history_num_samples;
+        draw_history();
+    }
+    else
+    {
+        draw_labels();
+        for (icon_widget_t &widget : icon_widgets)
+        {
+            widget.last_key = WIDGET_NOT_RENDERED;
+        }
+        for (value_widget_t &widget : value_widgets)
+        {
+            widget.last_key = WIDGET_NOT_RENDERED;
+        }
+    }
+    mark_dirty(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    current_screen = screen;
 }
 
-void draw_icon_heat(bool show)
+void update_screen()
 {
-    GFXcanvas1 canvas(16, 16);
-    if (show)
-        canvas.drawBitmap(0, 0, bmp_flame, 16, 16, WHITE);
-    display.drawBitmap(112, 0, canvas.getBuffer(), canvas.width(), canvas.height(), WHITE, BLACK);
+    track_history_relays();
+    if (requested_screen != current_screen)
+        show_screen(requested_screen);
+
+    if (current_screen == SCREEN_HISTORY)
+        update_history();
+    else
+        update_widgets();
 }
 
-void draw_icon_fan(bool show)
+void set_disp_screen(disp_screen_t screen)
 {
-    GFXcanvas1 canvas(16, 16);
-    if (show)
-        canvas.drawBitmap(0, 0, bmp_fan, 16, 16, WHITE);
-    display.drawBitmap(112, 16, canvas.getBuffer(), canvas.width(), canvas.height(), WHITE, BLACK);
+    requested_screen = screen;
 }
 
-void draw_icon_person(bool show)
+disp_screen_t get_disp_screen()
 {
-    GFXcanvas1 canvas(16, 16);
-    if (show)
-        canvas.drawBitmap(0, 0, bmp_person, 16, 16, WHITE);
-    display.drawBitmap(96, 0, canvas.getBuffer(), canvas.width(), canvas.height(), WHITE, BLACK);
+    return requested_screen;
 }
 
-void draw_icon_wifi(bool show)
+bool is_screen_switch_pending()
 {
-    GFXcanvas1 canvas(16, 16);
-    if (show)
-        canvas.drawBitmap(0, 0, bmp_wifi, 16, 16, WHITE);
-    display.drawBitmap(80, 0, canvas.getBuffer(), canvas.width(), canvas.height(), WHITE, BLACK);
+    return requested_screen != current_screen;
 }
 
-void draw_icon_homeassistant(bool show)
+///////////////////////////////////////////////////////////////////////////////////////
+
+void init_disp()
 {
-    GFXcanvas1 canvas(16, 16);
-    if (show)
-        canvas.drawBitmap(0, 0, bmp_homeassistant, 16, 16, WHITE);
-    display.drawBitmap(64, 0, canvas.getBuffer(), canvas.width(), canvas.height(), WHITE, BLACK);
+    for (int page = 0; page < DISP_NUM_PAGES; page++)
+    {
+        clear_dirty(page);
+        tx_pages[page] = tx_input[page] = dirty_pages[page]; // nothing to send either
+    }
+
+    // SSD1306_SWITCHCAPVCC = generate display voltage from 3.3V internally
+    if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C))
+    { // Address 0x3D for 128x64
+        Serial.println(F("SSD1306 allocation failed"));
+        for (;;)
+            ; // Don't proceed, loop forever
+    }
+
+    // no need to display the default adafruit logo, clear it.
+    display.clearDisplay();
+    draw_labels();
+    mark_dirty(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    set_bright_mode(false);
+
+    sched.add_or_update_task<refresh_display>(0, NULL, 0, 40, 0, 20); // about 25 FPS, lined up with the 20 ms network polls
+    sched.add_or_update_task<history_sample_task>(0, NULL, 0, HISTORY_SAMPLE_PERIOD_MS, HISTORY_SAMPLE_PERIOD_MS, MS_FROM_SECONDS(10));
 }
 
-void draw_icon_local_mode(bool show)
+void set_bright_mode(bool bright)
 {
-    GFXcanvas1 canvas(16, 16);
-    if (show)
-        canvas.drawBitmap(0, 0, bmp_local_mode, 16, 16, WHITE);
-    display.drawBitmap(64, 16, canvas.getBuffer(), canvas.width(), canvas.height(), WHITE, BLACK);
+    bright_mode = bright;
 }
@@ -0,0 +1,95 @@
+#include "estimator.h"
+
+#define MS_PER_HOUR 3600000LL
+
+// process noise, per second: how far the temperature may stray from the trend, and the trend itself may drift
+#define ESTIMATOR_TEMP_VAR_PER_S 1        // (1/256 F)^2, ~0.1 F^2 per hour
+#define ESTIMATOR_RATE_VAR_PER_S 60       // (1/256 F/h)^2, ~3 (F/h)^2 per hour
+// added to the rate variance when the relays switch: the furnace or the fan starting or stopping changes the trend by
+// several F/h right away. Much less once the trend in the new state is known
+#define ESTIMATOR_RELAY_RATE_VAR (2560LL * 2560)      // (10 F/h)^2
+#define ESTIMATOR_KNOWN_RELAY_RATE_VAR (512LL * 512)  // (2 F/h)^2
+#define ESTIMATOR_INITIAL_RATE_VAR (2560LL * 2560)
+// a stretch in one relay state has to be this long for its trend to be worth remembering
+#define ESTIMATOR_MIN_STRETCH_MS (10 * 60 * 1000LL)
+
+void estimator_init(temp_estimator_t &estimator, q8_t noise, q8_t resolution)
+{
+    estimator.initialized = false;
+    estimator.r = (int64_t)noise * noise;
+    estimator.half_step = resolution / 2;
+    estimator.relay_rates_known = 0;
+}
+
+// the relays switched: remember the trend of the stretch that ended, and carry on with the one of the new state
+static void switch_relays(temp_estimator_t &estimator, uint8_t relays, sched_ts_t ts)
+{
+    uint8_t last = estimator.last_relays;
+    if ((int64_t)(ts - estimator.relays_ts) / 1000 >= ESTIMATOR_MIN_STRETCH_MS)
+    {
+        bool known = estimator.relay_rates_known & 1 << last;
+        estimator.relay_rates[last] = known ? (estimator.relay_rates[last] + estimator.rate) / 2 : estimator.rate;
+        estimator.relay_rates_known |= 1 << last;
+    }
+    if (estimator.relay_rates_known & 1 << relays)
+    {
+        estimator.rate = estimator.relay_rates[relays];
+        estimator.p11 += ESTIMATOR_KNOWN_RELAY_RATE_VAR;
+    }
+    else
+    {
+        estimator.p11 += ESTIMATOR_RELAY_RATE_VAR;
+    }
+    estimator.last_relays = relays;
+    estimator.relays_ts = ts;
+}
+
+void estimator_update(temp_estimator_t &estimator, q8_t temp, sched_ts_t ts, bool heat, bool fan)
+{
+    uint8_t relays = heat | fan << 1;
+    if (!estimator.initialized)
+    {
+        estimator.temp = temp;
+        estimator.rate = 0;
+        estimator.p00 = estimator.r + (int64_t)estimator.half_step * estimator.half_step;
+        estimator.p01 = 0;
+        estimator.p11 = ESTIMATOR_INITIAL_RATE_VAR;
+        estimator.last_ts = ts;
+        estimator.last_temp = temp;
+        estimator.last_relays = relays;
+        estimator.relays_ts = ts;
+        estimator.initialized = true;
+        return;
+    }
+
+    // predict: the temperature follows the trend for dt. dt_h is dt in hours, Q16
+    int64_t dt_ms = (ts - estimator.last_ts) / 1000;
+    int64_t dt_h = (dt_ms << 16) / MS_PER_HOUR;
+    estimator.last_ts = ts;
+
+    estimator.temp += (estimator.rate * dt_h) >> 16;
+    estimator.p00 += ((2 * estimator.p01 * dt_h) >> 16) + ((((estimator.p11 * dt_h) >> 16) * dt_h) >> 16) + ESTIMATOR_TEMP_VAR_PER_S * dt_ms / 1000;
+    estimator.p01 += (estimator.p11 * dt_h) >> 16;
+    estimator.p11 += ESTIMATOR_RATE_VAR_PER_S * dt_ms / 1000;
+    if (relays != estimator.last_relays)
+        switch_relays(estimator, relays, ts);
+
+    // correct with the reading. A quantized reading that stays the same doesn't say much: the temperature is somewhere
+    // around it, and the readings don't average out while it drifts within the step, so it counts as if it could be a
+    // whole step off. A step to the next value says where the temperature is, right in between the two
+    q8_t last_temp = estimator.last_temp;
+    estimator.last_temp = temp;
+    int64_t innovation = temp - estimator.temp, r = estimator.r;
+    if (estimator.half_step && abs(temp - last_temp) == 2 * estimator.half_step)
+        innovation = (temp + last_temp) / 2 - estimator.temp;
+    else
+        r += 4 * (int64_t)estimator.half_step * estimator.half_step;
+
+    int64_t s = estimator.p00 + r;
+    int64_t p00 = estimator.p00, p01 = estimator.p01;
+    estimator.temp += p00 * innovation / s;
+    estimator.rate += p01 * innovation / s;
+    estimator.p00 -= p00 * p00 / s;
+    estimator.p01 -= p00 * p01 / s;
+    estimator.p11 -= p01 * p01 / s;
+}
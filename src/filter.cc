@@ -0,0 +1,87 @@
+#include "filter.h"
+
+#include <stdlib.h>
+
+// Hampel: x is an outlier when |x - median| > 3 * 1.4826 * MAD. The factor, as a ratio of small integers
+#define FILTER_MAD_SCALE_NUM 9
+#define FILTER_MAD_SCALE_DEN 2
+
+void filter_init(sample_filter_t &filter, q8_t min_threshold)
+{
+    filter.num_samples = 0;
+    filter.next = 0;
+    filter.min_threshold = min_threshold;
+    filter.num_outliers = 0;
+    filter.last_outlier = false;
+}
+
+// insertion sort. The window is small, and usually close to sorted already
+static void sort_values(q8_t *values, int num_values)
+{
+    for (int idx = 1; idx < num_values; idx++)
+    {
+        q8_t value = values[idx];
+        int pos = idx;
+        for (; pos > 0 && values[pos - 1] > value; pos--)
+        {
+            values[pos] = values[pos - 1];
+        }
+        values[pos] = value;
+    }
+}
+
+static q8_t sorted_median(const q8_t *values, int num_values)
+{
+    int mid = num_values / 2;
+    if (num_values % 2)
+        return values[mid];
+    return (values[mid - 1] + values[mid]) / 2;
+}
+
+bool filter_add(sample_filter_t &filter, q8_t sample, q8_t &filtered)
+{
+    filter.samples[filter.next] = sample;
+    filter.next = (filter.next + 1) % FILTER_WINDOW;
+    if (filter.num_samples < FILTER_WINDOW)
+        ++filter.num_samples;
+    filter.last_outlier = false;
+    if (filter.num_samples < FILTER_MIN_SAMPLES)
+        return false;
+
+    int num_samples = filter.num_samples;
+    q8_t sorted[FILTER_WINDOW];
+    for (int idx = 0; idx < num_samples; idx++)
+    {
+        sorted[idx] = filter.samples[idx];
+    }
+    sort_values(sorted, num_samples);
+    q8_t median = sorted_median(sorted, num_samples);
+
+    q8_t deviations[FILTER_WINDOW];
+    for (int idx = 0; idx < num_samples; idx++)
+    {
+        deviations[idx] = abs(sorted[idx] - median);
+    }
+    sort_values(deviations, num_samples);
+    q8_t mad = sorted_median(deviations, num_samples);
+    q8_t threshold = mad * FILTER_MAD_SCALE_NUM / FILTER_MAD_SCALE_DEN;
+    if (threshold < filter.min_threshold)
+        threshold = filter.min_threshold;
+
+    filter.last_outlier = abs(sample - median) > threshold;
+    if (filter.last_outlier)
+        ++filter.num_outliers;
+
+    int32_t sum = 0;
+    int num_inliers = 0;
+    for (int idx = 0; idx < num_samples; idx++)
+    {
+        if (abs(sorted[idx] - median) > threshold)
+            continue;
+        sum += sorted[idx];
+        ++num_inliers;
+    }
+    // the median itself is always an inlier, so there is at least one. Rounded to nearest
+    filtered = (sum + (sum >= 0 ? num_inliers / 2 : -num_inliers / 2)) / num_inliers;
+    return true;
+}
@@ -2,21 +2,31 @@
 
 #include "config.h"
 #include "tasks.h"
+#include "coro.h"
 #include "mqtt.h"
 #include "disp.h"
 #include "control.h"
 #include "utils.h"
 #include "local_thermostat.h"
 
+// the rotate handler is a signalled task: the quadrature ISR notifies it on every detent, the period is only a fallback
+// in case a notification got dropped
+#define KNOB_ROTATE_FALLBACK_PERIOD_MS 100
+#define KNOB_BUTTON_DEBOUNCE_MS 1
+#define KNOB_BUTTON_LONG_PRESS_MS MS_FROM_SECONDS(2)
+
 uint8 knob_pin_state_history;
 int8 knob_delta;
+uint32_t knob_input_cycles; // ESP.getCycleCount() at the first detent knob_delta holds
+
+void knob_rotate_handler_task();
 
 void report_new_target_temp_task()
 {
   send_mqtt_state_target_temp();
 }
 
-void knob_interrupt_handler_impl(bool pin_a, bool pin_b)
+ICACHE_RAM_ATTR void knob_interrupt_handler_impl(bool pin_a, bool pin_b)
 {
   uint8_t state = (pin_a << 1) | pin_b;
   if (state != (knob_pin_state_history & 0x3))
@@ -27,17 +37,22 @@ void knob_interrupt_handler_impl(bool pin_a, bool pin_b)
     knob_pin_state_history <<= 2;
     knob_pin_state_history |= state;
 
+    if ((knob_pin_state_history == 0x87 || knob_pin_state_history == 0x4B) && !knob_delta)
+      knob_input_cycles = ESP.getCycleCount();
+
     if (knob_pin_state_history == 0x87)
     {
       --knob_delta;
       // Serial.println(String("delta ") + knob_delta);
       knob_pin_state_history = 0;
+      sched.defer_notify_task<knob_rotate_handler_task>(0);
     }
     else if (knob_pin_state_history == 0x4B)
     {
       ++knob_delta;
       // Serial.println(String("delta ") + knob_delta);
       knob_pin_state_history = 0;
+      sched.defer_notify_task<knob_rotate_handler_task>(0);
     }
   }
 }
@@ -57,14 +72,20 @@ void knob_rotate_handler_task()
   if (!isnan(therm_state.tgt_temp))
   {
     therm_state.tgt_temp += knob_delta * 0.25;
+    set_disp_screen(SCREEN_MAIN); // show what the setpoint is being changed to
     // Serial.println(String("target temp ") + therm_state.tgt_temp);
-    draw_target_temp();
-    sched.add_or_update_task((void *)report_new_target_temp_task, 0, NULL, 0, 0, 5 * 1000);
+    sched.add_or_update_task<report_new_target_temp_task>(0, NULL, 0, 0, 5 * 1000);
   }
   knob_delta = 0;
+  refresh_display_for_input(knob_input_cycles);
 }
 
-void button_long_press_task_handler()
+void button_click()
+{
+  set_disp_screen(get_disp_screen() == SCREEN_MAIN ? SCREEN_HISTORY : SCREEN_MAIN);
+}
+
+void button_long_press()
 {
   Serial.println(String("long press!!!"));
   if (therm_conf.relays_available)
@@ -78,39 +99,57 @@ void button_long_press_task_handler()
       enable_local_thermostat();
     }
   }
-  sched.remove_task((void *)button_long_press_task_handler, 0);
 }
 
-void knob_button_handle_change(int state)
+volatile bool knob_isr_button_state = 0;
+
+struct knob_button_frame_t : coro_t
 {
-  Serial.println(String("button state changed ") + state);
-  if (state)
-  {
-    sched.add_or_update_task((void *)button_long_press_task_handler, 0, NULL, 2, 0, MS_FROM_SECONDS(2));
-  }
-  else
-  {
-    sched.remove_task((void *)button_long_press_task_handler, 0);
-  }
-}
+  bool state;       // debounced button state
+  bool click_armed; // pressed, and not held long enough for a long press (yet)
+} knob_button_frame;
 
-bool prev_knob_isr_button_state = 0;
-void knob_button_debouncer_task()
+// debounces the button and tells clicks from long presses. Signalled by the button ISR on every edge
+void knob_button_coro(knob_button_frame_t *co)
 {
-  int current_state = digitalRead(KNOB_BTN_PIN);
-  if (prev_knob_isr_button_state == current_state)
+  CORO_BEGIN(co);
+  CORO_AWAIT_SIGNAL(co, CORO_FOREVER);
+  while (true)
   {
-    // state held for duration of time, report
-    knob_button_handle_change(current_state);
+    // wait for the state to hold for a while
+    do
+    {
+      co->state = knob_isr_button_state;
+      CORO_AWAIT_DELAY(co, KNOB_BUTTON_DEBOUNCE_MS);
+    } while (knob_isr_button_state != co->state || digitalRead(KNOB_BTN_PIN) != co->state);
+    Serial.println(String("button state changed ") + co->state);
+
+    if (co->state)
+    {
+      // it's a long press unless the button changes before the hold time is up
+      co->click_armed = true;
+      CORO_AWAIT_SIGNAL(co, KNOB_BUTTON_LONG_PRESS_MS);
+      if (!CORO_TIMED_OUT(co))
+        continue;
+      co->click_armed = false;
+      button_long_press();
+    }
+    else if (co->click_armed)
+    {
+      // released before it became a long press
+      co->click_armed = false;
+      button_click();
+    }
+    CORO_AWAIT_SIGNAL(co, CORO_FOREVER);
   }
+  CORO_END(co);
 }
 
 ICACHE_RAM_ATTR void knob_button_interrupt_handler()
 {
   // Serial.println("interrupt");
-  int current_state = digitalRead(KNOB_BTN_PIN);
-  prev_knob_isr_button_state = current_state;
-  sched.add_or_update_task((void *)knob_button_debouncer_task, 0, NULL, 0, 0, 1);
+  knob_isr_button_state = digitalRead(KNOB_BTN_PIN);
+  sched.defer_notify_task<knob_button_coro>(0);
 }
 
 void init_knob()
@@ -121,6 +160,7 @@ void init_knob()
 
   attachInterrupt(digitalPinToInterrupt(KNOB_A_PIN), knob_interrupt_handler, CHANGE);
   attachInterrupt(digitalPinToInterrupt(KNOB_B_PIN), knob_interrupt_handler, CHANGE);
+  start_coro<knob_button_coro>(0, &knob_button_frame, 2);
   attachInterrupt(digitalPinToInterrupt(KNOB_BTN_PIN), knob_button_interrupt_handler, CHANGE);
-  sched.add_or_update_task((void *)knob_rotate_handler_task, 0, NULL, 0, 1, 0);
+  sched.add_or_update_task<knob_rotate_handler_task>(0, NULL, 0, KNOB_ROTATE_FALLBACK_PERIOD_MS, 0, KNOB_ROTATE_FALLBACK_PERIOD_MS / 2);
 }
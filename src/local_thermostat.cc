@@ -4,29 +4,62 @@
 #include "utils.h"
 #include "control.h"
 #include "disp.h"
+#include "psychro.h"
 
 #include <bitset>
 
 #define CIRCULATION_FAN_HISTORY_SIZE_IN_MIN 60
 // we will try to keep the fan on for CIRCULATION_MIN out of last CIRCULATION_FAN_HISTORY_SIZE_IN_MIN
 #define CIRCULATION_MIN 30
+// the furnace keeps heating for a while after it is turned off, and the air takes a while to mix. The control loop
+// acts on where the temperature will be by then, so that it doesn't overshoot the band
+#define LOCAL_MODE_LOOKAHEAD_MIN 3
+// the furnace heats at a few F/h, so that is a few tenths of a degree. A rate that is still settling (after a restart,
+// or the first furnace run) shouldn't be able to flip a decision on its own
+#define LOCAL_MODE_LOOKAHEAD_MAX_F 0.5f
+// how far the dew point has to stay below the outdoor temperature for fan only circulation
+#define CONDENSATION_MARGIN_F 5
 
 std::bitset<CIRCULATION_FAN_HISTORY_SIZE_IN_MIN> fan_state_history;
 short fan_state_history_ptr = 0;
 int64_t last_circ_fan_on_ts = -1;
 bool previous_fan_status = false;
 
+// if the fan runs without heat, the heat exchanger is effectively the coldest part of the HVAC loop: its flue side is
+// at about the outdoor temperature. Once that is below the dew point of the indoor air, moisture condenses on it.
+// Condensation = rust; lower life of furnace, carbon monoxide risk. Without a recent outdoor temperature, assume the worst
+bool circulation_condensation_risk()
+{
+    if (isnan(therm_state.cur_temp) || isnan(therm_state.cur_hum) || isnan(therm_state.out_temp) ||
+        therm_state.out_temp_ts < 0 || get_ts_ms() - therm_state.out_temp_ts > MS_FROM_MINUTES(OUT_TEMP_MAX_AGE_MIN))
+        return true;
+
+    q8_t dew = dew_point(Q8_FROM_FLOAT(therm_state.cur_temp), Q8_FROM_FLOAT(therm_state.cur_hum));
+    return dew + Q8_FROM_INT(CONDENSATION_MARGIN_F) >= Q8_FROM_FLOAT(therm_state.out_temp);
+}
+
 void circulation_watcher_task()
 {
     fan_state_history[fan_state_history_ptr] = therm_state.fan_relay;
     fan_state_history_ptr = (fan_state_history_ptr + 1) % CIRCULATION_FAN_HISTORY_SIZE_IN_MIN;
 
+    if (circulation_condensation_risk())
+    {
+        // a fan that circulation turned on goes off. One that runs along with the heat is none of our business
+        if (therm_state.fan_relay && last_circ_fan_on_ts >= 0 && !therm_state.heat_relay && fan_off())
+        {
+            last_circ_fan_on_ts = -1;
+        }
+        previous_fan_status = therm_state.fan_relay;
+        return;
+    }
+
     size_t fan_total_runtime = fan_state_history.count();
 
     if (therm_state.fan_relay && !previous_fan_status)
     {
         // this case handles fan turning on due to furnace; but not with current function
-        last_circ_fan_on_ts = millis();
+        last_circ_fan_on_ts = get_ts_ms();
     }
 
     if (!therm_state.fan_relay && fan_total_runtime < CIRCULATION_MIN)
@@ -34,11 +67,11 @@ void circulation_watcher_task()
         // we need to run the fan for few minutes
         if (fan_on())
         {
-            last_circ_fan_on_ts = millis();
+            last_circ_fan_on_ts = get_ts_ms();
         }
     }
 
-    if (therm_state.fan_relay && last_circ_fan_on_ts >= 0 && (millis() - last_circ_fan_on_ts) > MS_FROM_MINUTES(CIRCULATION_MIN))
+    if (therm_state.fan_relay && last_circ_fan_on_ts >= 0 && (get_ts_ms() - last_circ_fan_on_ts) > MS_FROM_MINUTES(CIRCULATION_MIN))
     {
         // fans have run long time. Shut off
         if (fan_off())
@@ -61,7 +94,10 @@ void monitor_local_mode_temperature()
         return;
     }
 
-    float diff = therm_state.tgt_temp - therm_state.cur_temp;
+    float predicted_temp = therm_state.cur_temp;
+    if (!isnan(therm_state.cur_temp_rate))
+        predicted_temp += constrain(therm_state.cur_temp_rate * LOCAL_MODE_LOOKAHEAD_MIN / 60, -LOCAL_MODE_LOOKAHEAD_MAX_F, LOCAL_MODE_LOOKAHEAD_MAX_F);
+    float diff = therm_state.tgt_temp - predicted_temp;
 
     if (diff > 1)
     {
@@ -71,8 +107,9 @@ void monitor_local_mode_temperature()
     else if (diff < -1)
     {
         heat_off();
-        // sched.add_or_update_task((void *)fan_off, 10, NULL, 0, 0, MS_FROM_SECONDS(60));
-        fan_off(); // FIXME: comment this out when we enable circulation mode again
+        // otherwise the circulation watcher decides how long the fan keeps running
+        if (circulation_condensation_risk())
+            fan_off();
     }
 }
 
@@ -87,25 +124,15 @@ void enable_local_thermostat()
         update_target_temp(73.0f);
     }
     therm_state.local_mode = 1;
-    draw_icon_local_mode(therm_state.local_mode);
-    sched.add_or_update_task((void *)monitor_local_mode_temperature, 0, NULL, 0, MS_FROM_SECONDS(10), 0);
+    sched.add_or_update_task<monitor_local_mode_temperature>(0, NULL, 0, MS_FROM_SECONDS(10), 0, MS_FROM_SECONDS(2));
 
     // circulation related
     fan_state_history.reset();
     fan_state_history_ptr = 0;
     last_circ_fan_on_ts = -1;
 
-    // FIXME: this is disabled for now during winter, can be enabled during summer
-    // reason for disabling: if the fan runs without heat, the heat exchanger is effectively the coldest part
-    // of the HVAC loop, and it accumulates condensation. Condensation = rust; lower life of furnace, carbon monoxide risk.
-    // The rust/evaporating water on iron what I was smelling when the heat kicked in since enabling circulation.
-    // Hence disabled during winter.
-    // Ideal fix: replace the inaccurate DHT11 by something more reliable,
-    // then check if the current internal moisture at internal temp will result in condensation
-    // on the heat exchanger by looking at outside temperature; and enable circulation mode automatically.
-    // Look into the dew point calculation. Could compare that with the external temp.
-
-    // sched.add_or_update_task((void *)circulation_watcher_task, 0, NULL, 0, MS_FROM_MINUTES(1), 0);
+    // circulation pauses by itself while it would condense moisture on the heat exchanger, see circulation_condensation_risk()
+    sched.add_or_update_task<circulation_watcher_task>(0, NULL, 0, MS_FROM_MINUTES(1), 0, MS_FROM_SECONDS(10));
 }
 
 void disable_local_thermostat()
@@ -114,8 +141,8 @@ void disable_local_thermostat()
     {
         return;
     }
-    sched.remove_task((void *)monitor_local_mode_temperature, 0);
+    sched.remove_task<monitor_local_mode_temperature>(0);
+    sched.remove_task<circulation_watcher_task>(0);
     update_target_temp(NAN);
     therm_state.local_mode = 0;
-    draw_icon_local_mode(therm_state.local_mode);
 }
\ No newline at end of file
@@ -6,17 +6,22 @@
 #include "utils.h"
 #include "wifi.h"
 #include "mqtt.h"
-#include "dht11.h"
+#include "sensor.h"
 #include "knob.h"
 #include "presence.h"
 #include "control.h"
 #include "disp.h"
+#include "stall.h"
 
 // global vars
 
+// upper bound for a single idle period of the scheduler, so that loop() still comes around regularly
+#define MAX_IDLE_MS 1000
+
 void setup()
 {
     Serial.begin(74880);
+    setup_stall_detector();
     init_disp();
 
     pinMode(RELAY_FAN_PIN, OUTPUT);
@@ -29,8 +34,8 @@ void setup()
     Serial.println("init mqtt");
     init_mqtt();
 
-    Serial.println("init dht");
-    setup_dht();
+    Serial.println("init sensor");
+    setup_sensor();
     Serial.println("init knob");
     init_knob();
     Serial.println("init radar");
@@ -39,5 +44,5 @@ void setup()
 
 void loop()
 {
-    sched.run(0);
+    sched.run(MAX_IDLE_MS);
 }
@@ -3,9 +3,12 @@
 #include "tasks.h"
 #include "control.h"
 #include "disp.h"
+#include "utils.h"
+#include "stall.h"
+#include "psychro.h"
 #include <ArduinoJson.h>
+#include <LittleFS.h>
 
-String stat_topic_prefix, cmnd_topic;
 
 const PROGMEM char *topic_component = "therm";
 const PROGMEM char *topic_rl_fan = "rl_fan";
@@ -13,21 +16,77 @@ const PROGMEM char *topic_rl_heat = "rl_heat";
 const PROGMEM char *topic_sw_presence = "sw_presence";
 const PROGMEM char *topic_cur_temp = "cur_temp";
 const PROGMEM char *topic_cur_hum = "cur_hum";
+const PROGMEM char *topic_cur_temp_rate = "cur_temp_rate";
 const PROGMEM char *topic_set_temp = "set_temp";
+const PROGMEM char *topic_out_temp = "out_temp";
+const PROGMEM char *topic_dew_point = "dew_point";
 
 const PROGMEM char *topic_suffix_relays = "relays";
 const PROGMEM char *topic_suffix_dht11 = "dht11";
 const PROGMEM char *topic_suffix_radar = "presence";
 const PROGMEM char *topic_suffix_target = "setpoint";
+const PROGMEM char *topic_suffix_sched = "sched";
+const PROGMEM char *topic_suffix_stall = "stall";
+const PROGMEM char *topic_ha_status = "homeassistant/status"; // HA's birth and last will
+
+// topics are put together once, in init_mqtt(), so that publishing doesn't build Strings
+#define MQTT_TOPIC_MAX_LEN 64
+char topic_state_relays[MQTT_TOPIC_MAX_LEN], topic_state_dht11[MQTT_TOPIC_MAX_LEN], topic_state_radar[MQTT_TOPIC_MAX_LEN];
+char topic_state_target[MQTT_TOPIC_MAX_LEN], topic_state_sched[MQTT_TOPIC_MAX_LEN], topic_state_stall[MQTT_TOPIC_MAX_LEN];
+char cmnd_topic[MQTT_TOPIC_MAX_LEN];
+
+// PubSubClient has no way to signal readable data, so it is polled. Incoming commands are not latency critical
+#define MQTT_LOOP_PERIOD_MS 20
+// connection attempts are spread out by a random delay, so that a fleet of units doesn't hit a restarted broker all at once
+#define MQTT_CONNECT_PERIOD_MS MS_FROM_SECONDS(30)
+#define MQTT_CONNECT_JITTER_MS MS_FROM_SECONDS(10)
+#define HA_DISCOVERY_JITTER_MS MS_FROM_SECONDS(10) // same for answering HA's birth message
+#define HA_DISCOVERY_HASH_FILE "/ha_discovery"
+#define SCHED_STATS_REPORT_PERIOD_MS MS_FROM_SECONDS(60)
+#define SCHED_STATS_NUM_TOP_TASKS 5
+
+#define MQTT_BUFFER_SIZE 512     // incoming commands and outgoing headers. Outgoing payloads are streamed and can be larger
+#define MQTT_CHUNK_SIZE 128      // payload bytes collected before they are handed to the TCP client
+#define MQTT_REPORT_DOC_SIZE 896 // the bigger, infrequent reports (scheduler stats, stall record, discovery) share one document
 
 WiFiClient mqtt_espClient;
 PubSubClient mqtt_client(mqtt_espClient);
 
-void mqtt_incoming_message_callback(char *topic, byte *payload, unsigned int length)
+void mqtt_connect();
+void ha_rediscovery_task();
+
+StaticJsonDocument<MQTT_REPORT_DOC_SIZE> report_jdoc;
+mqtt_stats_t mqtt_stats;
+
+// ArduinoJson prints one character at a time, and PubSubClient hands every write() straight to the TCP client.
+// collecting the payload in small chunks keeps that to a few TCP writes per message, without a copy of the whole payload
+class mqtt_payload_writer_t : public Print
 {
-  if (therm_state.local_mode)
-    return;
+public:
+  size_t write(uint8_t c)
+  {
+    if (len == sizeof(chunk))
+      send_chunk();
+    chunk[len++] = c;
+    return 1;
+  }
 
+  bool send_chunk()
+  {
+    if (len && mqtt_client.write(chunk, len) != len)
+      failed = true;
+    len = 0;
+    return !failed;
+  }
+
+private:
+  uint8_t chunk[MQTT_CHUNK_SIZE];
+  size_t len = 0;
+  bool failed = false;
+};
+
+void mqtt_incoming_message_callback(char *topic, byte *payload, unsigned int length)
+{
   Serial.print("Message arrived [");
   Serial.print(topic);
   Serial.print("] ");
@@ -37,7 +96,15 @@ void mqtt_incoming_message_callback(char *topic, byte *payload, unsigned int len
   }
   Serial.println();
 
-  DynamicJsonDocument jdoc(200);
+  // HA (re)started and asks for discovery. Everybody gets this at the same time
+  if (strcmp(topic, topic_ha_status) == 0)
+  {
+    if (length == 6 && memcmp(payload, "online", 6) == 0)
+      sched.add_or_update_task<ha_rediscovery_task>(0, NULL, 0, 0, random(HA_DISCOVERY_JITTER_MS));
+    return;
+  }
+
+  StaticJsonDocument<200> jdoc;
   auto json_error = deserializeJson(jdoc, payload, length);
   if (json_error)
   {
@@ -47,6 +114,21 @@ void mqtt_incoming_message_callback(char *topic, byte *payload, unsigned int len
   }
   JsonObject jobj = jdoc.as<JsonObject>();
 
+  // information, which local mode uses as well
+  if (jobj.containsKey(topic_out_temp))
+  {
+    float out_temp = jobj[topic_out_temp];
+    if (!isnan(out_temp))
+    {
+      therm_state.out_temp = out_temp;
+      therm_state.out_temp_ts = get_ts_ms();
+    }
+  }
+
+  // commands, which local mode doesn't take
+  if (therm_state.local_mode)
+    return;
+
   if (therm_conf.relays_available)
   {
     if (jobj.containsKey(topic_rl_fan))
@@ -81,6 +163,11 @@ void mqtt_incoming_message_callback(char *topic, byte *payload, unsigned int len
   return;
 }
 
+void schedule_mqtt_connect(unsigned int start_delay)
+{
+  sched.add_or_update_task<mqtt_connect>(0, NULL, 0, MQTT_CONNECT_PERIOD_MS, start_delay + random(MQTT_CONNECT_JITTER_MS), MS_FROM_SECONDS(5));
+}
+
 void mqtt_connect()
 {
   if (!mqtt_client.connected())
@@ -90,17 +177,25 @@ void mqtt_connect()
     {
       Serial.println("connected");
 
-      announce_devices_to_homeassistant();
+      announce_devices_to_homeassistant(false);
+      send_mqtt_stall_record();
 
-      Serial.println("Subscribe to " + cmnd_topic);
-      mqtt_client.subscribe(cmnd_topic.c_str(), 1);
+      Serial.print("Subscribe to ");
+      Serial.println(cmnd_topic);
+      mqtt_client.subscribe(cmnd_topic, 1);
+      mqtt_client.subscribe(topic_ha_status, 1);
 
       mqtt_client.setCallback(mqtt_incoming_message_callback);
     }
+    else
+    {
+      // the broker may be back for everybody at once, don't all retry in lockstep
+      schedule_mqtt_connect(MQTT_CONNECT_PERIOD_MS);
+    }
   }
 
   // update status on screen
-  draw_icon_homeassistant(mqtt_client.connected());
+  therm_state.mqtt_connected = mqtt_client.connected();
 }
 
 void mqtt_update_task(void *)
@@ -108,56 +203,75 @@ void mqtt_update_task(void *)
   mqtt_client.loop();
 }
 
-void send_mqtt_state(const String &topic, const JsonDocument &jdoc, bool retained = false)
+// serializes compact JSON straight into the MQTT connection. Nothing on this path allocates from the heap
+bool send_mqtt_state(const char *topic, const JsonDocument &jdoc, bool retained = false)
 {
   // uncomment this if we don't want to send local actions over to MQTT
   // TODO: look at this more carefully when we move the control to the PI
   // if (therm_state.local_mode) return;
 
   if (!mqtt_client.connected())
-    return;
+    return false;
 
-  String serialized_payload;
-  serializeJsonPretty(jdoc, serialized_payload);
-  Serial.println("MQTT: " + topic + " = " + serialized_payload);
-  bool publish_status = mqtt_client.publish(topic.c_str(), serialized_payload.c_str(), retained);
+  uint32_t start_cycles = ESP.getCycleCount();
+  size_t payload_len = measureJson(jdoc);
+  bool publish_status = mqtt_client.beginPublish(topic, payload_len, retained);
+  if (publish_status)
+  {
+    mqtt_payload_writer_t writer;
+    serializeJson(jdoc, writer);
+    publish_status = writer.send_chunk();
+    // what the TCP stack is still holding on to counts as well
+    mqtt_stats.min_free_heap = min(mqtt_stats.min_free_heap, ESP.getFreeHeap());
+    publish_status = mqtt_client.endPublish() && publish_status;
+  }
+  uint32_t cycles = ESP.getCycleCount() - start_cycles;
+
+  mqtt_stats.num_publishes++;
+  mqtt_stats.payload_bytes += payload_len;
+  mqtt_stats.total_publish_cycles += cycles;
+  mqtt_stats.max_publish_cycles = max(mqtt_stats.max_publish_cycles, cycles);
+
+  Serial.print("MQTT: ");
+  Serial.print(topic);
+  Serial.print(", ");
+  Serial.print(payload_len);
+  Serial.println(" bytes");
   if (!publish_status)
   {
+    mqtt_stats.num_publish_failures++;
     Serial.println("MQTT publish FAILED.");
-    Serial.println("MQTT buffer size = " + String(mqtt_client.getBufferSize()));
-    Serial.println("MQTT message size = " + String(serialized_payload.length()));
   }
+  return publish_status;
 }
 
-/*
-void send_mqtt_state(const JsonDocument &jdoc, bool retained = false)
+const mqtt_stats_t &get_mqtt_stats()
 {
-  send_mqtt_state(stat_topic_prefix, jdoc, retained);
+  return mqtt_stats;
 }
-*/
 
 void send_mqtt_state_relays()
 {
-  DynamicJsonDocument jdoc(200);
+  StaticJsonDocument<200> jdoc;
 
   jdoc[topic_rl_fan] = (therm_state.fan_relay ? "on" : "off");
   jdoc[topic_rl_heat] = (therm_state.heat_relay ? "on" : "off");
 
-  send_mqtt_state(stat_topic_prefix + "/" + topic_suffix_relays, jdoc);
+  send_mqtt_state(topic_state_relays, jdoc);
 }
 
 void send_mqtt_state_presence()
 {
-  DynamicJsonDocument jdoc(200);
+  StaticJsonDocument<200> jdoc;
 
   jdoc[topic_sw_presence] = (therm_state.presence ? "on" : "off");
 
-  send_mqtt_state(stat_topic_prefix + "/" + topic_suffix_radar, jdoc);
+  send_mqtt_state(topic_state_radar, jdoc);
 }
 
 void send_mqtt_state_cur_temp()
 {
-  DynamicJsonDocument jdoc(200);
+  StaticJsonDocument<200> jdoc;
 
   bool should_send = false;
   if (!isnan(therm_state.cur_temp))
@@ -166,21 +280,31 @@ void send_mqtt_state_cur_temp()
     should_send = true;
   }
 
+  if (!isnan(therm_state.cur_temp_rate))
+  {
+    jdoc[topic_cur_temp_rate] = therm_state.cur_temp_rate;
+  }
+
   if (!isnan(therm_state.cur_hum))
   {
     jdoc[topic_cur_hum] = therm_state.cur_hum;
     should_send = true;
   }
 
+  if (!isnan(therm_state.cur_temp) && !isnan(therm_state.cur_hum))
+  {
+    jdoc[topic_dew_point] = Q8_TO_FLOAT(dew_point(Q8_FROM_FLOAT(therm_state.cur_temp), Q8_FROM_FLOAT(therm_state.cur_hum)));
+  }
+
   if (should_send)
   {
-    send_mqtt_state(stat_topic_prefix + "/" + topic_suffix_dht11, jdoc);
+    send_mqtt_state(topic_state_dht11, jdoc);
   }
 }
 
 void send_mqtt_state_target_temp()
 {
-  DynamicJsonDocument jdoc(200);
+  StaticJsonDocument<200> jdoc;
 
   bool should_send = false;
   if (!isnan(therm_state.tgt_temp))
@@ -191,183 +315,296 @@ void send_mqtt_state_target_temp()
 
   if (should_send)
   {
-    send_mqtt_state(stat_topic_prefix + "/" + topic_suffix_target, jdoc);
+    send_mqtt_state(topic_state_target, jdoc);
   }
 }
 
-void announce_devices_to_homeassistant()
+#if SCHED_PROFILING
+struct sched_top_tasks_t
 {
-  String device_id = therm_conf.host;
-  String homeassistant_prefix = "homeassistant";
+  scheduler::task_info_t tasks[SCHED_STATS_NUM_TOP_TASKS];
+  int count = 0;
+};
 
+// keeps the tasks with the most cumulative execution time, sorted descending
+void collect_top_task(const scheduler::task_info_t &info, void *ctx)
+{
+  sched_top_tasks_t &top = *(sched_top_tasks_t *)ctx;
+  int pos = top.count;
+  while (pos > 0 && top.tasks[pos - 1].timing.total_cycles < info.timing.total_cycles)
   {
-    // sensor: current temp
+    if (pos < SCHED_STATS_NUM_TOP_TASKS)
+      top.tasks[pos] = top.tasks[pos - 1];
+    --pos;
+  }
+  if (pos < SCHED_STATS_NUM_TOP_TASKS)
+  {
+    top.tasks[pos] = info;
+    top.count = min(top.count + 1, SCHED_STATS_NUM_TOP_TASKS);
+  }
+}
+#endif
 
-    DynamicJsonDocument jdoc(500);
-    String hassio_device = "temperature";
-    String unique_id = device_id + "_" + hassio_device;
-    {
-      // device ID. This helps hassio group all the sensors of current esp instance together
-      auto dev_obj = jdoc.createNestedObject("dev");
-      dev_obj["name"] = device_id;
-      dev_obj["mf"] = "Prashant";
-      auto ids_array = dev_obj.createNestedArray("ids");
-      ids_array.add(device_id);
-    }
-    jdoc["name"] = unique_id;                                      // the name of the sensor that shows up in hassio
-    jdoc["stat_t"] = stat_topic_prefix + "/" + topic_suffix_dht11; // the stat topic that we publish. This is the one that hassio will start listening to
-    jdoc["uniq_id"] = unique_id;                                   // unique ID of the device in hassio. Doesn't get used for anything except as a unique ID
-    jdoc["unit_of_measurement"] = "°F";                            // we measure in F
-    jdoc["device_class"] = "temperature";                          // this is the hassio device class
-    jdoc["value_template"] = "{{value_json['cur_temp']}}";         // this is how hassio pulls the value from our overall status message JSON
-
-    auto config_topic = homeassistant_prefix + "/sensor/" + unique_id + "/config";
-    send_mqtt_state(config_topic, jdoc, true);
+// the full per task table is served at /metrics; MQTT gets the scheduler counters and the biggest loop hogs
+void send_mqtt_sched_stats()
+{
+  JsonDocument &jdoc = report_jdoc;
+  jdoc.clear();
+
+  jdoc["runs"] = sched.get_num_runs();
+  jdoc["task_runs"] = sched.get_num_task_runs();
+  jdoc["wakeups"] = sched.get_num_wakeups();
+  jdoc["tasks"] = sched.get_num_tasks();
+  jdoc["isr_q_ovf"] = sched.get_isr_queue_overflows();
+  jdoc["add_fail"] = sched.get_num_add_failures();
+
+  // CPU duty cycle since the previous report: the part of wall time the scheduler did not spend idling
+  // and the rate of wakeups that were saved by batching tasks with slack
+  static sched_ts_t prev_report_ts = 0, prev_idle_time = 0;
+  static uint32_t prev_coalesced_runs = 0;
+  sched_ts_t ts = get_ts(), idle_time = sched.get_idle_time();
+  uint32_t coalesced_runs = sched.get_num_coalesced_runs();
+  if (ts > prev_report_ts)
+  {
+    jdoc["duty_pct"] = 100.0f - 100.0f * (idle_time - prev_idle_time) / (ts - prev_report_ts);
+    jdoc["saved_wakeups_h"] = (uint32_t)((uint64_t)(coalesced_runs - prev_coalesced_runs) * 3600 * 1000000 / (ts - prev_report_ts));
   }
+  prev_report_ts = ts;
+  prev_idle_time = idle_time;
+  prev_coalesced_runs = coalesced_runs;
+
+  // knob to display latency, from the histogram since boot
+  jdoc["input_p50_ms"] = get_disp_latency_percentile_ms(50);
+  jdoc["input_p95_ms"] = get_disp_latency_percentile_ms(95);
+  jdoc["input_p99_ms"] = get_disp_latency_percentile_ms(99);
+
+#if SCHED_PROFILING
+  sched_top_tasks_t top;
+  sched.for_each_task(collect_top_task, &top);
+
+  JsonArray top_array = jdoc.createNestedArray("top");
+  uint32_t cycles_per_us = ESP.getCpuFreqMHz();
+  for (int i = 0; i < top.count; i++)
+  {
+    const scheduler::task_info_t &info = top.tasks[i];
+    char task_name[24];
+    snprintf(task_name, sizeof(task_name), "0x%08x:%d", (unsigned int)(uintptr_t)info.func_ptr, info.id);
+
+    JsonObject task_obj = top_array.createNestedObject();
+    task_obj["task"] = task_name;
+    task_obj["n"] = info.timing.num_runs;
+    task_obj["exec_ms"] = (uint32_t)(info.timing.total_cycles / cycles_per_us / 1000);
+    task_obj["exec_max_us"] = info.timing.max_cycles / cycles_per_us;
+    task_obj["late_max_us"] = info.timing.max_lateness;
+  }
+#endif
+
+  send_mqtt_state(topic_state_sched, jdoc);
+}
 
+// retained, so that a stall that ended in a reset is still there to look at
+void send_mqtt_stall_record()
+{
+  bool from_previous_boot;
+  const stall_record_t *record = get_last_stall(from_previous_boot);
+  if (!record)
+    return;
+
+  JsonDocument &jdoc = report_jdoc;
+  jdoc.clear();
+
+  char buf[16];
+  snprintf(buf, sizeof(buf), "0x%08x", record->task_func);
+  jdoc["task"] = buf;
+  jdoc["id"] = record->task_id;
+  jdoc["start_ms"] = record->start_ms;
+  jdoc["duration_ms"] = record->duration_ms;
+  jdoc["reset"] = from_previous_boot ? get_last_stall_reset_reason() : String();
+
+  // space separated, ready to paste into addr2line
+  char stack[STALL_STACK_WORDS * 11 + 1] = "";
+  int stack_len = 0;
+  for (uint32_t i = 0; i < record->num_stack_words; i++)
   {
-    // sensor: current humidity
+    stack_len += snprintf(stack + stack_len, sizeof(stack) - stack_len, i ? " 0x%08x" : "0x%08x", record->stack[i]);
+  }
+  jdoc["stack"] = (char *)stack; // a char *, so the document keeps a copy
 
-    DynamicJsonDocument jdoc(500);
-    String hassio_device = "humidity";
-    String unique_id = device_id + "_" + hassio_device;
-    {
-      // device ID. This helps hassio group all the sensors of current esp instance together
-      auto dev_obj = jdoc.createNestedObject("dev");
-      dev_obj["name"] = device_id;
-      dev_obj["mf"] = "Prashant";
-      auto ids_array = dev_obj.createNestedArray("ids");
-      ids_array.add(device_id);
-    }
-    jdoc["name"] = unique_id;                                      // the name of the sensor that shows up in hassio
-    jdoc["stat_t"] = stat_topic_prefix + "/" + topic_suffix_dht11; // the stat topic that we publish. This is the one that hassio will start listening to
-    jdoc["uniq_id"] = unique_id;                                   // unique ID of the device in hassio. Doesn't get used for anything except as a unique ID
-    jdoc["unit_of_measurement"] = "%";                             // we measure in F
-    jdoc["device_class"] = "humidity";                             // this is the hassio device class
-    jdoc["value_template"] = "{{value_json['cur_hum']}}";          // this is how hassio pulls the value from our overall status message JSON
-
-    auto config_topic = homeassistant_prefix + "/sensor/" + unique_id + "/config";
-    send_mqtt_state(config_topic, jdoc, true);
+  send_mqtt_state(topic_state_stall, jdoc, true);
+}
+
+// Home Assistant MQTT discovery. The entities are described by the table below. One generator turns each entry
+// into its retained config message. Announcing is skipped when nothing changed since the last time, going by a
+// hash that is kept on flash, so that a broker restart doesn't make every unit resend its whole config. HA
+// asks for the configs again by publishing its birth message, when it (or the broker) restarts.
+struct ha_entity_t
+{
+  char component[14];    // sensor, binary_sensor
+  char object_id[20];    // the unique ID is <host>_<object_id>
+  char state_suffix[10]; // the state topic we publish, stat/therm/<host>/<suffix>
+  char value_key[14];    // where in our state JSON the value is
+  char unit[4];          // empty for none
+  char device_class[12]; // empty for none
+  bool on_off;           // binary sensor, with "on" / "off" payloads
+  bool needs_relays;     // only exists on units with relays. Removed from HA on units without
+};
+
+static const ha_entity_t ha_entities[] PROGMEM = {
+    {"sensor", "temperature", "dht11", "cur_temp", "°F", "temperature", false, false},
+    {"sensor", "humidity", "dht11", "cur_hum", "%", "humidity", false, false},
+    {"sensor", "target_temperature", "setpoint", "set_temp", "°F", "temperature", false, false},
+    {"binary_sensor", "presence", "presence", "sw_presence", "", "occupancy", true, false},
+    {"binary_sensor", "furnace", "relays", "rl_heat", "", "heat", true, true},
+    {"binary_sensor", "fan", "relays", "rl_fan", "", "", true, true},
+};
+
+// FNV-1a of everything printed to it
+class fnv1a_print_t : public Print
+{
+public:
+  uint32_t hash = 2166136261u;
+
+  size_t write(uint8_t c)
+  {
+    hash = (hash ^ c) * 16777619u;
+    return 1;
   }
+};
+
+// puts the config topic of the entity into config_topic, and its config into report_jdoc.
+// returns false if the entity doesn't exist on this unit, i.e. its config is to be removed
+bool build_ha_entity_config(const ha_entity_t &entity, char *config_topic, size_t config_topic_size)
+{
+  const char *host = therm_conf.host.c_str();
+  snprintf(config_topic, config_topic_size, "homeassistant/%s/%s_%s/config", entity.component, host, entity.object_id);
+  if (entity.needs_relays && !therm_conf.relays_available)
+    return false;
 
+  JsonDocument &jdoc = report_jdoc;
+  jdoc.clear();
   {
-    // sensor: target temp
+    // device ID. This helps hassio group all the sensors of current esp instance together
+    auto dev_obj = jdoc.createNestedObject("dev");
+    dev_obj["name"] = (char *)host;
+    dev_obj["mf"] = "Prashant";
+    auto ids_array = dev_obj.createNestedArray("ids");
+    ids_array.add((char *)host);
+  }
 
-    DynamicJsonDocument jdoc(500);
-    String hassio_device = "target_temperature";
-    String unique_id = device_id + "_" + hassio_device;
-    {
-      // device ID. This helps hassio group all the sensors of current esp instance together
-      auto dev_obj = jdoc.createNestedObject("dev");
-      dev_obj["name"] = device_id;
-      dev_obj["mf"] = "Prashant";
-      auto ids_array = dev_obj.createNestedArray("ids");
-      ids_array.add(device_id);
-    }
-    jdoc["name"] = unique_id;                                       // the name of the sensor that shows up in hassio
-    jdoc["stat_t"] = stat_topic_prefix + "/" + topic_suffix_target; // the stat topic that we publish. This is the one that hassio will start listening to
-    jdoc["uniq_id"] = unique_id;                                    // unique ID of the device in hassio. Doesn't get used for anything except as a unique ID
-    jdoc["unit_of_measurement"] = "°F";                             // we measure in F
-    jdoc["device_class"] = "temperature";                           // this is the hassio device class
-    jdoc["value_template"] = "{{value_json['set_temp']}}";          // this is how hassio pulls the value from our overall status message JSON
-
-    auto config_topic = homeassistant_prefix + "/sensor/" + unique_id + "/config";
-    send_mqtt_state(config_topic, jdoc, true);
+  char buf[MQTT_TOPIC_MAX_LEN];
+  snprintf(buf, sizeof(buf), "%s_%s", host, entity.object_id);
+  jdoc["name"] = buf;    // the name of the sensor that shows up in hassio
+  jdoc["uniq_id"] = buf; // unique ID of the device in hassio. Doesn't get used for anything except as a unique ID
+  snprintf(buf, sizeof(buf), "stat/%s/%s/%s", topic_component, host, entity.state_suffix);
+  jdoc["stat_t"] = buf; // the stat topic that we publish. This is the one that hassio will start listening to
+  if (entity.unit[0])
+    jdoc["unit_of_measurement"] = (char *)entity.unit;
+  if (entity.device_class[0])
+    jdoc["device_class"] = (char *)entity.device_class;
+  if (entity.on_off)
+  {
+    jdoc["pl_on"] = "on";   // payload that indicates "ON" state
+    jdoc["pl_off"] = "off"; // payload that indicates "OFF" state
   }
+  snprintf(buf, sizeof(buf), "{{value_json['%s']}}", entity.value_key);
+  jdoc["value_template"] = buf; // this is how hassio pulls the value from our overall status message JSON
+  return true;
+}
 
+// covers the broker as well: a unit that is moved to another one announces itself there
+uint32_t hash_ha_discovery()
+{
+  fnv1a_print_t hasher;
+  hasher.print(therm_conf.mqtt_server);
+  for (unsigned int idx = 0; idx < sizeof(ha_entities) / sizeof(ha_entities[0]); idx++)
   {
-    // sensor: presence
+    ha_entity_t entity;
+    memcpy_P(&entity, &ha_entities[idx], sizeof(entity));
+    char config_topic[MQTT_TOPIC_MAX_LEN + 32];
+    bool exists = build_ha_entity_config(entity, config_topic, sizeof(config_topic));
+    hasher.print(config_topic);
+    if (exists)
+      serializeJson(report_jdoc, hasher);
+  }
+  return hasher.hash;
+}
 
-    DynamicJsonDocument jdoc(500);
-    String hassio_device = "presence";
-    String unique_id = device_id + "_" + hassio_device;
-    {
-      // device ID. This helps hassio group all the sensors of current esp instance together
-      auto dev_obj = jdoc.createNestedObject("dev");
-      dev_obj["name"] = device_id;
-      dev_obj["mf"] = "Prashant";
-      auto ids_array = dev_obj.createNestedArray("ids");
-      ids_array.add(device_id);
-    }
-    jdoc["name"] = unique_id;                                      // the name of the sensor that shows up in hassio
-    jdoc["stat_t"] = stat_topic_prefix + "/" + topic_suffix_radar; // the stat topic that we publish. This is the one that hassio will start listening to
-    jdoc["uniq_id"] = unique_id;                                   // unique ID of the device in hassio. Doesn't get used for anything except as a unique ID
-    jdoc["device_class"] = "occupancy";                            // this is the hassio device class
-    jdoc["pl_on"] = "on";                                          // payload that indicates "ON" state
-    jdoc["pl_off"] = "off";                                        // payload that indicates "OFF" state
-    jdoc["value_template"] = "{{value_json['sw_presence']}}";      // this is how hassio pulls the value from our overall status message JSON
-
-    auto config_topic = homeassistant_prefix + "/binary_sensor/" + unique_id + "/config";
-    send_mqtt_state(config_topic, jdoc, true);
+uint32_t read_ha_discovery_hash()
+{
+  File hash_file = LittleFS.open(HA_DISCOVERY_HASH_FILE, "r");
+  if (!hash_file)
+    return 0;
+  String hash_str = hash_file.readStringUntil('\n');
+  hash_file.close();
+  return strtoul(hash_str.c_str(), NULL, 16);
+}
+
+void write_ha_discovery_hash(uint32_t hash)
+{
+  File hash_file = LittleFS.open(HA_DISCOVERY_HASH_FILE, "w");
+  if (!hash_file)
+  {
+    Serial.println("Failed to open HA discovery hash file");
+    return;
   }
+  hash_file.printf("%08x\n", hash);
+  hash_file.close();
+}
 
-  if (therm_conf.relays_available)
+void announce_devices_to_homeassistant(bool force)
+{
+  static uint32_t announced_hash = read_ha_discovery_hash();
+
+  uint32_t hash = hash_ha_discovery();
+  if (!force && hash == announced_hash)
   {
-    {
-      // sensor: furnace relay
-
-      DynamicJsonDocument jdoc(500);
-      String hassio_device = "furnace";
-      String unique_id = device_id + "_" + hassio_device;
-      {
-        // device ID. This helps hassio group all the sensors of current esp instance together
-        auto dev_obj = jdoc.createNestedObject("dev");
-        dev_obj["name"] = device_id;
-        dev_obj["mf"] = "Prashant";
-        auto ids_array = dev_obj.createNestedArray("ids");
-        ids_array.add(device_id);
-      }
-      jdoc["name"] = unique_id;                                       // the name of the sensor that shows up in hassio
-      jdoc["stat_t"] = stat_topic_prefix + "/" + topic_suffix_relays; // the stat topic that we publish. This is the one that hassio will start listening to
-      jdoc["uniq_id"] = unique_id;                                    // unique ID of the device in hassio. Doesn't get used for anything except as a unique ID
-      jdoc["device_class"] = "heat";                                  // this is the hassio device class
-      jdoc["pl_on"] = "on";                                           // payload that indicates "ON" state
-      jdoc["pl_off"] = "off";                                         // payload that indicates "OFF" state
-      jdoc["value_template"] = "{{value_json['rl_heat']}}";           // this is how hassio pulls the value from our overall status message JSON
-
-      auto config_topic = homeassistant_prefix + "/binary_sensor/" + unique_id + "/config";
-      send_mqtt_state(config_topic, jdoc, true);
-    }
+    Serial.println("HA discovery unchanged");
+    return;
+  }
 
-    {
-      // sensor: fan relay
-
-      DynamicJsonDocument jdoc(500);
-      String hassio_device = "fan";
-      String unique_id = device_id + "_" + hassio_device;
-      {
-        // device ID. This helps hassio group all the sensors of current esp instance together
-        auto dev_obj = jdoc.createNestedObject("dev");
-        dev_obj["name"] = device_id;
-        dev_obj["mf"] = "Prashant";
-        auto ids_array = dev_obj.createNestedArray("ids");
-        ids_array.add(device_id);
-      }
-      jdoc["name"] = unique_id;                                       // the name of the sensor that shows up in hassio
-      jdoc["stat_t"] = stat_topic_prefix + "/" + topic_suffix_relays; // the stat topic that we publish. This is the one that hassio will start listening to
-      jdoc["uniq_id"] = unique_id;                                    // unique ID of the device in hassio. Doesn't get used for anything except as a unique ID
-      jdoc["pl_on"] = "on";                                           // payload that indicates "ON" state
-      jdoc["pl_off"] = "off";                                         // payload that indicates "OFF" state
-      jdoc["value_template"] = "{{value_json['rl_fan']}}";            // this is how hassio pulls the value from our overall status message JSON
-
-      auto config_topic = homeassistant_prefix + "/binary_sensor/" + unique_id + "/config";
-      send_mqtt_state(config_topic, jdoc, true);
-    }
+  bool announced = true;
+  for (unsigned int idx = 0; idx < sizeof(ha_entities) / sizeof(ha_entities[0]); idx++)
+  {
+    ha_entity_t entity;
+    memcpy_P(&entity, &ha_entities[idx], sizeof(entity));
+    char config_topic[MQTT_TOPIC_MAX_LEN + 32];
+    if (build_ha_entity_config(entity, config_topic, sizeof(config_topic)))
+      announced = send_mqtt_state(config_topic, report_jdoc, true) && announced;
+    else
+      announced = mqtt_client.publish(config_topic, "", true) && announced; // an empty retained config removes the entity
+  }
+
+  // only remember what HA has actually got
+  if (announced && hash != announced_hash)
+  {
+    write_ha_discovery_hash(hash);
+    announced_hash = hash;
   }
 }
 
+void ha_rediscovery_task()
+{
+  announce_devices_to_homeassistant(true);
+}
+
 void init_mqtt()
 {
-  String common_mid = topic_component;
-  common_mid += "/";
-  common_mid += therm_conf.host;
-  stat_topic_prefix = "stat/" + common_mid;
-  cmnd_topic = "cmnd/" + common_mid;
+  const char *host = therm_conf.host.c_str();
+  snprintf(topic_state_relays, sizeof(topic_state_relays), "stat/%s/%s/%s", topic_component, host, topic_suffix_relays);
+  snprintf(topic_state_dht11, sizeof(topic_state_dht11), "stat/%s/%s/%s", topic_component, host, topic_suffix_dht11);
+  snprintf(topic_state_radar, sizeof(topic_state_radar), "stat/%s/%s/%s", topic_component, host, topic_suffix_radar);
+  snprintf(topic_state_target, sizeof(topic_state_target), "stat/%s/%s/%s", topic_component, host, topic_suffix_target);
+  snprintf(topic_state_sched, sizeof(topic_state_sched), "stat/%s/%s/%s", topic_component, host, topic_suffix_sched);
+  snprintf(topic_state_stall, sizeof(topic_state_stall), "stat/%s/%s/%s", topic_component, host, topic_suffix_stall);
+  snprintf(cmnd_topic, sizeof(cmnd_topic), "cmnd/%s/%s", topic_component, host);
+
+  mqtt_stats.min_free_heap = ESP.getFreeHeap();
 
   Serial.println(String("MQTT server: " + therm_conf.mqtt_server));
-  mqtt_client.setBufferSize(512);
+  mqtt_client.setBufferSize(MQTT_BUFFER_SIZE);
   mqtt_client.setServer(therm_conf.mqtt_server.c_str(), 1883);
 
-  sched.add_or_update_task((void *)mqtt_connect, 0, NULL, 0, 30 * 1000, 15000);
-  sched.add_or_update_task((void *)mqtt_update_task, 0, NULL, 0, 1, 1000);
+  schedule_mqtt_connect(MS_FROM_SECONDS(15));
+  sched.add_or_update_task<mqtt_update_task>(0, NULL, 0, MQTT_LOOP_PERIOD_MS, 1000, MQTT_LOOP_PERIOD_MS / 2);
+  sched.add_or_update_task<send_mqtt_sched_stats>(0, NULL, 0, SCHED_STATS_REPORT_PERIOD_MS, SCHED_STATS_REPORT_PERIOD_MS, MS_FROM_SECONDS(10));
 }
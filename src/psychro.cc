@@ -0,0 +1,46 @@
+#include "psychro.h"
+
+#include <arduino.h>
+
+// Magnus coefficients (Sonntag 1990, over water): gamma = ln(RH / 100) + b * T / (c + T), dew point = c * gamma / (b - gamma)
+#define MAGNUS_B_Q12 72172 // 17.62
+#define MAGNUS_C_Q8 62239  // 243.12 C
+
+// ln(RH / 100) for RH = 1, 2, .. 100 %, in Q12
+const int16_t ln_rh_table[] PROGMEM = {
+    -18863, -16024, -14363, -13185, -12271, -11524, -10892, -10345, -9863, -9431,
+    -9041, -8685, -8357, -8053, -7771, -7506, -7258, -7024, -6802, -6592,
+    -6392, -6202, -6020, -5845, -5678, -5518, -5363, -5214, -5070, -4931,
+    -4797, -4667, -4541, -4419, -4300, -4185, -4072, -3963, -3857, -3753,
+    -3652, -3553, -3457, -3363, -3271, -3181, -3093, -3006, -2922, -2839,
+    -2758, -2678, -2600, -2524, -2449, -2375, -2302, -2231, -2161, -2092,
+    -2025, -1958, -1892, -1828, -1764, -1702, -1640, -1580, -1520, -1461,
+    -1403, -1346, -1289, -1233, -1178, -1124, -1071, -1018, -966, -914,
+    -863, -813, -763, -714, -666, -618, -570, -524, -477, -432,
+    -386, -342, -297, -253, -210, -167, -125, -83, -41, 0,
+};
+
+// the table at the whole percent below, plus ln(1 + frac / percent) for the rest, as 2 * atanh(u) = 2u + 2u^3 / 3
+// with u = frac / (2 * percent + frac). Straight interpolation is off by up to 0.005 in ln at 5 %RH (over 0.1 F of
+// dew point), and more below; this is within the table's own rounding from 2 %RH up.
+// Below 1 %RH it's clamped, the dew point is off the scale there anyway
+int32_t ln_rh_q12(q8_t hum)
+{
+    hum = constrain(hum, Q8_FROM_INT(1), Q8_FROM_INT(100));
+    int percent = hum / Q8_ONE;
+    int32_t ln_rh = (int16_t)pgm_read_word(&ln_rh_table[percent - 1]);
+    int32_t frac = hum % Q8_ONE;
+    if (!frac)
+        return ln_rh;
+    int32_t u = (frac << 12) / (2 * percent * Q8_ONE + frac); // Q12
+    int32_t u3 = ((u * u) >> 12) * u >> 12;
+    return ln_rh + 2 * u + 2 * u3 / 3;
+}
+
+q8_t dew_point(q8_t temp, q8_t hum)
+{
+    int32_t temp_c = (temp - Q8_FROM_INT(32)) * 5 / 9;
+    int32_t gamma = ln_rh_q12(hum) + (int64_t)MAGNUS_B_Q12 * temp_c / (MAGNUS_C_Q8 + temp_c);
+    int32_t dew_point_c = (int64_t)MAGNUS_C_Q8 * gamma / (MAGNUS_B_Q12 - gamma);
+    return dew_point_c * 9 / 5 + Q8_FROM_INT(32);
+}
@@ -0,0 +1,222 @@
+#include "sensor.h"
+#include "config.h"
+#include "tasks.h"
+#include "mqtt.h"
+#include "disp.h"
+#include "utils.h"
+#include "estimator.h"
+
+#include <Wire.h>
+
+// the read period adapts: the aim is for the temperature to move about SENSOR_READ_STEP between readings.
+// While the furnace or the fan runs it is always the shortest, things are about to change
+#define SENSOR_READ_PERIOD_MIN_MS MS_FROM_SECONDS(5)
+#define SENSOR_READ_PERIOD_MAX_MS MS_FROM_SECONDS(60)
+#define SENSOR_READ_STEP (Q8_ONE / 4) // F
+#define SENSOR_BUS_WAIT_MS 2 // while a display frame is going out
+
+const sensor_driver_t *sensor = &dht11_driver;
+bool sensor_initialized = false;
+
+sample_filter_t temp_filter, hum_filter;
+temp_estimator_t temp_estimator;
+q8_t calibration_offset_temp_q8, calibration_offset_hum_q8; // from therm_conf, which only changes across a restart
+
+sensor_stats_t sensor_stats = {};
+unsigned int sensor_read_period_ms = SENSOR_READ_PERIOD_MIN_MS;
+
+sensor_frame_t sensor_read_frame;
+
+void sensor_read_task();
+
+// slows down by at most a factor of 2 per reading, so it takes a while of steady readings to get to the longest
+// period, and speeds up right away
+void adapt_read_period()
+{
+    unsigned int period = SENSOR_READ_PERIOD_MIN_MS;
+    if (temp_estimator.initialized && !therm_state.heat_relay && !therm_state.fan_relay)
+    {
+        int32_t rate = abs(temp_estimator.rate);
+        int64_t steady_period = rate ? (int64_t)SENSOR_READ_STEP * MS_FROM_HOURS(1) / rate : SENSOR_READ_PERIOD_MAX_MS;
+        period = constrain(steady_period, (int64_t)SENSOR_READ_PERIOD_MIN_MS, (int64_t)SENSOR_READ_PERIOD_MAX_MS);
+        period = min(period, 2 * sensor_read_period_ms);
+    }
+    if (period == sensor_read_period_ms)
+        return;
+
+    sensor_read_period_ms = period;
+    sched.add_or_update_task<sensor_read_task>(0, NULL, 1, period, period, period / 5);
+}
+
+void sensor_relays_changed()
+{
+    adapt_read_period();
+}
+
+void sensor_report();
+
+// filters a reading into therm_state. The temperature goes through the outlier filter, and whatever passes through the
+// estimator; averaging would make it lag behind
+void process_sensor_reading(const sensor_reading_t &reading)
+{
+    uint32_t start_cycles = ESP.getCycleCount();
+    q8_t filtered;
+    q8_t temperature = reading.temperature * 9 / 5 + Q8_FROM_INT(32);
+    if (filter_add(temp_filter, temperature, filtered) && !temp_filter.last_outlier)
+    {
+        estimator_update(temp_estimator, temperature, get_ts(), therm_state.heat_relay, therm_state.fan_relay);
+        therm_state.uncal_cur_temp = Q8_TO_FLOAT(temp_estimator.temp);
+        therm_state.cur_temp = Q8_TO_FLOAT(temp_estimator.temp + calibration_offset_temp_q8);
+        therm_state.cur_temp_rate = Q8_TO_FLOAT(temp_estimator.rate);
+    }
+    if (filter_add(hum_filter, reading.humidity, filtered))
+    {
+        therm_state.uncal_cur_hum = Q8_TO_FLOAT(filtered);
+        therm_state.cur_hum = Q8_TO_FLOAT(filtered + calibration_offset_hum_q8);
+    }
+    sensor_stats.filter_max_cycles = max(sensor_stats.filter_max_cycles, ESP.getCycleCount() - start_cycles);
+
+    adapt_read_period();
+    sensor_report();
+}
+
+// the display sends a frame a chunk per scheduler slot. Sensor transfers go in after it, rather than in between
+#define SENSOR_AWAIT_BUS(co)                               \
+    while (sensor->on_display_bus && is_disp_flushing())   \
+    CORO_AWAIT_DELAY(co, SENSOR_BUS_WAIT_MS)
+
+// one read: trigger, wait for the conversion, collect
+void sensor_read_coro(sensor_frame_t *co)
+{
+    CORO_BEGIN(co);
+    ++sensor_stats.num_reads;
+    SENSOR_AWAIT_BUS(co);
+    if (!sensor_initialized)
+        sensor_initialized = sensor->init();
+    if (!sensor_initialized || !sensor->trigger())
+    {
+        ++sensor_stats.num_timeouts;
+        Serial.println(String(sensor->name) + ": no answer");
+        CORO_EXIT(co);
+    }
+    CORO_AWAIT_DELAY(co, sensor->conversion_ms);
+
+    co->collect_deadline = get_ts() + US_FROM_MS(sensor->timeout_ms);
+    while (true)
+    {
+        SENSOR_AWAIT_BUS(co);
+        {
+            sensor_status_t status = sensor->collect(co->reading, get_ts() >= co->collect_deadline);
+            if (status == SENSOR_OK)
+            {
+                process_sensor_reading(co->reading);
+                CORO_EXIT(co);
+            }
+            if (status != SENSOR_BUSY)
+            {
+                if (status == SENSOR_TIMEOUT)
+                    ++sensor_stats.num_timeouts;
+                else
+                    ++sensor_stats.num_checksum_errors;
+                Serial.println(String(sensor->name) + (status == SENSOR_TIMEOUT ? ": timeout" : ": bad data"));
+                CORO_EXIT(co);
+            }
+        }
+        CORO_AWAIT_SIGNAL(co, sensor->poll_ms);
+    }
+    CORO_END(co);
+}
+
+void sensor_read_task()
+{
+    start_coro<sensor_read_coro>(0, &sensor_read_frame, 1);
+}
+
+// sends the reading if it changed enough, or every now and then regardless. The cadence follows the read period
+void sensor_report()
+{
+    if (isnan(therm_state.cur_temp) || isnan(therm_state.cur_hum))
+    {
+        return;
+    }
+
+    if (isnan(therm_state.last_reported_temp) ||
+        (abs(therm_state.last_reported_temp - therm_state.cur_temp) >= MIN_TEMP_DELTA_BETWEEN_REPORTS || abs(therm_state.last_reported_hum - therm_state.cur_hum) >= MIN_HUM_DELTA_BETWEEN_REPORTS || get_ts_ms() - therm_state.last_reported_ts > TEMP_REPORT_NOCHANGE_PERIOD))
+    {
+        therm_state.last_reported_temp = therm_state.cur_temp;
+        therm_state.last_reported_hum = therm_state.cur_hum;
+        therm_state.last_reported_ts = get_ts_ms();
+        send_mqtt_state_cur_temp();
+    }
+}
+
+void setup_sensor()
+{
+    switch (therm_conf.sensor_type)
+    {
+    case SENSOR_TYPE_SHT3X:
+        sensor = &sht3x_driver;
+        break;
+    case SENSOR_TYPE_BME280:
+        sensor = &bme280_driver;
+        break;
+    default:
+        sensor = &dht11_driver;
+        break;
+    }
+    // I2C sensors share the bus the display has set up already
+    sensor_initialized = sensor->init();
+    Serial.println(String("sensor: ") + sensor->name + (sensor_initialized ? "" : " not found"));
+
+    filter_init(temp_filter, sensor->min_outlier_temp);
+    filter_init(hum_filter, sensor->min_outlier_hum);
+    estimator_init(temp_estimator, sensor->temp_noise, sensor->temp_resolution);
+    calibration_offset_temp_q8 = Q8_FROM_FLOAT(therm_conf.calibration_offset_temp);
+    calibration_offset_hum_q8 = Q8_FROM_FLOAT(therm_conf.calibration_offset_hum);
+
+    // sensors need a second after power up. Readings are not time critical, let them share wakeups with other tasks
+    sched.add_or_update_task<sensor_read_task>(0, NULL, 1, sensor_read_period_ms, MS_FROM_SECONDS(1), sensor_read_period_ms / 5);
+}
+
+const sensor_stats_t &get_sensor_stats()
+{
+    sensor_stats.num_outliers_temp = temp_filter.num_outliers;
+    sensor_stats.num_outliers_hum = hum_filter.num_outliers;
+    sensor_stats.read_period_ms = sensor_read_period_ms;
+    return sensor_stats;
+}
+
+const char *get_sensor_name()
+{
+    return sensor->name;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+bool sensor_i2c_write(uint8_t address, const uint8_t *data, int num_bytes)
+{
+    Wire.beginTransmission(address);
+    Wire.write(data, num_bytes);
+    return Wire.endTransmission() == 0;
+}
+
+bool sensor_i2c_read(uint8_t address, uint8_t *data, int num_bytes)
+{
+    if (Wire.requestFrom(address, (uint8_t)num_bytes) != num_bytes)
+        return false;
+    for (int idx = 0; idx < num_bytes; idx++)
+    {
+        data[idx] = Wire.read();
+    }
+    return true;
+}
+
+bool sensor_i2c_read_register(uint8_t address, uint8_t reg, uint8_t *data, int num_bytes)
+{
+    // repeated start between the register address and the read
+    Wire.beginTransmission(address);
+    Wire.write(reg);
+    if (Wire.endTransmission(false) != 0)
+        return false;
+    return sensor_i2c_read(address, data, num_bytes);
+}
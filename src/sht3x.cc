@@ -0,0 +1,72 @@
+#include "sensor.h"
+
+// Sensirion SHT30/31/35 on the display's I2C bus. 0.01 C / 0.01 %RH resolution, every value comes with a CRC
+#define SHT3X_I2C_ADDRESS 0x44 // ADDR pin low, 0x45 when high
+#define SHT3X_CMD_MEASURE 0x2400 // single shot, high repeatability, no clock stretching: the bus stays free while it converts
+#define SHT3X_CMD_SOFT_RESET 0x30A2
+#define SHT3X_CONVERSION_MS 16 // 15.5 ms max at high repeatability
+#define SHT3X_POLL_MS 2
+#define SHT3X_TIMEOUT_MS 20
+
+bool sht3x_command(uint16_t command)
+{
+    uint8_t data[2] = {(uint8_t)(command >> 8), (uint8_t)command};
+    return sensor_i2c_write(SHT3X_I2C_ADDRESS, data, sizeof(data));
+}
+
+// CRC-8, polynomial 0x31, initial value 0xFF
+uint8_t sht3x_crc(const uint8_t *data, int num_bytes)
+{
+    uint8_t crc = 0xFF;
+    for (int idx = 0; idx < num_bytes; idx++)
+    {
+        crc ^= data[idx];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+bool sht3x_init()
+{
+    // the reset takes 1.5 ms, the first measurement is much later
+    return sht3x_command(SHT3X_CMD_SOFT_RESET);
+}
+
+bool sht3x_trigger()
+{
+    return sht3x_command(SHT3X_CMD_MEASURE);
+}
+
+sensor_status_t sht3x_collect(sensor_reading_t &reading, bool last_call)
+{
+    // temperature MSB, LSB, CRC, humidity MSB, LSB, CRC. The read is NACKed while the measurement is still running
+    uint8_t data[6];
+    if (!sensor_i2c_read(SHT3X_I2C_ADDRESS, data, sizeof(data)))
+        return last_call ? SENSOR_TIMEOUT : SENSOR_BUSY;
+    if (sht3x_crc(data, 2) != data[2] || sht3x_crc(data + 3, 2) != data[5])
+        return SENSOR_BAD_DATA;
+
+    // T = -45 + 175 * raw / 65535 C, RH = 100 * raw / 65535 %. Both fit 32 bits unsigned in Q8
+    uint32_t raw_temp = data[0] << 8 | data[1], raw_hum = data[3] << 8 | data[4];
+    reading.temperature = Q8_FROM_INT(-45) + (q8_t)(175 * Q8_ONE * raw_temp / 65535);
+    reading.humidity = (q8_t)(100 * Q8_ONE * raw_hum / 65535);
+    return SENSOR_OK;
+}
+
+const sensor_driver_t sht3x_driver = {
+    "sht3x",
+    true,
+    Q8_FROM_INT(1) / 2, // F
+    Q8_FROM_INT(1),
+    Q8_FROM_INT(1) / 10,
+    Q8_ONE / 50, // 0.01 C
+    SHT3X_CONVERSION_MS,
+    SHT3X_POLL_MS,
+    SHT3X_TIMEOUT_MS,
+    sht3x_init,
+    sht3x_trigger,
+    sht3x_collect,
+};
@@ -0,0 +1,159 @@
+#include "stall.h"
+
+#include "tasks.h"
+#include "mqtt.h"
+#include "utils.h"
+
+#include <Esp.h>
+
+// main loop stall detector. A hardware timer (timer1, which nothing else in this firmware uses; analogWrite,
+// tone and Servo would) interrupts every STALL_TIMER_PERIOD_MS and checks whether the scheduler is still in
+// the same task run as last time. Once a task has been running for longer than STALL_BUDGET_MS, its identity
+// and the code addresses on its stack are written to RTC user memory. That works from the ISR even while the
+// task blocks, and survives the soft WDT reset that often follows; the next boot reports it.
+
+#define STALL_TIMER_PERIOD_MS 50
+#define STALL_TIMER_TICKS ((80000000 / 256) * STALL_TIMER_PERIOD_MS / 1000) // timer1 counts the 80 MHz APB clock, divided by 256
+#define STALL_CHECK_PERIOD_MS MS_FROM_SECONDS(5)
+
+#define STALL_RECORD_MAGIC 0x57A11ED0
+#define STALL_STACK_SCAN_WORDS 512
+
+// RTC user memory, as seen by ESP.rtcUserMemoryRead/Write, mapped so the ISR can write it without calling into flash.
+// the first 32 words are left alone, OTA updates (eboot) keep their command there
+#define STALL_RTC_USER_MEM ((volatile uint32_t *)0x60001200)
+#define STALL_RTC_OFFSET 32
+
+#define STALL_RECORD_WORDS (sizeof(stall_record_t) / sizeof(uint32_t))
+
+volatile uint32_t stall_seen_seq = 0, stall_ticks = 0;
+volatile bool stall_recorded = false;
+volatile uint32_t num_stalls = 0;
+
+stall_record_t last_stall;
+bool last_stall_valid = false, last_stall_from_previous_boot = false;
+String last_stall_reset_reason;
+
+ICACHE_RAM_ATTR static inline bool is_code_address(uint32_t word)
+{
+    return (word >= 0x40100000 && word < 0x40108000) // IRAM
+        || (word >= 0x40201000 && word < 0x40300000); // flash mapped code
+}
+
+ICACHE_RAM_ATTR static inline uint32_t stall_record_check(volatile uint32_t *words)
+{
+    // everything but the magic and the check itself
+    uint32_t check = STALL_RECORD_MAGIC;
+    for (unsigned int idx = 2; idx < STALL_RECORD_WORDS; idx++)
+    {
+        check = (check << 5 | check >> 27) ^ words[idx];
+    }
+    return check;
+}
+
+ICACHE_RAM_ATTR void stall_timer_isr()
+{
+    const scheduler::running_task_t &running = sched.get_running_task();
+    uint32_t seq = running.seq;
+    task_func_t func = running.func_ptr;
+    if (seq != stall_seen_seq || func == NULL)
+    {
+        stall_seen_seq = seq;
+        stall_ticks = 0;
+        return;
+    }
+
+    uint32_t duration_ms = ++stall_ticks * STALL_TIMER_PERIOD_MS;
+    if (duration_ms < STALL_BUDGET_MS)
+        return;
+
+    volatile uint32_t *rtc = STALL_RTC_USER_MEM + STALL_RTC_OFFSET;
+    volatile stall_record_t *record = (volatile stall_record_t *)rtc;
+    if (duration_ms < STALL_BUDGET_MS + STALL_TIMER_PERIOD_MS)
+    {
+        // just went over budget. The ISR runs on the stack of the code it interrupted, so above our own
+        // frame are the return addresses of whatever the task is stuck in
+        uint32_t *sp;
+        __asm__ __volatile__("mov %0, a1" : "=r"(sp));
+        uint32_t num_words = 0;
+        for (uint32_t *word = sp; word < sp + STALL_STACK_SCAN_WORDS && word < (uint32_t *)0x40000000 && num_words < STALL_STACK_WORDS; word++)
+        {
+            if (is_code_address(*word))
+                rtc[offsetof(stall_record_t, stack) / sizeof(uint32_t) + num_words++] = *word;
+        }
+        record->num_stack_words = num_words;
+        record->task_func = (uint32_t)(uintptr_t)func;
+        record->task_id = running.id;
+        record->start_ms = running.start_ms;
+        record->magic = STALL_RECORD_MAGIC;
+        ++num_stalls;
+    }
+    // keep the duration current for as long as the stall lasts, in case it ends in a reset
+    record->duration_ms = duration_ms;
+    record->check = stall_record_check(rtc);
+    stall_recorded = true;
+}
+
+bool read_stall_record(stall_record_t &record)
+{
+    ESP.rtcUserMemoryRead(STALL_RTC_OFFSET, (uint32_t *)&record, sizeof(record));
+    bool valid = record.magic == STALL_RECORD_MAGIC && record.check == stall_record_check((volatile uint32_t *)&record) && record.num_stack_words <= STALL_STACK_WORDS;
+
+    // consume it
+    uint32_t magic = 0;
+    ESP.rtcUserMemoryWrite(STALL_RTC_OFFSET, &magic, sizeof(magic));
+    return valid;
+}
+
+// picks up stalls that the main loop recovered from
+void stall_check_task()
+{
+    if (!stall_recorded)
+        return;
+    stall_recorded = false;
+
+    stall_record_t record;
+    if (!read_stall_record(record))
+        return;
+    last_stall = record;
+    last_stall_valid = true;
+    last_stall_from_previous_boot = false;
+    Serial.printf("stall: task 0x%08x:%d ran for %u ms\n", record.task_func, record.task_id, record.duration_ms);
+    send_mqtt_stall_record();
+}
+
+const stall_record_t *get_last_stall(bool &from_previous_boot)
+{
+    from_previous_boot = last_stall_from_previous_boot;
+    return last_stall_valid ? &last_stall : NULL;
+}
+
+String get_last_stall_reset_reason()
+{
+    return last_stall_reset_reason;
+}
+
+uint32_t get_num_stalls()
+{
+    return num_stalls;
+}
+
+void setup_stall_detector()
+{
+    // a record that is still there at boot means the previous run never got to report it: it most likely died in the stall
+    stall_record_t record;
+    if (read_stall_record(record))
+    {
+        last_stall = record;
+        last_stall_valid = true;
+        last_stall_from_previous_boot = true;
+        last_stall_reset_reason = ESP.getResetReason();
+        Serial.printf("stall before reset (%s): task 0x%08x:%d ran for %u ms\n", last_stall_reset_reason.c_str(), record.task_func, record.task_id, record.duration_ms);
+    }
+
+    timer1_attachInterrupt(stall_timer_isr);
+    timer1_enable(TIM_DIV256, TIM_EDGE, TIM_LOOP);
+    timer1_write(STALL_TIMER_TICKS);
+
+    sched.add_or_update_task<stall_check_task>(0, NULL, 0, STALL_CHECK_PERIOD_MS, STALL_CHECK_PERIOD_MS, STALL_CHECK_PERIOD_MS);
+}
@@ -1,137 +1,389 @@
 #include "tasks.h"
 
-scheduler sched(MAX_NUM_TASKS); // 'task' scheduler
+#include <core_version.h>
+#include <coredecls.h>
 
-int scheduler::find_task(void *func, int id)
+// core 3.x can end a delay early when the loop gets esp_schedule()d, which lets ISRs cut the idle short
+#if defined(ARDUINO_ESP8266_MAJOR) && ARDUINO_ESP8266_MAJOR >= 3
+#define SCHED_INTERRUPTIBLE_IDLE 1
+#else
+#define SCHED_INTERRUPTIBLE_IDLE 0
+#endif
+
+static_scheduler<SCHED_MAX_TASKS> sched; // 'task' scheduler
+
+///////////////////////////////////////////////////////////////////////////////////////
+// (func_ptr, id) -> slot index
+
+unsigned int scheduler::hash_key(task_func_t func, int id)
 {
-    for (int i = 0; i < num_tasks; i++)
+    // function pointers are at least 4 byte aligned, the low bits carry no information
+    unsigned int h = ((unsigned int)(uintptr_t)func >> 2) ^ ((unsigned int)id * 0x9E3779B1u);
+    return h ^ (h >> 16);
+}
+
+void scheduler::rebuild_index()
+{
+    for (int i = 0; i <= index_mask; i++)
+    {
+        index[i] = -1;
+    }
+    for (int task_idx = 0; task_idx < max_tasks; task_idx++)
     {
-        if (tasks[i].id == id && tasks[i].func_ptr == func)
+        if (!tasks[task_idx].in_use)
+            continue;
+        unsigned int pos = hash_key(tasks[task_idx].func_ptr, tasks[task_idx].id) & index_mask;
+        while (index[pos] >= 0)
         {
-            return i;
+            pos = (pos + 1) & index_mask;
         }
+        index[pos] = task_idx;
+    }
+}
+
+int scheduler::find_task(task_func_t func, int id)
+{
+    unsigned int pos = hash_key(func, id) & index_mask;
+    while (index[pos] >= 0)
+    {
+        const task_t &task = tasks[index[pos]];
+        if (task.id == id && task.func_ptr == func)
+        {
+            return index[pos];
+        }
+        pos = (pos + 1) & index_mask;
     }
     return -1;
 }
 
-void scheduler::update_task(int task_idx, void *params, int priority, unsigned int period, unsigned int start_delay)
+///////////////////////////////////////////////////////////////////////////////////////
+// slot management
+
+bool scheduler::grow()
 {
-    tasks[task_idx].params = params;
-    tasks[task_idx].period = period;
-    tasks[task_idx].priority = priority;
-    tasks[task_idx].next_ts = get_ts() + start_delay;
+    if (!owns_storage)
+        return false;
 
-    // put the task in correct priority order
-    // other tasks are already sorted
+    int new_max_tasks = max_tasks * 2;
+    task_t *new_tasks = (task_t *)realloc(tasks, new_max_tasks * sizeof(task_t));
+    if (new_tasks == NULL)
+        return false;
+    tasks = new_tasks;
 
-    int direction_to_move = -1;
-    if ((task_idx == 0) || (tasks[task_idx - 1].priority <= priority))
-        direction_to_move = 0;
+    int *new_heap = (int *)realloc(heap, new_max_tasks * sizeof(int));
+    if (new_heap == NULL)
+        return false;
+    heap = new_heap;
 
-    if (direction_to_move == 0)
+    // keep the hash table at most half full
+    int *new_index = (int *)realloc(index, (index_mask + 1) * 2 * sizeof(int));
+    if (new_index == NULL)
+        return false;
+    index = new_index;
+    index_mask = (index_mask + 1) * 2 - 1;
+
+    // chain the new slots in front of the (empty) free list
+    for (int task_idx = max_tasks; task_idx < new_max_tasks; task_idx++)
     {
-        if (task_idx < num_tasks - 1 && tasks[task_idx + 1].priority < priority)
-            direction_to_move = 1;
+        tasks[task_idx].in_use = false;
+        tasks[task_idx].generation = 0;
+        tasks[task_idx].heap_pos = -1;
+        tasks[task_idx].next_free = (task_idx + 1 < new_max_tasks) ? task_idx + 1 : free_head;
     }
+    free_head = max_tasks;
+    max_tasks = new_max_tasks;
+
+    rebuild_index();
+    return true;
+}
 
-    if (direction_to_move != 0)
+int scheduler::alloc_slot(task_func_t func, int id)
+{
+    if (free_head < 0 && !grow())
+        return -1;
+
+    int task_idx = free_head;
+    free_head = tasks[task_idx].next_free;
+
+    task_t &task = tasks[task_idx];
+    task.func_ptr = func;
+    task.id = id;
+    task.heap_pos = -1;
+    memset(&task.timing, 0, sizeof(task.timing));
+    task.in_use = true;
+    ++num_tasks;
+
+    unsigned int pos = hash_key(func, id) & index_mask;
+    while (index[pos] >= 0)
     {
-        // move to correct place
-        int target_position = -1;
-        int other_task_idx = task_idx + direction_to_move;
-        for (; other_task_idx >= 0 && other_task_idx < num_tasks; other_task_idx += direction_to_move)
-        {
-            if ((tasks[other_task_idx].priority - priority) * direction_to_move >= 0)
-            {
-                target_position = other_task_idx - direction_to_move;
-                break;
-            }
-        }
-        if (other_task_idx < 0)
-        {
-            target_position = 0;
-        }
-        else if (other_task_idx == num_tasks)
-        {
-            target_position = num_tasks - 1;
-        }
+        pos = (pos + 1) & index_mask;
+    }
+    index[pos] = task_idx;
 
-        task_t temp = tasks[task_idx];
-        if (direction_to_move > 0)
-        {
-            memmove(&tasks[task_idx], &tasks[task_idx + 1], (target_position - task_idx) * sizeof(task_t));
-        }
-        else
+    return task_idx;
+}
+
+void scheduler::free_slot(int task_idx)
+{
+    task_t &task = tasks[task_idx];
+
+    // remove from the hash table with backward shift deletion, so that no tombstones are needed
+    unsigned int hole = hash_key(task.func_ptr, task.id) & index_mask;
+    while (index[hole] != task_idx)
+    {
+        hole = (hole + 1) & index_mask;
+    }
+    unsigned int pos = hole;
+    while (true)
+    {
+        pos = (pos + 1) & index_mask;
+        if (index[pos] < 0)
+            break;
+        unsigned int home = hash_key(tasks[index[pos]].func_ptr, tasks[index[pos]].id) & index_mask;
+        // the entry at pos can fill the hole only if its home bucket is not cyclically within (hole, pos]
+        if (((pos - home) & index_mask) >= ((pos - hole) & index_mask))
         {
-            memmove(&tasks[target_position + 1], &tasks[target_position], (task_idx - target_position) * sizeof(task_t));
+            index[hole] = index[pos];
+            hole = pos;
         }
-        tasks[target_position] = temp;
     }
+    index[hole] = -1;
+
+    task.in_use = false;
+    ++task.generation;
+    task.next_free = free_head;
+    free_head = task_idx;
+    --num_tasks;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// deadline heap
+
+bool scheduler::is_before(int task_a, int task_b)
+{
+    const task_t &a = tasks[task_a], &b = tasks[task_b];
+    if (a.latest_ts != b.latest_ts)
+        return a.latest_ts < b.latest_ts;
+    return a.priority < b.priority;
 }
 
-void scheduler::rearm_task(int task_idx)
+void scheduler::heap_swap(int pos_a, int pos_b)
 {
-    tasks[task_idx].next_ts = get_ts() + tasks[task_idx].period;
+    int task_a = heap[pos_a];
+    heap[pos_a] = heap[pos_b];
+    heap[pos_b] = task_a;
+    tasks[heap[pos_a]].heap_pos = pos_a;
+    tasks[heap[pos_b]].heap_pos = pos_b;
+}
+
+void scheduler::heap_sift_up(int pos)
+{
+    while (pos > 0)
+    {
+        int parent = (pos - 1) / 2;
+        if (!is_before(heap[pos], heap[parent]))
+            break;
+        heap_swap(pos, parent);
+        pos = parent;
+    }
+}
+
+void scheduler::heap_sift_down(int pos)
+{
+    while (true)
+    {
+        int smallest = pos;
+        int left = 2 * pos + 1, right = left + 1;
+        if (left < heap_size && is_before(heap[left], heap[smallest]))
+            smallest = left;
+        if (right < heap_size && is_before(heap[right], heap[smallest]))
+            smallest = right;
+        if (smallest == pos)
+            break;
+        heap_swap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+void scheduler::heap_push(int task_idx)
+{
+    int pos = heap_size++;
+    heap[pos] = task_idx;
+    tasks[task_idx].heap_pos = pos;
+    heap_sift_up(pos);
+}
+
+void scheduler::heap_remove(int task_idx)
+{
+    int pos = tasks[task_idx].heap_pos;
+    if (pos < 0)
+        return;
+    tasks[task_idx].heap_pos = -1;
+
+    int last = --heap_size;
+    if (pos == last)
+        return;
+
+    heap[pos] = heap[last];
+    tasks[heap[pos]].heap_pos = pos;
+    heap_sift_up(pos);
+    heap_sift_down(tasks[heap[pos]].heap_pos);
+}
+
+void scheduler::collect_due(int pos, sched_ts_t ts, int *due, int &num_due)
+{
+    // children never have an earlier latest_ts than their parent. A task can only be due if
+    // latest_ts <= ts + its slack <= ts + max_slack, so whole subtrees beyond that are skipped
+    if (pos >= heap_size || num_due >= SCHED_MAX_BATCH)
+        return;
+    const task_t &task = tasks[heap[pos]];
+    if (task.latest_ts > ts + max_slack)
+        return;
+    if (task.next_ts <= ts)
+        due[num_due++] = heap[pos];
+    collect_due(2 * pos + 1, ts, due, num_due);
+    collect_due(2 * pos + 2, ts, due, num_due);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+void scheduler::update_task(int task_idx, void *params, int priority, unsigned int period, unsigned int start_delay, unsigned int slack)
+{
+    heap_remove(task_idx);
+
+    tasks[task_idx].params = params;
+    tasks[task_idx].period = US_FROM_MS(period);
+    tasks[task_idx].priority = priority;
+    tasks[task_idx].slack = US_FROM_MS(slack);
+    tasks[task_idx].next_ts = get_ts() + US_FROM_MS(start_delay);
+    tasks[task_idx].latest_ts = tasks[task_idx].next_ts + tasks[task_idx].slack;
+    max_slack = max(max_slack, tasks[task_idx].slack);
+
+    heap_push(task_idx);
+}
+
+void scheduler::rearm_task(int task_idx, sched_ts_t deadline)
+{
+    // rearm relative to the previous deadline rather than to 'now', so periodic tasks don't drift
+    task_t &task = tasks[task_idx];
+    sched_ts_t ts = get_ts();
+    task.next_ts = deadline + task.period;
+    if (task.next_ts <= ts)
+    {
+        // we fell a whole period (or more) behind. Skip the missed deadlines instead of running the task back to back
+        sched_ts_t missed = (ts - task.next_ts) / task.period + 1;
+        task.next_ts += missed * task.period;
+        task.timing.num_overruns += missed;
+    }
+    task.latest_ts = task.next_ts + task.slack;
+    heap_push(task_idx);
+}
+
+void scheduler::record_timing(int task_idx, sched_ts_t deadline, sched_ts_t start_ts)
+{
+    task_timing_t &timing = tasks[task_idx].timing;
+    uint32_t lateness = start_ts > deadline ? (uint32_t)min<sched_ts_t>(start_ts - deadline, UINT32_MAX) : 0;
+    if (timing.num_runs > 0)
+    {
+        int32_t delta = abs((int32_t)(lateness - timing.last_lateness));
+        timing.jitter = (int32_t)timing.jitter + (delta - (int32_t)timing.jitter) / 16;
+    }
+    ++timing.num_runs;
+    timing.last_lateness = lateness;
+    timing.max_lateness = max(timing.max_lateness, lateness);
+    timing.total_lateness += lateness;
 }
 
 bool scheduler::remove_task(int task_idx)
 {
-    if (task_idx >= 0 && task_idx < num_tasks)
+    if (task_idx >= 0 && task_idx < max_tasks && tasks[task_idx].in_use)
     {
-        memmove(&tasks[task_idx], &tasks[task_idx + 1], (num_tasks - task_idx - 1) * sizeof(task_t));
-        --num_tasks;
+        heap_remove(task_idx);
+        free_slot(task_idx);
         return true;
     }
     return false;
 }
 
+void scheduler::init_storage()
+{
+    for (int task_idx = 0; task_idx < max_tasks; task_idx++)
+    {
+        tasks[task_idx].in_use = false;
+        tasks[task_idx].generation = 0;
+        tasks[task_idx].heap_pos = -1;
+        tasks[task_idx].next_free = (task_idx + 1 < max_tasks) ? task_idx + 1 : -1;
+    }
+    free_head = 0;
+    num_tasks = 0;
+    heap_size = 0;
+
+    rebuild_index();
+}
+
 scheduler::scheduler(int max_tasks)
 {
     this->max_tasks = max_tasks;
-    tasks = new task_t[max_tasks];
-    num_tasks = 0;
+    tasks = (task_t *)malloc(max_tasks * sizeof(task_t));
+    heap = (int *)malloc(max_tasks * sizeof(int));
+    index = (int *)malloc(index_size_for(max_tasks) * sizeof(int));
+    index_mask = index_size_for(max_tasks) - 1;
+    owns_storage = true;
+
+    init_storage();
+}
+
+scheduler::scheduler(task_t *tasks, int *heap, int *index, int max_tasks)
+{
+    this->max_tasks = max_tasks;
+    this->tasks = tasks;
+    this->heap = heap;
+    this->index = index;
+    index_mask = index_size_for(max_tasks) - 1;
+    owns_storage = false;
+
+    init_storage();
 }
 
 scheduler::~scheduler()
 {
-    if (tasks != NULL)
+    if (owns_storage)
     {
-        delete[] tasks;
+        free(tasks);
+        free(heap);
+        free(index);
     }
 }
 
-bool scheduler::add_or_update_task(void *func, int id, void *params, int priority, unsigned int period, unsigned int start_delay)
+// ISRs must not call into the task table directly; they go through the deferral queue below.
+// So the main loop never has to disable interrupts to keep the table consistent.
+bool scheduler::add_or_update_task(task_func_t func, int id, void *params, int priority, unsigned int period, unsigned int start_delay, unsigned int slack)
 {
-    if (num_tasks >= max_tasks)
-        return false;
-
-    noInterrupts();
-
     int task_idx = find_task(func, id);
 
     if (task_idx < 0)
     {
         // new task
-        task_idx = num_tasks++;
-
-        tasks[task_idx].func_ptr = func;
-        tasks[task_idx].id = id;
+        task_idx = alloc_slot(func, id);
+        if (task_idx < 0)
+        {
+            ++num_add_failures;
+            Serial.printf("scheduler full (%d tasks), dropped task %p:%d\n", max_tasks, (void *)func, id);
+            return false;
+        }
     }
 
-    update_task(task_idx, params, priority, period, start_delay);
+    update_task(task_idx, params, priority, period, start_delay, slack);
 
     // Serial.printf("created task %d\n", task_idx);
 
-    interrupts();
-
     return true;
 }
 
-bool scheduler::remove_task(void *func, int id)
+bool scheduler::remove_task(task_func_t func, int id)
 {
     if (num_tasks == 0)
         return false;
-    noInterrupts();
 
     int task_idx = find_task(func, id);
 
@@ -139,49 +391,285 @@ bool scheduler::remove_task(void *func, int id)
 
     // Serial.printf("removed task %d (%d)\n", task_idx, success);
 
-    interrupts();
-
     return success;
 }
 
-void scheduler::run(int notask_delay)
+bool scheduler::notify_task(task_func_t func, int id)
+{
+    int task_idx = find_task(func, id);
+    if (task_idx < 0)
+        return false;
+
+    task_t &task = tasks[task_idx];
+    sched_ts_t ts = get_ts();
+    if (task.heap_pos < 0)
+    {
+        // the task is running right now (it notified itself, or got notified from something it called). Run it again next pass
+        task.next_ts = task.latest_ts = ts;
+        heap_push(task_idx);
+    }
+    else if (task.latest_ts > ts)
+    {
+        // pull the deadline in, without slack: a signal is handled right away. It can only move towards the root of the heap
+        task.next_ts = task.latest_ts = ts;
+        heap_sift_up(task.heap_pos);
+    }
+    else
+    {
+        // already due
+        return true;
+    }
+    ++task.timing.num_notifies;
+    return true;
+}
+
+bool scheduler::requeue_current_task(sched_ts_t ts)
+{
+    if (current_task < 0 || !tasks[current_task].in_use)
+        return false;
+
+    task_t &task = tasks[current_task];
+    if (task.heap_pos >= 0)
+    {
+        if (task.next_ts <= ts)
+            return true;
+        heap_remove(current_task);
+    }
+    task.next_ts = ts;
+    // a parked task has no slack to add
+    task.latest_ts = ts > SCHED_TS_NEVER - task.slack ? SCHED_TS_NEVER : ts + task.slack;
+    heap_push(current_task);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// ISR deferral queue
+
+ICACHE_RAM_ATTR bool scheduler::defer(task_func_t func, int id, void *params, int priority, unsigned int period, unsigned int start_delay, deferred_op_type_t type)
+{
+    uint8_t head = isr_queue_head;
+    if ((uint8_t)(head - isr_queue_tail) >= ISR_QUEUE_SIZE)
+    {
+        ++isr_queue_overflows;
+        return false;
+    }
+
+    deferred_op_t &op = isr_queue[head & (ISR_QUEUE_SIZE - 1)];
+    op.func_ptr = func;
+    op.id = id;
+    op.params = params;
+    op.priority = priority;
+    op.period = period;
+    op.start_delay = start_delay;
+    op.type = type;
+
+    // publish the entry only after it is fully written
+    __asm__ __volatile__("" ::: "memory");
+    isr_queue_head = head + 1;
+
+#if SCHED_INTERRUPTIBLE_IDLE
+    // wake the loop if it's idling in run()
+    esp_schedule();
+#endif
+    return true;
+}
+
+void scheduler::drain_isr_queue()
+{
+    uint8_t tail = isr_queue_tail;
+    uint8_t head = isr_queue_head;
+    isr_queue_high_water = max<uint8_t>(isr_queue_high_water, head - tail);
+    __asm__ __volatile__("" ::: "memory");
+
+    for (; tail != head; ++tail)
+    {
+        const deferred_op_t &op = isr_queue[tail & (ISR_QUEUE_SIZE - 1)];
+        switch (op.type)
+        {
+        case DEFERRED_ADD_OR_UPDATE:
+            add_or_update_task(op.func_ptr, op.id, op.params, op.priority, op.period, op.start_delay, 0);
+            break;
+        case DEFERRED_REMOVE:
+            remove_task(op.func_ptr, op.id);
+            break;
+        case DEFERRED_NOTIFY:
+            notify_task(op.func_ptr, op.id);
+            break;
+        }
+        // hand the slot back to the producer as soon as it's consumed
+        isr_queue_tail = tail + 1;
+    }
+}
+
+#if SCHED_PROFILING
+void scheduler::record_exec_time(int task_idx, uint16_t generation, uint32_t cycles)
 {
-    unsigned long ts = get_ts();
+    // the task may have removed itself, and the slot may have been reused, while it ran
+    if (!tasks[task_idx].in_use || tasks[task_idx].generation != generation)
+        return;
+    task_timing_t &timing = tasks[task_idx].timing;
+    timing.max_cycles = max(timing.max_cycles, cycles);
+    timing.total_cycles += cycles;
+}
+#endif
+
+bool scheduler::get_task_timing(task_func_t func, int id, task_timing_t &timing)
+{
+    int task_idx = find_task(func, id);
+    if (task_idx < 0)
+        return false;
+    timing = tasks[task_idx].timing;
+    return true;
+}
+
+void scheduler::for_each_task(task_visitor_t visit, void *ctx)
+{
+    for (int task_idx = 0; task_idx < max_tasks; task_idx++)
+    {
+        const task_t &task = tasks[task_idx];
+        if (!task.in_use)
+            continue;
+        task_info_t info = {(void *)task.func_ptr, task.id, task.priority, task.next_ts, task.period, task.slack, task.timing};
+        visit(info, ctx);
+    }
+}
+
+bool scheduler::must_run_now(const task_t &task, sched_ts_t ts)
+{
+    if (task.latest_ts <= ts)
+        return true;
+    // idle() can't sleep less than a ms. If the window is open and closes sooner than that, run now
+    // instead of spinning the remainder away
+    return task.next_ts <= ts && task.latest_ts - ts < 1000;
+}
+
+void scheduler::idle(unsigned int max_idle_ms)
+{
+    if (isr_queue_head != isr_queue_tail)
+        return;
+
+    sched_ts_t ts = get_ts();
+    sched_ts_t idle_us = US_FROM_MS(max_idle_ms);
+    if (heap_size > 0)
+    {
+        // tasks with slack don't wake us up before they have to run; until then they ride along with other wakeups
+        sched_ts_t latest_ts = tasks[heap[0]].latest_ts;
+        idle_us = min(idle_us, latest_ts > ts ? latest_ts - ts : 0);
+    }
+
+    // delay() has 1 ms granularity. Round down so that we never oversleep a deadline; the sub-ms remainder is spun off by the next run()
+    uint32_t idle_ms = idle_us / 1000;
+    if (idle_ms == 0)
+    {
+        yield();
+        return;
+    }
+
+#if SCHED_INTERRUPTIBLE_IDLE
+    // keep sleeping until the timeout, or until an ISR queues work for us
+    esp_delay(idle_ms, [this]()
+              { return isr_queue_head == isr_queue_tail; });
+#else
+    delay(idle_ms);
+#endif
+    idle_time += get_ts() - ts;
+}
+
+void scheduler::run(unsigned int max_idle_ms)
+{
+    drain_isr_queue();
+
+    sched_ts_t ts = get_ts();
     // Serial.printf("(%d) check run, total = %d\n", ts, num_tasks);
+
+    ++num_runs;
+    if (heap_size == 0 || !must_run_now(tasks[heap[0]], ts))
+    {
+        // nothing has to run yet: sleep until the earliest latest run time instead of spinning loop()
+        idle(max_idle_ms);
+        return;
+    }
+
+    // we're awake anyway, so take along every task whose window is open. Snapshot them first: tasks that
+    // get re-armed for 'now' while this pass runs wait for the next pass
+    int due[SCHED_MAX_BATCH];
+    uint16_t due_generation[SCHED_MAX_BATCH];
+    int num_due = 0;
+    collect_due(0, ts, due, num_due);
+
+    // run them in deadline order
+    for (int pos = 1; pos < num_due; pos++)
+    {
+        for (int prev = pos; prev > 0 && is_before(due[prev], due[prev - 1]); prev--)
+        {
+            int task_idx = due[prev];
+            due[prev] = due[prev - 1];
+            due[prev - 1] = task_idx;
+        }
+    }
+    for (int pos = 0; pos < num_due; pos++)
+    {
+        due_generation[pos] = tasks[due[pos]].generation;
+    }
+
     int num_tasks_run = 0;
-    for (int task_idx = 0; task_idx < num_tasks; task_idx++)
+    for (int pos = 0; pos < num_due; pos++)
     {
-        auto task = tasks[task_idx];
-        if (task.next_ts <= ts)
+        int task_idx = due[pos];
+
+        // an earlier task in this batch may have removed, rescheduled or replaced this one
+        const task_t &queued = tasks[task_idx];
+        if (!queued.in_use || queued.generation != due_generation[pos] || queued.heap_pos < 0 || queued.next_ts > ts)
+            continue;
+        heap_remove(task_idx);
+
+        // the slot array can be reallocated while the task runs, don't hold references into it
+        task_t task = tasks[task_idx];
+
+        // it would have needed a wakeup of its own
+        if (task.latest_ts > ts)
+            ++num_coalesced_runs;
+
+        // run the task
+        // Serial.printf("run task %d \n", task_idx);
+        record_timing(task_idx, task.next_ts, get_ts());
+#if SCHED_PROFILING
+        uint32_t start_cycles = ESP.getCycleCount();
+#endif
+        current_task = task_idx;
+        running.func_ptr = task.func_ptr;
+        running.id = task.id;
+        running.start_ms = get_ts_ms();
+        ++running.seq;
+        task.func_ptr(task.params);
+        running.func_ptr = NULL;
+        ++running.seq;
+        current_task = -1;
+#if SCHED_PROFILING
+        record_exec_time(task_idx, task.generation, ESP.getCycleCount() - start_cycles);
+#endif
+
+        // after the function runs, it could have removed itself from the schedule or updated timings -- check for that.
+        // a task that updated itself is back in the heap; a removed one has a new generation.
+        const task_t &task2 = tasks[task_idx];
+        if (task2.in_use && task2.generation == task.generation && task2.heap_pos < 0)
         {
-            // run the task
-            // Serial.printf("run task %d \n", task_idx);
-            ((void (*)(void *))task.func_ptr)(task.params);
-
-            // after the function runs, it could have removed itself from the schedule or updated timings -- check for that
-            // even if the task updates itself, it can end up at the same idx; but it would have a different next_ts
-            auto task2 = tasks[task_idx];
-            if (task.func_ptr == task2.func_ptr && task.id == task2.id && task.next_ts == task2.next_ts)
+            // task did not move or update
+            if (task2.period > 0)
+            {
+                rearm_task(task_idx, task.next_ts);
+                // Serial.printf("rearm task %d \n", task_idx);
+            }
+            else
             {
-                // task did not move or update
-                if (task.period > 0)
-                {
-                    rearm_task(task_idx);
-                    // Serial.printf("rearm task %d \n", task_idx);
-                }
-                else
-                {
-                    // task done, no repeat. delete
-                    remove_task(task_idx);
-                    // Serial.printf("delete task %d \n", task_idx);
-                }
+                // task done, no repeat. delete
+                free_slot(task_idx);
+                // Serial.printf("delete task %d \n", task_idx);
             }
-            yield(); // give network stack a chance to grab stuff from wifi
-            ++num_tasks_run;
         }
+        yield(); // give network stack a chance to grab stuff from wifi
+        ++num_tasks_run;
     }
-    if (num_tasks_run == 0)
-    {
-        delay(notask_delay);
-    }
+    num_task_runs += num_tasks_run;
+    ++num_wakeups;
 }
@@ -22,3 +22,22 @@ String get_chip_id()
 {
     return String(ESP.getChipId());
 }
+
+char *format_uint64(uint64_t value, char *buf)
+{
+    char *ptr = buf + UINT64_MAX_DIGITS;
+    *ptr = 0;
+    do
+    {
+        *--ptr = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    return ptr;
+}
+
+String uint64_to_string(uint64_t value)
+{
+    // String has no 64-bit constructor
+    char buf[UINT64_MAX_DIGITS + 1];
+    return String(format_uint64(value, buf));
+}
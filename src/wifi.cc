@@ -1,6 +1,16 @@
 #include "wifi.h"
 #include "tasks.h"
 #include "disp.h"
+#include "utils.h"
+#include "stall.h"
+#include "sensor.h"
+#include "mqtt.h"
+
+// neither the web server nor mDNS can signal the scheduler, so they are polled at a rate that's fine for humans.
+// mDNS packets are processed by the core as they arrive (LEAmDNS schedules that itself); update() only runs the
+// probe/announce timers
+#define WEB_SERVER_POLL_PERIOD_MS 20
+#define MDNS_UPDATE_PERIOD_MS 100
 
 ESP8266WebServer web_server(80);
 bool web_server_initialized = false;
@@ -36,7 +46,7 @@ void wifi_connect()
     {
       init_web_server();
       Serial.println(String("already connected to WiFi SSID: ") + therm_conf.ssid);
-      draw_icon_wifi(true);
+      therm_state.wifi_connected = 1;
 
       return;
     }
@@ -44,11 +54,14 @@ void wifi_connect()
     web_server_initialized = false;
   }
 
-  draw_icon_wifi(false);
+  therm_state.wifi_connected = 0;
 
   Serial.println(String("attempting to connnect to WiFi SSID: ") + therm_conf.ssid);
   WiFi.hostname(therm_conf.host);
   WiFi.mode(WiFiMode_t::WIFI_STA);
+  // the radio sleeps between DTIM beacons while the scheduler idles. Light sleep would also stop the CPU, but it can only
+  // wake on GPIO levels, not the edges the knob quadrature decoder needs, so it isn't safe here
+  WiFi.setSleepMode(WIFI_MODEM_SLEEP);
   WiFi.begin(therm_conf.ssid, therm_conf.pass);
   // since we're not sure yet whether connection is successful, we don't set the wifi icon yet. It will be set the next time wifi_connect gets called
 }
@@ -83,7 +96,7 @@ void init_mdns()
 
   MDNS.addService("http", "tcp", 80);
 
-  sched.add_or_update_task((void *)mdns_update_task, 0, NULL, 2, 1, 0);
+  sched.add_or_update_task<mdns_update_task>(0, NULL, 2, MDNS_UPDATE_PERIOD_MS, 0, MDNS_UPDATE_PERIOD_MS / 2);
 }
 
 void handle_404()
@@ -134,6 +147,16 @@ const char config_form_html[] PROGMEM = R"===(
   <input type="submit" />
 </form>
 <form method="GET" action="/c">
+<h1>Sensor</h1>
+  <input type="radio" id="sensor_dht11" name="sensor_type" value="0" checked>
+  <label for="sensor_dht11">DHT11</label><br>
+  <input type="radio" id="sensor_sht3x" name="sensor_type" value="1">
+  <label for="sensor_sht3x">SHT3x (I2C, 0x44)</label><br>
+  <input type="radio" id="sensor_bme280" name="sensor_type" value="2">
+  <label for="sensor_bme280">BME280 (I2C, 0x76 / 0x77)</label><br>
+  <input type="submit" />
+</form>
+<form method="GET" action="/c">
 <h1>Calibration</h1>
   Temperature offset: 
     <input type="range" min="-20" max="20" step="0.1" name="calibration_offset_temp" 
@@ -154,9 +177,187 @@ Firmware:
 </form>
 )===";
 
+// /metrics is several KB with all the per task lines, too much to build up in one String on the heap. It goes out
+// chunked, through a small buffer on the stack
+#define METRICS_CHUNK_SIZE 256
+
+class metrics_writer_t : public Print
+{
+public:
+  size_t write(uint8_t c)
+  {
+    if (len == sizeof(buf))
+      send_buffered();
+    buf[len++] = c;
+    return 1;
+  }
+
+  void send_buffered()
+  {
+    if (len)
+      web_server.sendContent(buf, len);
+    len = 0;
+  }
+
+private:
+  char buf[METRICS_CHUNK_SIZE];
+  size_t len = 0;
+};
+
+// one sample. labels is the {...} part, or empty
+void append_metric(Print &out, const char *name, const char *labels, uint64_t value)
+{
+  // Print has no 64-bit overload
+  char digits[UINT64_MAX_DIGITS + 1];
+
+  out.print(name);
+  out.print(labels);
+  out.print(' ');
+  out.print(format_uint64(value, digits));
+  out.print('\n');
+}
+
+void append_metric(Print &out, const char *name, uint64_t value)
+{
+  append_metric(out, name, "", value);
+}
+
+// Prometheus text exposition of the scheduler's per task statistics.
+// tasks are labelled by function address (resolve with addr2line against the firmware .elf) and id
+void append_task_metrics(const scheduler::task_info_t &info, void *ctx)
+{
+  Print &out = *(Print *)ctx;
+  char labels[48];
+  snprintf(labels, sizeof(labels), "{task=\"0x%08x\",id=\"%d\"}", (unsigned int)(uintptr_t)info.func_ptr, info.id);
+
+  append_metric(out, "therm_task_runs_total", labels, info.timing.num_runs);
+  append_metric(out, "therm_task_notifies_total", labels, info.timing.num_notifies);
+  append_metric(out, "therm_task_overruns_total", labels, info.timing.num_overruns);
+  append_metric(out, "therm_task_lateness_us_total", labels, info.timing.total_lateness);
+  append_metric(out, "therm_task_lateness_us_max", labels, info.timing.max_lateness);
+  append_metric(out, "therm_task_jitter_us", labels, info.timing.jitter);
+  append_metric(out, "therm_task_slack_us", labels, info.slack);
+#if SCHED_PROFILING
+  append_metric(out, "therm_task_exec_cycles_total", labels, info.timing.total_cycles);
+  append_metric(out, "therm_task_exec_cycles_max", labels, info.timing.max_cycles);
+#endif
+}
+
+void handle_metrics()
+{
+  web_server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  web_server.send(200, "text/plain; version=0.0.4", "");
+  metrics_writer_t out;
+
+  append_metric(out, "therm_uptime_us", get_ts());
+  append_metric(out, "therm_cpu_freq_mhz", ESP.getCpuFreqMHz());
+  append_metric(out, "therm_sched_idle_us_total", sched.get_idle_time());
+  append_metric(out, "therm_sched_runs_total", sched.get_num_runs());
+  append_metric(out, "therm_sched_task_runs_total", sched.get_num_task_runs());
+  append_metric(out, "therm_sched_wakeups_total", sched.get_num_wakeups());
+  // task runs that shared a wakeup thanks to their slack, i.e. wakeups that didn't happen
+  append_metric(out, "therm_sched_saved_wakeups_total", sched.get_num_coalesced_runs());
+  append_metric(out, "therm_sched_saved_wakeups_per_hour", (uint64_t)sched.get_num_coalesced_runs() * 3600 * 1000000 / max<sched_ts_t>(get_ts(), 1));
+  append_metric(out, "therm_sched_tasks", sched.get_num_tasks());
+  append_metric(out, "therm_sched_tasks_max", sched.get_max_tasks());
+  append_metric(out, "therm_sched_add_failures_total", sched.get_num_add_failures());
+  append_metric(out, "therm_sched_isr_queue_overflows_total", sched.get_isr_queue_overflows());
+  append_metric(out, "therm_sched_isr_queue_high_water", sched.get_isr_queue_high_water());
+  append_metric(out, "therm_stalls_total", get_num_stalls());
+
+  const sensor_stats_t &sensor_stats = get_sensor_stats();
+  char labels[32];
+  snprintf(labels, sizeof(labels), "{driver=\"%s\"}", get_sensor_name());
+  append_metric(out, "therm_sensor_info", labels, 1);
+  append_metric(out, "therm_sensor_reads_total", sensor_stats.num_reads);
+  append_metric(out, "therm_sensor_timeouts_total", sensor_stats.num_timeouts);
+  append_metric(out, "therm_sensor_checksum_errors_total", sensor_stats.num_checksum_errors);
+  append_metric(out, "therm_sensor_outliers_total", "{quantity=\"temp\"}", sensor_stats.num_outliers_temp);
+  append_metric(out, "therm_sensor_outliers_total", "{quantity=\"hum\"}", sensor_stats.num_outliers_hum);
+  append_metric(out, "therm_sensor_filter_cycles_max", sensor_stats.filter_max_cycles);
+  append_metric(out, "therm_sensor_read_period_ms", sensor_stats.read_period_ms);
+
+  const disp_stats_t &disp_stats = get_disp_stats();
+  append_metric(out, "therm_disp_frames_total", disp_stats.num_frames);
+  append_metric(out, "therm_disp_bytes_total", disp_stats.bytes_sent);
+  append_metric(out, "therm_disp_frame_bytes_last", disp_stats.last_frame_bytes);
+  append_metric(out, "therm_disp_frame_bytes_max", disp_stats.max_frame_bytes);
+  append_metric(out, "therm_disp_chunk_us_max", disp_stats.max_chunk_us);
+  append_metric(out, "therm_disp_widget_renders_total", disp_stats.widget_renders);
+  append_metric(out, "therm_disp_render_us_total", disp_stats.total_render_us);
+  append_metric(out, "therm_disp_render_us_max", disp_stats.max_render_us);
+  // user input (knob) to the end of the display transfer that shows it
+  uint32_t num_latencies = 0;
+  for (int bucket = 0; bucket < DISP_LATENCY_NUM_BUCKETS; bucket++)
+  {
+    num_latencies += disp_stats.latency_buckets[bucket];
+    snprintf(labels, sizeof(labels), "{le=\"%u\"}", disp_latency_bucket_ms[bucket] * 1000U);
+    append_metric(out, "therm_disp_input_latency_us_bucket", labels, num_latencies);
+  }
+  append_metric(out, "therm_disp_input_latency_us_bucket", "{le=\"+Inf\"}", disp_stats.num_latencies);
+  append_metric(out, "therm_disp_input_latency_us_sum", disp_stats.total_latency_us);
+  append_metric(out, "therm_disp_input_latency_us_count", disp_stats.num_latencies);
+
+  append_metric(out, "therm_heap_free_bytes", ESP.getFreeHeap());
+  append_metric(out, "therm_heap_max_free_block_bytes", ESP.getMaxFreeBlockSize());
+  append_metric(out, "therm_heap_fragmentation_pct", ESP.getHeapFragmentation());
+
+  const mqtt_stats_t &mqtt_stats = get_mqtt_stats();
+  append_metric(out, "therm_mqtt_publish_min_free_heap_bytes", mqtt_stats.min_free_heap);
+  append_metric(out, "therm_mqtt_publishes_total", mqtt_stats.num_publishes);
+  append_metric(out, "therm_mqtt_publish_failures_total", mqtt_stats.num_publish_failures);
+  append_metric(out, "therm_mqtt_payload_bytes_total", mqtt_stats.payload_bytes);
+  append_metric(out, "therm_mqtt_publish_cycles_total", mqtt_stats.total_publish_cycles);
+  append_metric(out, "therm_mqtt_publish_cycles_max", mqtt_stats.max_publish_cycles);
+
+  sched.for_each_task(append_task_metrics, (Print *)&out);
+
+  out.send_buffered();
+  // an empty chunk ends a chunked response
+  web_server.sendContent("");
+}
+
+// what the display shows, as a PBM image. For checking screen changes against known good snapshots without
+// looking at the panel: curl http://<host>/screen.pbm
+void handle_screen()
+{
+  char header[24];
+  int header_len = snprintf(header, sizeof(header), "P4\n%d %d\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+  web_server.setContentLength(header_len + SCREEN_WIDTH * SCREEN_HEIGHT / 8);
+  web_server.send(200, "image/x-portable-bitmap", "");
+  web_server.sendContent(header, header_len);
+
+  uint8_t rows[8 * SCREEN_WIDTH / 8];
+  for (int page = 0; page < SCREEN_HEIGHT / 8; page++)
+  {
+    get_screen_pbm_rows(page, rows);
+    web_server.sendContent((const char *)rows, sizeof(rows));
+  }
+}
+
 void handle_root()
 {
-  web_server.send(200, "text/html", config_form_html);
+  String page;
+  bool from_previous_boot;
+  const stall_record_t *stall = get_last_stall(from_previous_boot);
+  if (stall)
+  {
+    char buf[96];
+    page += "<h1>Last stall</h1>\n<pre>";
+    snprintf(buf, sizeof(buf), "task 0x%08x:%d started at %u ms, ran for %u ms\n", stall->task_func, stall->task_id, stall->start_ms, stall->duration_ms);
+    page += buf;
+    if (from_previous_boot)
+      page += "ended in a reset: " + get_last_stall_reset_reason() + "\n";
+    page += "stack:";
+    for (uint32_t i = 0; i < stall->num_stack_words; i++)
+    {
+      snprintf(buf, sizeof(buf), " 0x%08x", stall->stack[i]);
+      page += buf;
+    }
+    page += "</pre>\n";
+  }
+  page += FPSTR(config_form_html);
+  web_server.send(200, "text/html", page);
 }
 
 void handle_config_update_params()
@@ -170,6 +371,7 @@ void handle_config_update_params()
   auto calibration_offset_temp = web_server.arg("calibration_offset_temp");
   auto calibration_offset_hum = web_server.arg("calibration_offset_hum");
   auto relays_available = web_server.arg("relays_available");
+  auto sensor_type = web_server.arg("sensor_type");
 
   if (!therm_conf.read("/therm.conf"))
   {
@@ -198,6 +400,8 @@ void handle_config_update_params()
     therm_conf.calibration_offset_hum = calibration_offset_hum.toFloat();
   if (!relays_available.isEmpty())
     therm_conf.relays_available = relays_available.toInt();
+  if (!sensor_type.isEmpty())
+    therm_conf.sensor_type = sensor_type.toInt();
 
   therm_conf.write("/therm.conf");
   web_server.sendHeader("Connection", "close");
@@ -214,6 +418,8 @@ void init_web_server()
 
   web_server.on("/", handle_root);
   web_server.on("/c", handle_config_update_params);
+  web_server.on("/metrics", handle_metrics);
+  web_server.on("/screen.pbm", handle_screen);
   web_server.onNotFound(handle_404);
   web_server.on(
       "/update", HTTP_POST,
@@ -264,7 +470,7 @@ void init_web_server()
         yield();
       });
   web_server.begin();
-  sched.add_or_update_task((void *)web_server_handle_client_task, 0, NULL, 0, 1, 0);
+  sched.add_or_update_task<web_server_handle_client_task>(0, NULL, 0, WEB_SERVER_POLL_PERIOD_MS, 0, WEB_SERVER_POLL_PERIOD_MS / 2);
   Serial.println("HTTP server started");
   web_server_initialized = true;
 }
@@ -281,7 +487,7 @@ void init_wifi()
   {
     // wifi config read. now connect
     // check wifi periodically, and reconnect if needed.
-    sched.add_or_update_task((void *)wifi_connect, 0, NULL, 0, 30 * 1000, 0);
+    sched.add_or_update_task<wifi_connect>(0, NULL, 0, 30 * 1000, 0, MS_FROM_SECONDS(5));
   }
   init_mdns();
 }
@@ -0,0 +1,268 @@
+#ifndef __FAKE_ADAFRUIT_GFX_H__
+#define __FAKE_ADAFRUIT_GFX_H__
+
+#include "Arduino.h"
+
+// the part of Adafruit GFX the firmware draws with, done the way the library does it: everything ends up in
+// per-pixel drawPixel() calls, so the relative cost of GFX drawing against direct framebuffer access carries over.
+// text is the built-in 5x7 font, with only the characters the screens print (others come out as a box), or a GFX
+// font, drawn like the library draws it, with the font headers from the library (Fonts/*.h)
+
+#define BLACK 0
+#define WHITE 1
+#define INVERSE 2
+
+// as in gfxfont.h
+struct GFXglyph
+{
+    uint16_t bitmapOffset;
+    uint8_t width, height;
+    uint8_t xAdvance;
+    int8_t xOffset, yOffset;
+};
+
+struct GFXfont
+{
+    uint8_t *bitmap;
+    GFXglyph *glyph;
+    uint16_t first, last;
+    uint8_t yAdvance;
+};
+
+// classic 5x7 font: 5 columns per character, LSB on top
+struct fake_gfx_char_t
+{
+    char ch;
+    uint8_t columns[5];
+};
+
+static const fake_gfx_char_t fake_gfx_font[] = {
+    {' ', {0x00, 0x00, 0x00, 0x00, 0x00}},
+    {'-', {0x08, 0x08, 0x08, 0x08, 0x08}},
+    {':', {0x00, 0x36, 0x36, 0x00, 0x00}},
+    {'0', {0x3E, 0x51, 0x49, 0x45, 0x3E}},
+    {'1', {0x00, 0x42, 0x7F, 0x40, 0x00}},
+    {'2', {0x72, 0x49, 0x49, 0x49, 0x46}},
+    {'3', {0x21, 0x41, 0x49, 0x4D, 0x33}},
+    {'4', {0x18, 0x14, 0x12, 0x7F, 0x10}},
+    {'5', {0x27, 0x45, 0x45, 0x45, 0x39}},
+    {'6', {0x3C, 0x4A, 0x49, 0x49, 0x31}},
+    {'7', {0x41, 0x21, 0x11, 0x09, 0x07}},
+    {'8', {0x36, 0x49, 0x49, 0x49, 0x36}},
+    {'9', {0x46, 0x49, 0x49, 0x29, 0x1E}},
+    {'C', {0x3E, 0x41, 0x41, 0x41, 0x22}},
+    {'F', {0x7F, 0x09, 0x09, 0x09, 0x01}},
+    {'H', {0x7F, 0x08, 0x08, 0x08, 0x7F}},
+    {'I', {0x00, 0x41, 0x7F, 0x41, 0x00}},
+    {'L', {0x7F, 0x40, 0x40, 0x40, 0x40}},
+    {'S', {0x26, 0x49, 0x49, 0x49, 0x32}},
+    {'a', {0x20, 0x54, 0x54, 0x54, 0x78}},
+    {'d', {0x38, 0x44, 0x44, 0x48, 0x7F}},
+    {'e', {0x38, 0x54, 0x54, 0x54, 0x18}},
+    {'h', {0x7F, 0x08, 0x04, 0x04, 0x78}},
+    {'i', {0x00, 0x44, 0x7D, 0x40, 0x00}},
+    {'m', {0x7C, 0x04, 0x18, 0x04, 0x78}},
+    {'n', {0x7C, 0x08, 0x04, 0x04, 0x78}},
+    {'s', {0x48, 0x54, 0x54, 0x54, 0x24}},
+    {'t', {0x04, 0x04, 0x3F, 0x44, 0x24}},
+    {'u', {0x3C, 0x40, 0x40, 0x20, 0x7C}},
+};
+
+class Adafruit_GFX : public Print
+{
+protected:
+    int16_t _width, _height;
+    int16_t cursor_x = 0, cursor_y = 0;
+    uint16_t textcolor = WHITE, textbgcolor = WHITE;
+    bool wrap = true;
+    const GFXfont *gfxFont = NULL;
+
+public:
+    Adafruit_GFX(int16_t w, int16_t h) : _width(w), _height(h) {}
+
+    virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+
+    int16_t width() const { return _width; }
+    int16_t height() const { return _height; }
+
+    void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color)
+    {
+        for (int16_t row = y; row < y + h; row++)
+            drawPixel(x, row, color);
+    }
+    void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color)
+    {
+        for (int16_t col = x; col < x + w; col++)
+            drawPixel(col, y, color);
+    }
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+    {
+        for (int16_t col = x; col < x + w; col++)
+            drawFastVLine(col, y, h, color);
+    }
+    void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+    {
+        drawFastHLine(x, y, w, color);
+        drawFastHLine(x, y + h - 1, w, color);
+        drawFastVLine(x, y, h, color);
+        drawFastVLine(x + w - 1, y, h, color);
+    }
+    virtual void fillScreen(uint16_t color) { fillRect(0, 0, _width, _height, color); }
+
+    // rows of (w + 7) / 8 bytes, MSB on the left. Set bits are drawn in color, clear ones in bg if given
+    void drawBitmap(int16_t x, int16_t y, const uint8_t *bitmap, int16_t w, int16_t h, uint16_t color)
+    {
+        int16_t byte_width = (w + 7) / 8;
+        for (int16_t row = 0; row < h; row++)
+            for (int16_t col = 0; col < w; col++)
+                if (pgm_read_byte(bitmap + row * byte_width + col / 8) & (0x80 >> (col & 7)))
+                    drawPixel(x + col, y + row, color);
+    }
+    void drawBitmap(int16_t x, int16_t y, const uint8_t *bitmap, int16_t w, int16_t h, uint16_t color, uint16_t bg)
+    {
+        int16_t byte_width = (w + 7) / 8;
+        for (int16_t row = 0; row < h; row++)
+            for (int16_t col = 0; col < w; col++)
+                drawPixel(x + col, y + row, (bitmap[row * byte_width + col / 8] & (0x80 >> (col & 7))) ? color : bg);
+    }
+
+    // the cursor is on the baseline with a GFX font, at the top with the built-in one
+    void setFont(const GFXfont *font = NULL)
+    {
+        if (font && !gfxFont)
+            cursor_y += 6;
+        else if (!font && gfxFont)
+            cursor_y -= 6;
+        gfxFont = font;
+    }
+    void setTextSize(uint8_t) {}
+    void setTextColor(uint16_t color) { textcolor = textbgcolor = color; }
+    void setTextColor(uint16_t color, uint16_t bg)
+    {
+        textcolor = color;
+        textbgcolor = bg;
+    }
+    void setTextWrap(bool w) { wrap = w; }
+    void setCursor(int16_t x, int16_t y)
+    {
+        cursor_x = x;
+        cursor_y = y;
+    }
+
+    void drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg)
+    {
+        if (gfxFont)
+        {
+            // the glyph's bits run on from one row into the next, MSB first. Only the set ones are drawn
+            const GFXglyph &glyph = gfxFont->glyph[c - gfxFont->first];
+            const uint8_t *bitmap = gfxFont->bitmap + glyph.bitmapOffset;
+            uint8_t bits = 0;
+            int bit = 0;
+            for (int yy = 0; yy < glyph.height; yy++)
+            {
+                for (int xx = 0; xx < glyph.width; xx++, bits <<= 1)
+                {
+                    if (!(bit++ & 7))
+                        bits = pgm_read_byte(bitmap++);
+                    if (bits & 0x80)
+                        drawPixel(x + glyph.xOffset + xx, y + glyph.yOffset + yy, color);
+                }
+            }
+            return;
+        }
+        const uint8_t box[5] = {0x7F, 0x41, 0x41, 0x41, 0x7F};
+        const uint8_t *columns = box;
+        for (const fake_gfx_char_t &glyph : fake_gfx_font)
+        {
+            if (glyph.ch == c)
+                columns = glyph.columns;
+        }
+        for (int8_t col = 0; col < 5; col++)
+        {
+            uint8_t line = columns[col];
+            for (int8_t row = 0; row < 8; row++, line >>= 1)
+            {
+                if (line & 1)
+                    drawPixel(x + col, y + row, color);
+                else if (bg != color)
+                    drawPixel(x + col, y + row, bg);
+            }
+        }
+    }
+
+    size_t write(uint8_t c) override
+    {
+        if (gfxFont)
+        {
+            if (c == '\n')
+            {
+                cursor_x = 0;
+                cursor_y += gfxFont->yAdvance;
+            }
+            else if (c != '\r' && c >= gfxFont->first && c <= gfxFont->last)
+            {
+                const GFXglyph &glyph = gfxFont->glyph[c - gfxFont->first];
+                if (glyph.width && glyph.height)
+                {
+                    if (wrap && cursor_x + glyph.xOffset + glyph.width > _width)
+                    {
+                        cursor_x = 0;
+                        cursor_y += gfxFont->yAdvance;
+                    }
+                    drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor);
+                }
+                cursor_x += glyph.xAdvance;
+            }
+            return 1;
+        }
+        if (c == '\n')
+        {
+            cursor_x = 0;
+            cursor_y += 8;
+        }
+        else if (c != '\r')
+        {
+            if (wrap && cursor_x + 6 > _width)
+            {
+                cursor_x = 0;
+                cursor_y += 8;
+            }
+            drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor);
+            cursor_x += 6;
+        }
+        return 1;
+    }
+    using Print::write;
+};
+
+// 1 bit per pixel, rows of (w + 7) / 8 bytes, MSB on the left
+class GFXcanvas1 : public Adafruit_GFX
+{
+    uint8_t *buffer;
+
+public:
+    GFXcanvas1(uint16_t w, uint16_t h) : Adafruit_GFX(w, h) { buffer = (uint8_t *)calloc((w + 7) / 8 * h, 1); }
+    ~GFXcanvas1() { free(buffer); }
+
+    uint8_t *getBuffer() const { return buffer; }
+
+    void drawPixel(int16_t x, int16_t y, uint16_t color) override
+    {
+        if (x < 0 || y < 0 || x >= _width || y >= _height)
+            return;
+        uint8_t *ptr = &buffer[(x / 8) + y * ((_width + 7) / 8)];
+        if (color)
+            *ptr |= 0x80 >> (x & 7);
+        else
+            *ptr &= ~(0x80 >> (x & 7));
+    }
+    bool getPixel(int16_t x, int16_t y) const
+    {
+        if (x < 0 || y < 0 || x >= _width || y >= _height)
+            return false;
+        return buffer[(x / 8) + y * ((_width + 7) / 8)] & (0x80 >> (x & 7));
+    }
+    void fillScreen(uint16_t color) override { memset(buffer, color ? 0xFF : 0x00, (_width + 7) / 8 * _height); }
+};
+
+#endif // __FAKE_ADAFRUIT_GFX_H__
@@ -0,0 +1,98 @@
+#ifndef __FAKE_ADAFRUIT_SSD1306_H__
+#define __FAKE_ADAFRUIT_SSD1306_H__
+
+#include "Adafruit_GFX.h"
+#include "Wire.h"
+
+// the framebuffer side of Adafruit_SSD1306: pages of 8 rows, one byte per column, LSB on top. The library's own
+// transfers (init sequence, dim) go over the fake Wire like they would over the real one; display() isn't there,
+// the firmware sends the framebuffer itself
+
+#define SSD1306_WHITE WHITE
+#define SSD1306_BLACK BLACK
+#define SSD1306_INVERSE INVERSE
+
+#define SSD1306_SWITCHCAPVCC 0x02
+#define SSD1306_MEMORYMODE 0x20
+#define SSD1306_COLUMNADDR 0x21
+#define SSD1306_PAGEADDR 0x22
+#define SSD1306_SETCONTRAST 0x81
+#define SSD1306_CHARGEPUMP 0x8D
+#define SSD1306_DISPLAYOFF 0xAE
+#define SSD1306_DISPLAYON 0xAF
+
+class Adafruit_SSD1306 : public Adafruit_GFX
+{
+    uint8_t *buffer = NULL;
+    TwoWire *wire;
+    uint8_t i2c_address = 0x3C;
+    uint32_t clock_after;
+
+    void commands(const uint8_t *cmds, size_t len)
+    {
+        wire->beginTransmission(i2c_address);
+        wire->write((uint8_t)0x00);
+        wire->write(cmds, len);
+        wire->endTransmission();
+    }
+
+public:
+    Adafruit_SSD1306(uint8_t w, uint8_t h, TwoWire *twi, int8_t rst_pin = -1, uint32_t clk_during = 400000, uint32_t clk_after = 100000)
+        : Adafruit_GFX(w, h), wire(twi), clock_after(clk_after)
+    {
+        (void)rst_pin;
+        (void)clk_during;
+    }
+    ~Adafruit_SSD1306() { free(buffer); }
+
+    bool begin(uint8_t vcs = SSD1306_SWITCHCAPVCC, uint8_t addr = 0x3C)
+    {
+        (void)vcs;
+        if (!buffer && !(buffer = (uint8_t *)malloc(_width * ((_height + 7) / 8))))
+            return false;
+        clearDisplay();
+        i2c_address = addr;
+        wire->begin();
+        // horizontal addressing, charge pump on, display on
+        const uint8_t init[] = {SSD1306_DISPLAYOFF, SSD1306_MEMORYMODE, 0x00, SSD1306_CHARGEPUMP, 0x14, SSD1306_DISPLAYON};
+        commands(init, sizeof(init));
+        wire->setClock(clock_after);
+        return true;
+    }
+
+    uint8_t *getBuffer() { return buffer; }
+    void clearDisplay() { memset(buffer, 0, _width * ((_height + 7) / 8)); }
+
+    void drawPixel(int16_t x, int16_t y, uint16_t color) override
+    {
+        if (x < 0 || y < 0 || x >= _width || y >= _height)
+            return;
+        uint8_t *ptr = &buffer[x + (y / 8) * _width];
+        switch (color)
+        {
+        case WHITE:
+            *ptr |= 1 << (y & 7);
+            break;
+        case BLACK:
+            *ptr &= ~(1 << (y & 7));
+            break;
+        case INVERSE:
+            *ptr ^= 1 << (y & 7);
+            break;
+        }
+    }
+    bool getPixel(int16_t x, int16_t y)
+    {
+        if (x < 0 || y < 0 || x >= _width || y >= _height)
+            return false;
+        return buffer[x + (y / 8) * _width] & (1 << (y & 7));
+    }
+
+    void dim(bool dim)
+    {
+        const uint8_t contrast[] = {SSD1306_SETCONTRAST, (uint8_t)(dim ? 0x00 : 0xCF)};
+        commands(contrast, sizeof(contrast));
+    }
+};
+
+#endif // __FAKE_ADAFRUIT_SSD1306_H__
@@ -0,0 +1,177 @@
+#ifndef __FAKE_ARDUINO_H__
+#define __FAKE_ARDUINO_H__
+
+// just enough of the ESP8266 Arduino core to build firmware modules on the host ([env:native]). Time is simulated:
+// micros64() returns fake_micros, which only moves when a test (or delay()) advances it, so runs are repeatable and
+// days of uptime pass in no time
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+
+#include "WString.h"
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) ((const __FlashStringHelper *)(s))
+#define FPSTR(p) ((const __FlashStringHelper *)(p))
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define RISING 2
+#define FALLING 3
+
+#define FAKE_CPU_MHZ 160
+
+///////////////////////////////////////////////////////////////////////////////////////
+// simulated time
+
+inline uint64_t fake_micros = 0;
+inline uint64_t fake_delayed_us = 0; // total time passed in delay(), i.e. what the firmware slept
+
+inline unsigned long long micros64() { return fake_micros; }
+inline unsigned long micros() { return (uint32_t)fake_micros; }
+inline unsigned long millis() { return (uint32_t)(fake_micros / 1000); }
+
+inline void fake_advance_us(uint64_t us) { fake_micros += us; }
+
+inline void delay(unsigned long ms)
+{
+    fake_micros += (uint64_t)ms * 1000;
+    fake_delayed_us += (uint64_t)ms * 1000;
+}
+inline void delayMicroseconds(unsigned int us) { fake_micros += us; }
+inline void yield() {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// GPIO: inputs read fake_pin_levels, outputs write them
+
+inline uint8_t fake_pin_levels[17];
+inline void pinMode(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t pin) { return fake_pin_levels[pin]; }
+inline void digitalWrite(uint8_t pin, uint8_t level) { fake_pin_levels[pin] = level; }
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int, void (*)(), int) {}
+inline void detachInterrupt(int) {}
+
+// deterministic, so that jitter doesn't make runs differ
+inline uint32_t fake_random_state = 1;
+inline long random(long howbig)
+{
+    fake_random_state = fake_random_state * 1103515245u + 12345u;
+    return howbig > 0 ? (long)((fake_random_state >> 8) % (uint32_t)howbig) : 0;
+}
+inline long random(long howsmall, long howbig) { return howsmall + random(howbig - howsmall); }
+inline void randomSeed(unsigned long seed) { fake_random_state = seed; }
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+///////////////////////////////////////////////////////////////////////////////////////
+// Print / Serial
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (size--)
+            n += write(*buffer++);
+        return n;
+    }
+    size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const __FlashStringHelper *str) { return write((const char *)str); }
+    size_t print(const String &str) { return write(str.c_str(), str.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value, int base = 10) { return print((long)value, base); }
+    size_t print(unsigned int value, int base = 10) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = 10) { return printf(base == 16 ? "%lx" : "%ld", value); }
+    size_t print(unsigned long value, int base = 10) { return printf(base == 16 ? "%lx" : "%lu", value); }
+    size_t print(long long value, int base = 10) { return printf(base == 16 ? "%llx" : "%lld", value); }
+    size_t print(unsigned long long value, int base = 10) { return printf(base == 16 ? "%llx" : "%llu", value); }
+    size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(T value) { return print(value) + println(); }
+    template <typename T>
+    size_t println(T value, int format) { return print(value, format) + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buf[256];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        return write(buf, min<size_t>(len, sizeof(buf) - 1));
+    }
+
+    virtual void flush() {}
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+
+    String readStringUntil(char terminator)
+    {
+        String str;
+        for (int c = read(); c >= 0 && c != terminator; c = read())
+            str += (char)c;
+        return str;
+    }
+};
+
+// firmware debug output. Off by default, it drowns the test report
+inline bool fake_serial_echo = false;
+
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override
+    {
+        if (fake_serial_echo)
+            putchar(c);
+        return 1;
+    }
+    using Print::write;
+};
+
+inline HardwareSerial Serial;
+
+#include "Esp.h"
+
+#endif // __FAKE_ARDUINO_H__
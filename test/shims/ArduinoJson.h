@@ -0,0 +1,860 @@
+#ifndef __FAKE_ARDUINOJSON_H__
+#define __FAKE_ARDUINOJSON_H__
+
+// the part of ArduinoJson 6 the firmware uses, on the host. Memory works like the library's: a document has a fixed
+// capacity, counted in the library's sizes on a 32-bit target (JSON_SLOT_SIZE per value, plus the strings it copies:
+// char * and String, not const char *), and what doesn't fit is dropped. A DynamicJsonDocument takes its capacity
+// from the heap in one block, a StaticJsonDocument holds it inline; the host side of the values lives next to that,
+// outside of the heap the tests count. Output is the library's too: compact, or pretty with two space indents and
+// CRLF, and numbers with up to 9 decimals, as the library prints a float it keeps as a double
+
+#include <Arduino.h>
+#include <type_traits>
+
+#define JSON_SLOT_SIZE 16 // a value with its key and the link to the next one, on the ESP8266
+#define JSON_HOST_SCALE 4 // host bytes per capacity byte, for the values with 64-bit pointers
+#define JSON_OBJECT_SIZE(n) ((n) * JSON_SLOT_SIZE)
+#define JSON_ARRAY_SIZE(n) ((n) * JSON_SLOT_SIZE)
+
+enum json_type_t
+{
+    JSON_NULL,
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_FLOAT,
+    JSON_INT,
+    JSON_UINT,
+    JSON_BOOL,
+};
+
+struct json_node_t
+{
+    json_type_t type;
+    const char *key;
+    union
+    {
+        const char *str;
+        double f;
+        int64_t i;
+        uint64_t u;
+        bool b;
+    };
+    json_node_t *first, *last, *next; // members of an object, elements of an array
+};
+
+class JsonDocument;
+class JsonObject;
+class JsonArray;
+
+// a value in a document, or the place for one: a member that gets created when it is assigned to
+class JsonVariant
+{
+public:
+    JsonVariant(JsonDocument *doc, json_node_t *node, json_node_t *parent = NULL, const char *key = NULL)
+        : doc(doc), node(node), parent(parent), key(key) {}
+
+    JsonVariant &operator=(const char *value);
+    JsonVariant &operator=(char *value);
+    JsonVariant &operator=(const String &value);
+    JsonVariant &operator=(bool value);
+    template <typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    JsonVariant &operator=(T value)
+    {
+        json_node_t *target = resolve();
+        if (!target)
+            return *this;
+        if (std::is_floating_point<T>::value)
+        {
+            target->type = JSON_FLOAT;
+            target->f = value;
+        }
+        else if (std::is_signed<T>::value)
+        {
+            target->type = JSON_INT;
+            target->i = (int64_t)value;
+        }
+        else
+        {
+            target->type = JSON_UINT;
+            target->u = (uint64_t)value;
+        }
+        return *this;
+    }
+
+    bool isNull() const { return !node || node->type == JSON_NULL; }
+    template <typename T>
+    T as() const;
+    template <typename T>
+    operator T() const { return as<T>(); }
+
+private:
+    json_node_t *resolve();
+
+    JsonDocument *doc;
+    json_node_t *node;
+    json_node_t *parent;
+    const char *key;
+
+    friend class JsonObject;
+};
+
+class JsonObject
+{
+public:
+    JsonObject() : doc(NULL), node(NULL) {}
+    JsonObject(JsonDocument *doc, json_node_t *node) : doc(doc), node(node) {}
+
+    JsonVariant operator[](const char *key) const;
+    bool containsKey(const char *key) const;
+    JsonObject createNestedObject(const char *key) const;
+    JsonArray createNestedArray(const char *key) const;
+    bool isNull() const { return !node; }
+
+private:
+    JsonDocument *doc;
+    json_node_t *node;
+};
+
+class JsonArray
+{
+public:
+    JsonArray() : doc(NULL), node(NULL) {}
+    JsonArray(JsonDocument *doc, json_node_t *node) : doc(doc), node(node) {}
+
+    template <typename T>
+    bool add(T value)
+    {
+        json_node_t *element = append();
+        if (!element)
+            return false;
+        JsonVariant(doc, element) = value;
+        return element->type != JSON_NULL;
+    }
+    JsonObject createNestedObject() const;
+    bool isNull() const { return !node; }
+
+private:
+    json_node_t *append() const;
+
+    JsonDocument *doc;
+    json_node_t *node;
+};
+
+class JsonDocument
+{
+public:
+    JsonDocument(const JsonDocument &) = delete;
+    JsonDocument &operator=(const JsonDocument &) = delete;
+
+    void clear()
+    {
+        memset(&root, 0, sizeof(root));
+        used = 0;
+        num_nodes = 0;
+        strings_used = 0;
+        overflow = false;
+    }
+    size_t capacity() const { return capacity_bytes; }
+    size_t memoryUsage() const { return used; }
+    bool overflowed() const { return overflow; }
+
+    JsonVariant operator[](const char *key);
+    bool containsKey(const char *key);
+    JsonObject createNestedObject(const char *key);
+    JsonArray createNestedArray(const char *key);
+    template <typename T>
+    T as();
+
+    const json_node_t &get_root() const { return root; }
+
+    // for the values: the capacity accounting
+    json_node_t *alloc_node(json_type_t type, const char *key)
+    {
+        if (used + JSON_SLOT_SIZE > capacity_bytes || num_nodes == max_nodes)
+        {
+            overflow = true;
+            return NULL;
+        }
+        used += JSON_SLOT_SIZE;
+        json_node_t *node = &nodes[num_nodes++];
+        memset(node, 0, sizeof(*node));
+        node->type = type;
+        node->key = key;
+        return node;
+    }
+    const char *copy_string(const char *str, size_t len)
+    {
+        if (used + len + 1 > capacity_bytes || strings_used + len + 1 > capacity_bytes)
+        {
+            overflow = true;
+            return NULL;
+        }
+        used += len + 1;
+        char *copy = strings + strings_used;
+        memcpy(copy, str, len);
+        copy[len] = 0;
+        strings_used += len + 1;
+        return copy;
+    }
+    json_node_t *root_as(json_type_t type)
+    {
+        if (root.type == JSON_NULL)
+            root.type = type;
+        return root.type == type ? &root : NULL;
+    }
+
+protected:
+    JsonDocument(size_t capacity, uint8_t *host_pool)
+        : capacity_bytes(capacity), nodes((json_node_t *)host_pool), max_nodes(capacity / JSON_SLOT_SIZE),
+          strings((char *)host_pool + max_nodes * sizeof(json_node_t))
+    {
+        static_assert(sizeof(json_node_t) + JSON_SLOT_SIZE <= JSON_SLOT_SIZE * JSON_HOST_SCALE, "");
+        clear();
+    }
+
+private:
+    size_t capacity_bytes;
+    size_t used;
+    json_node_t root;
+    json_node_t *nodes;
+    size_t num_nodes, max_nodes;
+    char *strings;
+    size_t strings_used;
+    bool overflow;
+};
+
+template <size_t desired_capacity>
+class StaticJsonDocument : public JsonDocument
+{
+public:
+    StaticJsonDocument() : JsonDocument(desired_capacity, host_pool) {}
+
+private:
+    alignas(json_node_t) uint8_t host_pool[desired_capacity * JSON_HOST_SCALE];
+};
+
+class DynamicJsonDocument : public JsonDocument
+{
+public:
+    explicit DynamicJsonDocument(size_t capacity) : DynamicJsonDocument(capacity, (uint8_t *)malloc(capacity * JSON_HOST_SCALE)) {}
+    ~DynamicJsonDocument()
+    {
+        delete[] heap_block;
+        free(host_pool);
+    }
+
+private:
+    // the host side comes from malloc(), which the tests don't count. The block the library would malloc() comes from
+    // new, which they do
+    DynamicJsonDocument(size_t capacity, uint8_t *host_pool)
+        : JsonDocument(capacity, host_pool), host_pool(host_pool), heap_block(new uint8_t[capacity]) {}
+
+    uint8_t *host_pool;
+    uint8_t *heap_block; // what the library takes from the heap
+};
+
+///////////////////////////////////////////////////////////////////////////////////////
+// values
+
+inline json_node_t *JsonVariant::resolve()
+{
+    if (node)
+    {
+        node->type = JSON_NULL;
+        node->first = node->last = NULL;
+        return node;
+    }
+    if (!parent)
+        return NULL;
+    node = doc->alloc_node(JSON_NULL, key);
+    if (!node)
+        return NULL;
+    if (parent->last)
+        parent->last->next = node;
+    else
+        parent->first = node;
+    parent->last = node;
+    return node;
+}
+
+inline JsonVariant &JsonVariant::operator=(const char *value)
+{
+    json_node_t *target = resolve();
+    if (target && value)
+    {
+        target->type = JSON_STRING;
+        target->str = value; // kept by pointer
+    }
+    return *this;
+}
+
+inline JsonVariant &JsonVariant::operator=(char *value)
+{
+    json_node_t *target = resolve();
+    if (target && value)
+    {
+        target->str = doc->copy_string(value, strlen(value));
+        target->type = target->str ? JSON_STRING : JSON_NULL;
+    }
+    return *this;
+}
+
+inline JsonVariant &JsonVariant::operator=(const String &value)
+{
+    json_node_t *target = resolve();
+    if (target)
+    {
+        target->str = doc->copy_string(value.c_str(), value.length());
+        target->type = target->str ? JSON_STRING : JSON_NULL;
+    }
+    return *this;
+}
+
+inline JsonVariant &JsonVariant::operator=(bool value)
+{
+    json_node_t *target = resolve();
+    if (target)
+    {
+        target->type = JSON_BOOL;
+        target->b = value;
+    }
+    return *this;
+}
+
+template <typename T>
+inline T JsonVariant::as() const
+{
+    static_assert(std::is_arithmetic<T>::value, "");
+    if (!node)
+        return 0;
+    switch (node->type)
+    {
+    case JSON_FLOAT:
+        return (T)node->f;
+    case JSON_INT:
+        return (T)node->i;
+    case JSON_UINT:
+        return (T)node->u;
+    case JSON_BOOL:
+        return (T)node->b;
+    default:
+        return 0;
+    }
+}
+
+template <>
+inline const char *JsonVariant::as<const char *>() const
+{
+    return node && node->type == JSON_STRING ? node->str : NULL;
+}
+
+template <>
+inline String JsonVariant::as<String>() const
+{
+    const char *str = as<const char *>();
+    return String(str ? str : "null");
+}
+
+inline json_node_t *json_find_member(json_node_t *object, const char *key)
+{
+    for (json_node_t *member = object ? object->first : NULL; member; member = member->next)
+    {
+        if (strcmp(member->key, key) == 0)
+            return member;
+    }
+    return NULL;
+}
+
+inline JsonVariant JsonObject::operator[](const char *key) const
+{
+    return JsonVariant(doc, json_find_member(node, key), node, key);
+}
+
+inline bool JsonObject::containsKey(const char *key) const
+{
+    return json_find_member(node, key) != NULL;
+}
+
+inline JsonObject JsonObject::createNestedObject(const char *key) const
+{
+    JsonVariant member = (*this)[key];
+    json_node_t *target = node ? member.resolve() : NULL;
+    if (!target)
+        return JsonObject();
+    target->type = JSON_OBJECT;
+    return JsonObject(doc, target);
+}
+
+inline JsonArray JsonObject::createNestedArray(const char *key) const
+{
+    JsonVariant member = (*this)[key];
+    json_node_t *target = node ? member.resolve() : NULL;
+    if (!target)
+        return JsonArray();
+    target->type = JSON_ARRAY;
+    return JsonArray(doc, target);
+}
+
+inline json_node_t *JsonArray::append() const
+{
+    if (!node)
+        return NULL;
+    json_node_t *element = doc->alloc_node(JSON_NULL, NULL);
+    if (!element)
+        return NULL;
+    if (node->last)
+        node->last->next = element;
+    else
+        node->first = element;
+    node->last = element;
+    return element;
+}
+
+inline JsonObject JsonArray::createNestedObject() const
+{
+    json_node_t *element = append();
+    if (!element)
+        return JsonObject();
+    element->type = JSON_OBJECT;
+    return JsonObject(doc, element);
+}
+
+template <>
+inline JsonObject JsonDocument::as<JsonObject>()
+{
+    return JsonObject(this, root_as(JSON_OBJECT));
+}
+
+template <>
+inline JsonArray JsonDocument::as<JsonArray>()
+{
+    return JsonArray(this, root_as(JSON_ARRAY));
+}
+
+inline JsonVariant JsonDocument::operator[](const char *key)
+{
+    return as<JsonObject>()[key];
+}
+
+inline bool JsonDocument::containsKey(const char *key)
+{
+    return as<JsonObject>().containsKey(key);
+}
+
+inline JsonObject JsonDocument::createNestedObject(const char *key)
+{
+    return as<JsonObject>().createNestedObject(key);
+}
+
+inline JsonArray JsonDocument::createNestedArray(const char *key)
+{
+    return as<JsonObject>().createNestedArray(key);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// serialization
+
+inline void json_print_string(Print &out, const char *str)
+{
+    out.write('"');
+    for (; *str; str++)
+    {
+        const char *escape = NULL;
+        switch (*str)
+        {
+        case '"': escape = "\\\""; break;
+        case '\\': escape = "\\\\"; break;
+        case '\b': escape = "\\b"; break;
+        case '\f': escape = "\\f"; break;
+        case '\n': escape = "\\n"; break;
+        case '\r': escape = "\\r"; break;
+        case '\t': escape = "\\t"; break;
+        }
+        if (escape)
+            out.write(escape);
+        else
+            out.write((uint8_t)*str);
+    }
+    out.write('"');
+}
+
+// integral part, up to 9 decimals without trailing zeros, and an exponent outside of 1e-5..1e7
+inline void json_print_float(Print &out, double value)
+{
+    if (isnan(value) || isinf(value))
+    {
+        out.write("null");
+        return;
+    }
+    if (value < 0)
+    {
+        out.write('-');
+        value = -value;
+    }
+    int exponent = 0;
+    if (value >= 1e7)
+    {
+        while (value >= 10)
+        {
+            value /= 10;
+            ++exponent;
+        }
+    }
+    else if (value > 0 && value < 1e-5)
+    {
+        while (value < 1)
+        {
+            value *= 10;
+            --exponent;
+        }
+    }
+    uint32_t integral = (uint32_t)value;
+    double remainder = (value - integral) * 1e9;
+    uint32_t decimal = (uint32_t)remainder;
+    if (remainder - decimal >= 0.5 && ++decimal == 1000000000)
+    {
+        decimal = 0;
+        ++integral;
+    }
+    int places = 9;
+    while (places && decimal % 10 == 0)
+    {
+        decimal /= 10;
+        --places;
+    }
+    char buf[32];
+    int len = places ? snprintf(buf, sizeof(buf), "%u.%0*u", integral, places, decimal) : snprintf(buf, sizeof(buf), "%u", integral);
+    if (exponent)
+        snprintf(buf + len, sizeof(buf) - len, "e%d", exponent);
+    out.write(buf);
+}
+
+inline void json_print_indent(Print &out, int nesting)
+{
+    for (int idx = 0; idx < nesting; idx++)
+        out.write("  ");
+}
+
+inline void json_print(Print &out, const json_node_t &node, bool pretty, int nesting)
+{
+    char buf[24];
+    switch (node.type)
+    {
+    case JSON_OBJECT:
+    case JSON_ARRAY:
+    {
+        bool object = node.type == JSON_OBJECT;
+        out.write(object ? '{' : '[');
+        for (const json_node_t *child = node.first; child; child = child->next)
+        {
+            if (child != node.first)
+                out.write(',');
+            if (pretty)
+            {
+                out.write("\r\n");
+                json_print_indent(out, nesting + 1);
+            }
+            if (object)
+            {
+                json_print_string(out, child->key);
+                out.write(pretty ? ": " : ":");
+            }
+            json_print(out, *child, pretty, nesting + 1);
+        }
+        if (pretty && node.first)
+        {
+            out.write("\r\n");
+            json_print_indent(out, nesting);
+        }
+        out.write(object ? '}' : ']');
+        break;
+    }
+    case JSON_STRING:
+        json_print_string(out, node.str);
+        break;
+    case JSON_FLOAT:
+        json_print_float(out, node.f);
+        break;
+    case JSON_INT:
+        snprintf(buf, sizeof(buf), "%lld", (long long)node.i);
+        out.write(buf);
+        break;
+    case JSON_UINT:
+        snprintf(buf, sizeof(buf), "%llu", (unsigned long long)node.u);
+        out.write(buf);
+        break;
+    case JSON_BOOL:
+        out.write(node.b ? "true" : "false");
+        break;
+    default:
+        out.write("null");
+        break;
+    }
+}
+
+class json_counter_t : public Print
+{
+public:
+    size_t count = 0;
+    size_t write(uint8_t) override { return ++count, 1; }
+    using Print::write;
+};
+
+// the library collects String output in a small buffer and appends it a piece at a time
+class json_string_writer_t : public Print
+{
+public:
+    explicit json_string_writer_t(String &str) : str(str) {}
+    ~json_string_writer_t() { flush(); }
+    size_t write(uint8_t c) override
+    {
+        if (len == sizeof(buf))
+            flush();
+        buf[len++] = c;
+        return 1;
+    }
+    using Print::write;
+    void flush() override
+    {
+        str.concat(buf, len);
+        len = 0;
+    }
+
+private:
+    String &str;
+    char buf[32];
+    size_t len = 0;
+};
+
+inline size_t measureJson(const JsonDocument &doc)
+{
+    json_counter_t counter;
+    json_print(counter, doc.get_root(), false, 0);
+    return counter.count;
+}
+
+inline size_t measureJsonPretty(const JsonDocument &doc)
+{
+    json_counter_t counter;
+    json_print(counter, doc.get_root(), true, 0);
+    return counter.count;
+}
+
+inline size_t serializeJson(const JsonDocument &doc, Print &out)
+{
+    json_print(out, doc.get_root(), false, 0);
+    return measureJson(doc);
+}
+
+inline size_t serializeJson(const JsonDocument &doc, String &str)
+{
+    str.clear();
+    json_string_writer_t writer(str);
+    return serializeJson(doc, writer);
+}
+
+inline size_t serializeJsonPretty(const JsonDocument &doc, Print &out)
+{
+    json_print(out, doc.get_root(), true, 0);
+    return measureJsonPretty(doc);
+}
+
+inline size_t serializeJsonPretty(const JsonDocument &doc, String &str)
+{
+    str.clear();
+    json_string_writer_t writer(str);
+    return serializeJsonPretty(doc, writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// deserialization: objects, arrays, strings with the simple escapes, numbers, true / false / null
+
+class DeserializationError
+{
+public:
+    enum Code
+    {
+        Ok,
+        EmptyInput,
+        IncompleteInput,
+        InvalidInput,
+        NoMemory,
+    };
+
+    DeserializationError(Code code) : code_(code) {}
+    explicit operator bool() const { return code_ != Ok; }
+    Code code() const { return code_; }
+    const char *c_str() const
+    {
+        static const char *names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory"};
+        return names[code_];
+    }
+    const char *f_str() const { return c_str(); }
+
+private:
+    Code code_;
+};
+
+class json_parser_t
+{
+public:
+    json_parser_t(JsonDocument &doc, const char *input, size_t len) : doc(doc), pos(input), end(input + len) {}
+
+    DeserializationError::Code parse(json_node_t *node)
+    {
+        skip_space();
+        if (pos == end)
+            return DeserializationError::IncompleteInput;
+        switch (*pos)
+        {
+        case '{':
+        case '[':
+        {
+            bool object = *pos++ == '{';
+            node->type = object ? JSON_OBJECT : JSON_ARRAY;
+            skip_space();
+            if (pos < end && *pos == (object ? '}' : ']'))
+                return ++pos, DeserializationError::Ok;
+            while (true)
+            {
+                const char *key = NULL;
+                if (object)
+                {
+                    skip_space();
+                    DeserializationError::Code error = parse_string(key);
+                    if (error != DeserializationError::Ok)
+                        return error;
+                    skip_space();
+                    if (pos == end)
+                        return DeserializationError::IncompleteInput;
+                    if (*pos++ != ':')
+                        return DeserializationError::InvalidInput;
+                }
+                json_node_t *child = doc.alloc_node(JSON_NULL, key);
+                if (!child)
+                    return DeserializationError::NoMemory;
+                if (node->last)
+                    node->last->next = child;
+                else
+                    node->first = child;
+                node->last = child;
+                DeserializationError::Code error = parse(child);
+                if (error != DeserializationError::Ok)
+                    return error;
+                skip_space();
+                if (pos == end)
+                    return DeserializationError::IncompleteInput;
+                char c = *pos++;
+                if (c == (object ? '}' : ']'))
+                    return DeserializationError::Ok;
+                if (c != ',')
+                    return DeserializationError::InvalidInput;
+            }
+        }
+        case '"':
+        {
+            node->type = JSON_STRING;
+            return parse_string(node->str);
+        }
+        default:
+            return parse_literal(node);
+        }
+    }
+
+private:
+    void skip_space()
+    {
+        while (pos < end && isspace((unsigned char)*pos))
+            ++pos;
+    }
+
+    DeserializationError::Code parse_string(const char *&str)
+    {
+        if (pos == end)
+            return DeserializationError::IncompleteInput;
+        if (*pos++ != '"')
+            return DeserializationError::InvalidInput;
+        char buf[128];
+        size_t len = 0;
+        while (true)
+        {
+            if (pos == end)
+                return DeserializationError::IncompleteInput;
+            char c = *pos++;
+            if (c == '"')
+                break;
+            if (c == '\\')
+            {
+                if (pos == end)
+                    return DeserializationError::IncompleteInput;
+                c = *pos++;
+                c = c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c == 'b' ? '\b' : c == 'f' ? '\f' : c;
+            }
+            if (len == sizeof(buf) - 1)
+                return DeserializationError::NoMemory;
+            buf[len++] = c;
+        }
+        str = doc.copy_string(buf, len);
+        return str ? DeserializationError::Ok : DeserializationError::NoMemory;
+    }
+
+    DeserializationError::Code parse_literal(json_node_t *node)
+    {
+        char buf[32];
+        size_t len = 0;
+        while (pos < end && len < sizeof(buf) - 1 && (isalnum((unsigned char)*pos) || strchr("+-.", *pos)))
+            buf[len++] = *pos++;
+        buf[len] = 0;
+        if (!len)
+            return DeserializationError::InvalidInput;
+        if (strcmp(buf, "true") == 0 || strcmp(buf, "false") == 0)
+        {
+            node->type = JSON_BOOL;
+            node->b = buf[0] == 't';
+            return DeserializationError::Ok;
+        }
+        if (strcmp(buf, "null") == 0)
+            return DeserializationError::Ok;
+        char *number_end;
+        if (strpbrk(buf, ".eE"))
+        {
+            node->type = JSON_FLOAT;
+            node->f = strtod(buf, &number_end);
+        }
+        else
+        {
+            node->type = JSON_INT;
+            node->i = strtoll(buf, &number_end, 10);
+        }
+        return *number_end ? DeserializationError::InvalidInput : DeserializationError::Ok;
+    }
+
+    JsonDocument &doc;
+    const char *pos, *end;
+};
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input, size_t len)
+{
+    doc.clear();
+    json_parser_t parser(doc, input, len);
+    json_node_t *root = doc.root_as(JSON_NULL);
+    bool empty = true;
+    for (size_t idx = 0; idx < len && empty; idx++)
+        empty = isspace((unsigned char)input[idx]);
+    if (empty)
+        return DeserializationError::EmptyInput;
+    return parser.parse(root);
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const uint8_t *input, size_t len)
+{
+    return deserializeJson(doc, (const char *)input, len);
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input)
+{
+    return deserializeJson(doc, input, strlen(input));
+}
+
+#endif // __FAKE_ARDUINOJSON_H__
@@ -0,0 +1,17 @@
+#ifndef __FAKE_CLIENT_H__
+#define __FAKE_CLIENT_H__
+
+#include "Arduino.h"
+
+// a TCP connection. Nothing listens on the other end; the fake PubSubClient keeps track of what it sends
+class Client : public Stream
+{
+public:
+    size_t write(uint8_t) override { return 1; }
+    size_t write(const uint8_t *, size_t size) override { return size; }
+    using Print::write;
+    virtual uint8_t connected() { return 1; }
+    virtual void stop() {}
+};
+
+#endif // __FAKE_CLIENT_H__
@@ -0,0 +1,6 @@
+#ifndef __FAKE_ESP8266WEBSERVER_H__
+#define __FAKE_ESP8266WEBSERVER_H__
+
+// see ESP8266WiFi.h: nothing built on the host serves pages
+
+#endif // __FAKE_ESP8266WEBSERVER_H__
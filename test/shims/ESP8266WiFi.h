@@ -0,0 +1,7 @@
+#ifndef __FAKE_ESP8266WIFI_H__
+#define __FAKE_ESP8266WIFI_H__
+
+// wifi.h includes the network headers for everyone; modules built on the host only need the client
+#include "WiFiClient.h"
+
+#endif // __FAKE_ESP8266WIFI_H__
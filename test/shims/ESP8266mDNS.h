@@ -0,0 +1,6 @@
+#ifndef __FAKE_ESP8266MDNS_H__
+#define __FAKE_ESP8266MDNS_H__
+
+// see ESP8266WiFi.h
+
+#endif // __FAKE_ESP8266MDNS_H__
@@ -0,0 +1,26 @@
+#ifndef __FAKE_ESP_H__
+#define __FAKE_ESP_H__
+
+#include "Arduino.h"
+
+// heap in use, for tests that count allocations (test_mqtt). It stays at 0 otherwise, and the free heap with it
+inline uint32_t fake_heap_in_use = 0;
+#define FAKE_HEAP_SIZE 40000
+
+// the cycle counter follows the simulated clock. Code that does work "takes" time by calling fake_advance_us()
+class EspClass
+{
+public:
+    uint32_t getCycleCount() { return (uint32_t)(fake_micros * FAKE_CPU_MHZ); }
+    uint8_t getCpuFreqMHz() { return FAKE_CPU_MHZ; }
+    uint32_t getFreeHeap() { return FAKE_HEAP_SIZE - min<uint32_t>(fake_heap_in_use, FAKE_HEAP_SIZE); }
+    uint32_t getMaxFreeBlockSize() { return 30000; }
+    uint8_t getHeapFragmentation() { return 0; }
+    uint32_t getChipId() { return 0x123456; }
+    String getResetReason() { return "Fake"; }
+    void restart() {}
+};
+
+inline EspClass ESP;
+
+#endif // __FAKE_ESP_H__
@@ -0,0 +1,118 @@
+#ifndef __FAKE_LITTLEFS_H__
+#define __FAKE_LITTLEFS_H__
+
+#include "Arduino.h"
+
+// a flash filesystem in RAM: a few files, each in a fixed buffer, so it takes nothing from the heap of the tests that
+// count it. Like LittleFS, "r" reads from the start, "w" truncates or creates, "a" appends, and open() fails for a
+// file that isn't there. fake_fs_mounted = false is a unit whose filesystem didn't mount: every open() fails, and
+// code that keeps state in files has to carry on without it. fake_fs_format() empties it
+
+#define FAKE_FS_MAX_FILES 4
+#define FAKE_FS_NAME_SIZE 32
+#define FAKE_FS_FILE_SIZE 1024
+
+struct fake_fs_file_t
+{
+    char name[FAKE_FS_NAME_SIZE]; // empty for a free slot
+    uint8_t data[FAKE_FS_FILE_SIZE];
+    size_t size;
+};
+
+inline fake_fs_file_t fake_fs_files[FAKE_FS_MAX_FILES];
+inline bool fake_fs_mounted = true;
+
+inline void fake_fs_format()
+{
+    for (fake_fs_file_t &file : fake_fs_files)
+        file.name[0] = 0;
+}
+
+inline fake_fs_file_t *fake_fs_find(const char *path)
+{
+    for (fake_fs_file_t &file : fake_fs_files)
+        if (file.name[0] && strcmp(file.name, path) == 0)
+            return &file;
+    return NULL;
+}
+
+inline fake_fs_file_t *fake_fs_free_slot()
+{
+    for (fake_fs_file_t &file : fake_fs_files)
+        if (!file.name[0])
+            return &file;
+    return NULL;
+}
+
+class File : public Stream
+{
+public:
+    File() {}
+    File(fake_fs_file_t *file, bool writable) : file(file), writable(writable) {}
+
+    explicit operator bool() const { return file != NULL; }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        if (!file || !writable)
+            return 0;
+        size = min(size, sizeof(file->data) - file->size); // a full disk takes what fits
+        memcpy(file->data + file->size, buffer, size);
+        file->size += size;
+        return size;
+    }
+    using Print::write;
+    int available() override { return file ? file->size - pos : 0; }
+    int read() override { return available() ? file->data[pos++] : -1; }
+    int peek() override { return available() ? file->data[pos] : -1; }
+    size_t size() const { return file ? file->size : 0; }
+    void close() { file = NULL; }
+
+private:
+    fake_fs_file_t *file = NULL;
+    bool writable = false;
+    size_t pos = 0;
+};
+
+class FS
+{
+public:
+    bool begin() { return fake_fs_mounted; }
+    bool format()
+    {
+        fake_fs_format();
+        return true;
+    }
+
+    File open(const char *path, const char *mode)
+    {
+        if (!fake_fs_mounted)
+            return File();
+        fake_fs_file_t *file = fake_fs_find(path);
+        if (mode[0] == 'r')
+            return File(file, false);
+        if (!file)
+        {
+            file = fake_fs_free_slot();
+            if (!file || strlen(path) >= sizeof(file->name))
+                return File();
+            strcpy(file->name, path);
+            file->size = 0;
+        }
+        if (mode[0] == 'w')
+            file->size = 0;
+        return File(file, true);
+    }
+    bool exists(const char *path) { return fake_fs_mounted && fake_fs_find(path); }
+    bool remove(const char *path)
+    {
+        fake_fs_file_t *file = fake_fs_mounted ? fake_fs_find(path) : NULL;
+        if (file)
+            file->name[0] = 0;
+        return file != NULL;
+    }
+};
+
+inline FS LittleFS;
+
+#endif // __FAKE_LITTLEFS_H__
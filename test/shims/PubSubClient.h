@@ -0,0 +1,136 @@
+#ifndef __FAKE_PUBSUBCLIENT_H__
+#define __FAKE_PUBSUBCLIENT_H__
+
+#include "Arduino.h"
+#include "Client.h"
+
+// PubSubClient 2.8, as much as the firmware uses, on a broker that takes everything. Outgoing messages go out the
+// way the library sends them: publish() puts the header, topic and payload together in the client's buffer (and
+// fails if they don't fit) and makes one write; beginPublish() writes the header and topic, and every write() after
+// it goes to the connection as it comes. fake_mqtt_stats counts what went out, fake_mqtt_last_* is the last message
+
+#define MQTT_MAX_HEADER_SIZE 5
+#define MQTT_CALLBACK_SIGNATURE void (*callback)(char *, uint8_t *, unsigned int)
+
+struct fake_mqtt_stats_t
+{
+    uint32_t num_messages;
+    uint32_t num_tcp_writes;
+    uint64_t payload_bytes;
+    uint64_t wire_bytes; // with the MQTT header and the topic
+};
+
+inline fake_mqtt_stats_t fake_mqtt_stats;
+inline bool fake_mqtt_broker_up = true;
+inline char fake_mqtt_last_topic[128];
+inline char fake_mqtt_last_payload[2048];
+inline size_t fake_mqtt_last_len;
+inline bool fake_mqtt_last_retained;
+
+class PubSubClient
+{
+public:
+    explicit PubSubClient(Client &) {}
+    ~PubSubClient() { delete[] buffer; }
+
+    bool setBufferSize(uint16_t size)
+    {
+        delete[] buffer;
+        buffer = new uint8_t[size];
+        buffer_size = size;
+        return true;
+    }
+    uint16_t getBufferSize() { return buffer_size; }
+    PubSubClient &setServer(const char *, uint16_t) { return *this; }
+    PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE)
+    {
+        this->callback = callback;
+        return *this;
+    }
+
+    bool connect(const char *, const char *, const char *) { return is_connected = fake_mqtt_broker_up; }
+    bool connected() { return is_connected; }
+    void disconnect() { is_connected = false; }
+    bool subscribe(const char *, uint8_t = 0) { return is_connected; }
+    bool loop() { return is_connected; }
+
+    bool publish(const char *topic, const char *payload, bool retained = false)
+    {
+        size_t topic_len = strlen(topic), len = strlen(payload);
+        if (!is_connected || buffer_size < MQTT_MAX_HEADER_SIZE + 2 + topic_len + len)
+            return false;
+        start_message(topic, len, retained);
+        memcpy(buffer + MQTT_MAX_HEADER_SIZE + 2 + topic_len, payload, len);
+        record_payload((const uint8_t *)payload, len);
+        send(header_len(len + 2 + topic_len) + 2 + topic_len + len);
+        return true;
+    }
+
+    bool beginPublish(const char *topic, unsigned int len, bool retained)
+    {
+        if (!is_connected)
+            return false;
+        size_t topic_len = strlen(topic);
+        start_message(topic, len, retained);
+        send(header_len(len + 2 + topic_len) + 2 + topic_len);
+        return true;
+    }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t size)
+    {
+        record_payload(data, size);
+        send(size);
+        return size;
+    }
+    int endPublish() { return is_connected; }
+
+    // for tests: a message from the broker on a subscribed topic
+    void fake_receive(const char *topic, const char *payload)
+    {
+        if (callback)
+            callback((char *)topic, (uint8_t *)payload, strlen(payload));
+    }
+
+private:
+    // fixed header: the packet type and the remaining length, 7 bits per byte
+    static size_t header_len(size_t remaining_len)
+    {
+        size_t len = 2;
+        while (remaining_len >= 128)
+        {
+            remaining_len /= 128;
+            ++len;
+        }
+        return len;
+    }
+
+    void start_message(const char *topic, size_t len, bool retained)
+    {
+        snprintf(fake_mqtt_last_topic, sizeof(fake_mqtt_last_topic), "%s", topic);
+        fake_mqtt_last_len = 0;
+        fake_mqtt_last_retained = retained;
+        fake_mqtt_stats.num_messages++;
+        fake_mqtt_stats.payload_bytes += len;
+    }
+
+    void record_payload(const uint8_t *data, size_t size)
+    {
+        size_t copy = min(size, sizeof(fake_mqtt_last_payload) - 1 - fake_mqtt_last_len);
+        memcpy(fake_mqtt_last_payload + fake_mqtt_last_len, data, copy);
+        fake_mqtt_last_len += copy;
+        fake_mqtt_last_payload[fake_mqtt_last_len] = 0;
+    }
+
+    void send(size_t size)
+    {
+        fake_mqtt_stats.num_tcp_writes++;
+        fake_mqtt_stats.wire_bytes += size;
+    }
+
+    uint8_t *buffer = NULL;
+    uint16_t buffer_size = 0;
+    bool is_connected = false;
+    void (*callback)(char *, uint8_t *, unsigned int) = NULL;
+};
+
+#endif // __FAKE_PUBSUBCLIENT_H__
@@ -0,0 +1,6 @@
+#ifndef __FAKE_SPI_H__
+#define __FAKE_SPI_H__
+
+// the display is on I2C; disp.cc includes this for Adafruit_SSD1306 only
+
+#endif // __FAKE_SPI_H__
@@ -0,0 +1,117 @@
+#ifndef __FAKE_WSTRING_H__
+#define __FAKE_WSTRING_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+// the ESP8266 SDK's integer types, which reach the firmware through the core headers
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+typedef int8_t sint8;
+typedef int16_t sint16;
+typedef int32_t sint32;
+typedef int64_t sint64;
+typedef unsigned int uint;
+
+class __FlashStringHelper;
+
+class String
+{
+    std::string str;
+
+public:
+    String() {}
+    String(const char *cstr) : str(cstr ? cstr : "") {}
+    String(const __FlashStringHelper *cstr) : String((const char *)cstr) {}
+    String(const std::string &s) : str(s) {}
+    String(char c) : str(1, c) {}
+    String(int value) : str(std::to_string(value)) {}
+    String(unsigned int value) : str(std::to_string(value)) {}
+    String(long value) : str(std::to_string(value)) {}
+    String(unsigned long value) : str(std::to_string(value)) {}
+    String(float value, unsigned int digits = 2) { format_float(value, digits); }
+    String(double value, unsigned int digits = 2) { format_float(value, digits); }
+
+    const char *c_str() const { return str.c_str(); }
+    unsigned int length() const { return str.size(); }
+    bool isEmpty() const { return str.empty(); }
+    void clear() { str.clear(); }
+    bool reserve(unsigned int size)
+    {
+        str.reserve(size);
+        return true;
+    }
+
+    bool concat(const char *cstr, unsigned int len)
+    {
+        str.append(cstr, len);
+        return true;
+    }
+    template <typename T>
+    String &operator+=(const T &value)
+    {
+        str += String(value).str;
+        return *this;
+    }
+    String &operator+=(const String &other)
+    {
+        str += other.str;
+        return *this;
+    }
+    template <typename T>
+    friend String operator+(const String &lhs, const T &rhs)
+    {
+        String result(lhs);
+        result += rhs;
+        return result;
+    }
+    friend String operator+(const char *lhs, const String &rhs) { return String(lhs) + rhs; }
+
+    bool operator==(const String &other) const { return str == other.str; }
+    bool operator==(const char *cstr) const { return str == cstr; }
+    bool operator!=(const String &other) const { return str != other.str; }
+    char operator[](unsigned int idx) const { return str[idx]; }
+    char charAt(unsigned int idx) const { return str[idx]; }
+
+    bool equalsIgnoreCase(const String &other) const
+    {
+        if (str.size() != other.str.size())
+            return false;
+        for (size_t idx = 0; idx < str.size(); idx++)
+        {
+            if (tolower(str[idx]) != tolower(other.str[idx]))
+                return false;
+        }
+        return true;
+    }
+    int indexOf(char c) const
+    {
+        size_t pos = str.find(c);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+    String substring(unsigned int from, unsigned int to) const { return String(str.substr(from, to - from)); }
+    String substring(unsigned int from) const { return String(str.substr(from)); }
+    void remove(unsigned int idx) { str.erase(idx); }
+    void remove(unsigned int idx, unsigned int count) { str.erase(idx, count); }
+    void trim()
+    {
+        size_t first = str.find_first_not_of(" \t\r\n");
+        size_t last = str.find_last_not_of(" \t\r\n");
+        str = first == std::string::npos ? "" : str.substr(first, last - first + 1);
+    }
+    long toInt() const { return strtol(str.c_str(), NULL, 10); }
+    float toFloat() const { return strtof(str.c_str(), NULL); }
+
+private:
+    void format_float(double value, unsigned int digits)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", (int)digits, value);
+        str = buf;
+    }
+};
+
+#endif // __FAKE_WSTRING_H__
@@ -0,0 +1,10 @@
+#ifndef __FAKE_WIFICLIENT_H__
+#define __FAKE_WIFICLIENT_H__
+
+#include "Client.h"
+
+class WiFiClient : public Client
+{
+};
+
+#endif // __FAKE_WIFICLIENT_H__
@@ -0,0 +1,122 @@
+#ifndef __FAKE_WIRE_H__
+#define __FAKE_WIRE_H__
+
+#include "Arduino.h"
+
+// I2C master on a simulated bus. Devices are attached by address (fake_i2c_attach); a transaction to an address
+// with nothing attached is NACKed, like on the real bus. Every transaction takes the time it would at the bus clock
+// (start, address and data bytes at 9 clocks each, stop) off the simulated clock, and is counted in fake_i2c_stats
+
+#define BUFFER_LENGTH 128 // the ESP8266 core's Wire buffer
+
+// what a device sees of the transactions addressed to it
+class fake_i2c_device_t
+{
+public:
+    virtual ~fake_i2c_device_t() {}
+    // a write transaction (stop = false for a repeated start). Returns false to NACK it
+    virtual bool on_write(const uint8_t *data, size_t len, bool stop) = 0;
+    // a read transaction. Fills up to len bytes, returns how many the device had (the rest reads 0xFF). 0 NACKs
+    // the address, like a sensor that is still busy converting
+    virtual size_t on_read(uint8_t *data, size_t len) = 0;
+};
+
+struct fake_i2c_stats_t
+{
+    uint32_t num_transactions, num_nacks;
+    uint64_t num_bytes; // address and data bytes
+    uint64_t bus_us;    // time the bus was busy
+};
+
+inline fake_i2c_device_t *fake_i2c_devices[128];
+inline fake_i2c_stats_t fake_i2c_stats;
+
+inline void fake_i2c_attach(uint8_t address, fake_i2c_device_t *device) { fake_i2c_devices[address & 0x7F] = device; }
+
+class TwoWire
+{
+    uint8_t tx_address = 0;
+    uint8_t tx_buffer[BUFFER_LENGTH], rx_buffer[BUFFER_LENGTH];
+    size_t tx_len = 0, rx_len = 0, rx_pos = 0;
+    uint32_t clock_hz = 100000;
+
+    // start + address byte + num_bytes + stop
+    void bus_transfer(size_t num_bytes)
+    {
+        uint64_t clocks = 1 + 9 * (1 + num_bytes) + 1;
+        uint64_t us = (clocks * 1000000 + clock_hz - 1) / clock_hz;
+        ++fake_i2c_stats.num_transactions;
+        fake_i2c_stats.num_bytes += 1 + num_bytes;
+        fake_i2c_stats.bus_us += us;
+        fake_advance_us(us);
+    }
+
+public:
+    void begin() {}
+    void begin(int, int) {}
+    void setClock(uint32_t hz) { clock_hz = hz; }
+    uint32_t getClock() { return clock_hz; }
+
+    void beginTransmission(uint8_t address)
+    {
+        tx_address = address;
+        tx_len = 0;
+    }
+    void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+
+    size_t write(uint8_t data)
+    {
+        if (tx_len >= BUFFER_LENGTH)
+            return 0;
+        tx_buffer[tx_len++] = data;
+        return 1;
+    }
+    size_t write(const uint8_t *data, size_t len)
+    {
+        size_t n = 0;
+        while (n < len && write(data[n]))
+            n++;
+        return n;
+    }
+
+    // 0 = ok, 2 = address NACKed, as the core reports it
+    uint8_t endTransmission(bool stop = true)
+    {
+        fake_i2c_device_t *device = fake_i2c_devices[tx_address & 0x7F];
+        if (!device || !device->on_write(tx_buffer, tx_len, stop))
+        {
+            bus_transfer(0);
+            ++fake_i2c_stats.num_nacks;
+            return 2;
+        }
+        bus_transfer(tx_len);
+        return 0;
+    }
+    uint8_t endTransmission(uint8_t stop) { return endTransmission((bool)stop); }
+
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, bool stop = true)
+    {
+        (void)stop;
+        rx_pos = rx_len = 0;
+        fake_i2c_device_t *device = fake_i2c_devices[address & 0x7F];
+        quantity = min<uint8_t>(quantity, BUFFER_LENGTH);
+        memset(rx_buffer, 0xFF, quantity);
+        if (!device || !device->on_read(rx_buffer, quantity))
+        {
+            bus_transfer(0);
+            ++fake_i2c_stats.num_nacks;
+            return 0;
+        }
+        rx_len = quantity;
+        bus_transfer(quantity);
+        return quantity;
+    }
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t)address, (uint8_t)quantity); }
+
+    int available() { return rx_len - rx_pos; }
+    int read() { return rx_pos < rx_len ? rx_buffer[rx_pos++] : -1; }
+};
+
+inline TwoWire Wire;
+
+#endif // __FAKE_WIRE_H__
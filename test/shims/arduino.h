@@ -0,0 +1,2 @@
+// the firmware includes the core under both spellings, which matters on a case sensitive file system
+#include "Arduino.h"
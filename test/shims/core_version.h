@@ -0,0 +1 @@
+// the host build is no particular core version
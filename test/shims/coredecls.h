@@ -0,0 +1 @@
+// nothing the host build needs
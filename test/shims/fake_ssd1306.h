@@ -0,0 +1,109 @@
+#ifndef __FAKE_SSD1306_PANEL_H__
+#define __FAKE_SSD1306_PANEL_H__
+
+#include "Wire.h"
+
+// the SSD1306 controller at the other end of the fake I2C bus. It decodes the byte stream the way the chip does
+// (control byte, then commands or display data) into its own display RAM, so a test sees what the panel would
+// show rather than what the firmware meant to send. Only the horizontal addressing mode the firmware uses is
+// modelled; all other commands are skipped along with their arguments
+
+#define FAKE_SSD1306_WIDTH 128
+#define FAKE_SSD1306_PAGES 8
+
+class fake_ssd1306_panel_t : public fake_i2c_device_t
+{
+    uint8_t col_start = 0, col_end = FAKE_SSD1306_WIDTH - 1, page_start = 0, page_end = FAKE_SSD1306_PAGES - 1;
+    uint8_t col = 0, page = 0;
+
+    // bytes of arguments that follow a command
+    static int num_args(uint8_t cmd)
+    {
+        switch (cmd)
+        {
+        case 0x21: // column address
+        case 0x22: // page address
+            return 2;
+        case 0x20: // memory mode
+        case 0x81: // contrast
+        case 0x8D: // charge pump
+        case 0xA8: // multiplex
+        case 0xD3: // display offset
+        case 0xD5: // clock divide
+        case 0xD9: // precharge
+        case 0xDA: // com pins
+        case 0xDB: // vcom detect
+            return 1;
+        default:
+            return 0;
+        }
+    }
+
+    void command(const uint8_t *cmd)
+    {
+        switch (cmd[0])
+        {
+        case 0x21:
+            col_start = col = cmd[1] & 0x7F;
+            col_end = cmd[2] & 0x7F;
+            break;
+        case 0x22:
+            page_start = page = cmd[1] & 0x07;
+            page_end = cmd[2] & 0x07;
+            break;
+        case 0x81:
+            contrast = cmd[1];
+            break;
+        case 0xAE:
+            on = false;
+            break;
+        case 0xAF:
+            on = true;
+            break;
+        }
+        ++num_commands;
+    }
+
+    // horizontal addressing: along the column window, then on to the next page of the page window
+    void data(uint8_t bits)
+    {
+        ram[page * FAKE_SSD1306_WIDTH + col] = bits;
+        ++num_data_bytes;
+        if (col++ < col_end)
+            return;
+        col = col_start;
+        page = page < page_end ? page + 1 : page_start;
+    }
+
+public:
+    uint8_t ram[FAKE_SSD1306_WIDTH * FAKE_SSD1306_PAGES] = {};
+    uint8_t contrast = 0x7F;
+    bool on = false;
+    uint32_t num_commands = 0, num_data_bytes = 0;
+
+    bool on_write(const uint8_t *bytes, size_t len, bool) override
+    {
+        // a control byte with Co = 0 makes the rest of the transaction commands (D/C = 0) or data (D/C = 1)
+        if (len == 0)
+            return true;
+        if (bytes[0] & 0x40)
+        {
+            for (size_t pos = 1; pos < len; pos++)
+                data(bytes[pos]);
+            return true;
+        }
+        for (size_t pos = 1; pos < len; pos += 1 + num_args(bytes[pos]))
+        {
+            if (pos + num_args(bytes[pos]) >= len)
+                break; // arguments cut off by the end of the transaction
+            command(bytes + pos);
+        }
+        return true;
+    }
+
+    size_t on_read(uint8_t *, size_t) override { return 0; }
+
+    bool pixel(int x, int y) const { return ram[(y / 8) * FAKE_SSD1306_WIDTH + x] & (1 << (y % 8)); }
+};
+
+#endif // __FAKE_SSD1306_PANEL_H__
@@ -0,0 +1,121 @@
+// coroutine awaits: a CORO_FOREVER signal wait only ends on a notify, also after the 49.7 days a UINT32_MAX ms
+// timeout would last, while a timed wait still times out. The simulated clock is fast-forwarded across the gap
+
+#include <unity.h>
+
+#include "../../src/tasks.cc"
+#include "coro.h"
+
+#define LOOP_PASS_US 100
+#define DAYS_US(days) ((sched_ts_t)(days) * 24 * 3600 * 1000000)
+
+struct waiter_frame_t : coro_t
+{
+    uint32_t timeout_ms;
+    int num_wakeups;
+    bool timed_out;
+} waiter_frame;
+
+void waiter_coro(waiter_frame_t *co)
+{
+    CORO_BEGIN(co);
+    while (true)
+    {
+        CORO_AWAIT_SIGNAL(co, co->timeout_ms);
+        ++co->num_wakeups;
+        co->timed_out = CORO_TIMED_OUT(co);
+    }
+    CORO_END(co);
+}
+
+// the loop, until the simulated clock reaches until_us, and one more pass there. Whole days would take too many
+// passes, so the clock jumps ahead whenever the scheduler goes idle
+void run_until(uint64_t until_us)
+{
+    while (fake_micros < until_us)
+    {
+        uint64_t delayed_us = fake_delayed_us;
+        sched.run(1000);
+        if (fake_delayed_us == delayed_us)
+            fake_advance_us(LOOP_PASS_US);
+        else if (fake_micros < until_us)
+            fake_advance_us(min<uint64_t>(DAYS_US(1), until_us - fake_micros));
+    }
+    sched.run(0);
+}
+
+void start_waiter(uint32_t timeout_ms)
+{
+    waiter_frame.timeout_ms = timeout_ms;
+    waiter_frame.num_wakeups = 0;
+    waiter_frame.timed_out = false;
+    start_coro<waiter_coro>(0, &waiter_frame, 0);
+    sched.run(0); // runs up to the first await
+}
+
+void setUp()
+{
+    fake_micros = 1000000;
+}
+
+void tearDown()
+{
+    sched.remove_task<waiter_coro>(0);
+}
+
+void test_forever_waits_past_uint32_ms()
+{
+    start_waiter(CORO_FOREVER);
+
+    run_until(fake_micros + DAYS_US(60));
+    TEST_ASSERT_EQUAL(0, waiter_frame.num_wakeups);
+
+    sched.notify_task<waiter_coro>(0);
+    run_until(fake_micros + 10 * LOOP_PASS_US);
+    TEST_ASSERT_EQUAL(1, waiter_frame.num_wakeups);
+    TEST_ASSERT_FALSE(waiter_frame.timed_out);
+
+    // and it parks again afterwards
+    run_until(fake_micros + DAYS_US(60));
+    TEST_ASSERT_EQUAL(1, waiter_frame.num_wakeups);
+}
+
+void test_forever_idles_instead_of_spinning()
+{
+    start_waiter(CORO_FOREVER);
+
+    uint32_t num_runs = sched.get_num_runs();
+    uint64_t start_us = fake_micros;
+    while (fake_micros < start_us + US_FROM_MS(10000))
+    {
+        sched.run(1000);
+    }
+    // one pass per max idle period
+    TEST_ASSERT_LESS_OR_EQUAL(11, sched.get_num_runs() - num_runs);
+    TEST_ASSERT_EQUAL(0, waiter_frame.num_wakeups);
+}
+
+void test_timed_wait_times_out()
+{
+    start_waiter(5000);
+
+    run_until(fake_micros + US_FROM_MS(4900));
+    TEST_ASSERT_EQUAL(0, waiter_frame.num_wakeups);
+    run_until(fake_micros + US_FROM_MS(200));
+    TEST_ASSERT_EQUAL(1, waiter_frame.num_wakeups);
+    TEST_ASSERT_TRUE(waiter_frame.timed_out);
+
+    sched.notify_task<waiter_coro>(0);
+    run_until(fake_micros + 10 * LOOP_PASS_US);
+    TEST_ASSERT_EQUAL(2, waiter_frame.num_wakeups);
+    TEST_ASSERT_FALSE(waiter_frame.timed_out);
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_forever_waits_past_uint32_ms);
+    RUN_TEST(test_forever_idles_instead_of_spinning);
+    RUN_TEST(test_timed_wait_times_out);
+    return UNITY_END();
+}
@@ -0,0 +1,221 @@
+// the DHT11 driver (dht11.cc) through sensor_read_coro: the ISR is fed recorded frames, falling edge by falling edge,
+// on the simulated clock. Valid frames, below zero, a bad checksum, a lost edge, no answer at all, and bit times at
+// the limits of what dht11_decode() takes, with the readings and the error counters they end up in:
+//   pio test -e native -f test_dht11 -v
+
+#include <unity.h>
+
+#include "../../src/tasks.cc"
+#include "../../src/filter.cc"
+#include "../../src/estimator.cc"
+#include "../../src/sensor.cc"
+#include "../../src/dht11.cc"
+#include "../../src/sht3x.cc"
+#include "../../src/bme280.cc"
+
+#define LOOP_PASS_US 100
+#define READ_LIMIT_MS 200 // a read that takes longer than this is stuck
+
+// high times after the 50 us low that starts every bit, as the datasheet gives them
+#define DHT11_ZERO_HIGH_US 27
+#define DHT11_ONE_HIGH_US 70
+#define DHT11_RESPONSE_US 160 // 80 us low, 80 us high, from the response's falling edge to the first bit's
+
+ThermConfig::ThermConfig() {}
+ThermConfig::~ThermConfig() {}
+ThermConfig therm_conf;
+ThermState therm_state;
+
+bool is_disp_flushing()
+{
+    return false;
+}
+
+void send_mqtt_state_cur_temp() {}
+
+// a recorded frame: the time from each falling edge to the next, starting with the response's
+struct dht11_frame_t
+{
+    uint32_t gaps_us[DHT11_NUM_EDGES - 1];
+    int num_edges;
+};
+
+dht11_frame_t make_frame(const uint8_t data[5])
+{
+    dht11_frame_t frame;
+    frame.gaps_us[0] = DHT11_RESPONSE_US;
+    for (int bit = 0; bit < 40; bit++)
+    {
+        bool one = data[bit / 8] & (0x80 >> (bit % 8));
+        frame.gaps_us[bit + 1] = 50 + (one ? DHT11_ONE_HIGH_US : DHT11_ZERO_HIGH_US);
+    }
+    frame.num_edges = DHT11_NUM_EDGES;
+    return frame;
+}
+
+dht11_frame_t make_frame(uint8_t hum, uint8_t hum_tenths, uint8_t temp, uint8_t temp_tenths)
+{
+    const uint8_t data[5] = {hum, hum_tenths, temp, temp_tenths, (uint8_t)(hum + hum_tenths + temp + temp_tenths)};
+    return make_frame(data);
+}
+
+// the ISR, at every falling edge of the frame
+void send_frame(const dht11_frame_t &frame)
+{
+    for (int edge = 0; edge < frame.num_edges; edge++)
+    {
+        if (edge)
+            fake_advance_us(frame.gaps_us[edge - 1]);
+        dht11_interrupt_handler();
+    }
+}
+
+// one read through sensor_read_coro: the start signal, then the frame as soon as the driver listens for it
+void read_frame(const dht11_frame_t &frame)
+{
+    uint64_t limit_us = fake_micros + US_FROM_MS(READ_LIMIT_MS);
+    bool sent = false;
+    sensor_read_task();
+    do
+    {
+        sched.run(0);
+        if (dht11_listening && !sent)
+        {
+            send_frame(frame);
+            sent = true;
+        }
+        fake_advance_us(LOOP_PASS_US);
+    } while (sensor_read_frame.line != 0 && fake_micros < limit_us);
+    TEST_ASSERT_EQUAL(0, sensor_read_frame.line);
+    TEST_ASSERT_FALSE(dht11_listening);
+    sched.remove_task<sensor_read_task>(0);
+}
+
+// dht11_decode() on the edges of frame, as the ISR would have stored them
+bool decode(const dht11_frame_t &frame, uint8_t *data)
+{
+    uint32_t cycles = 0xFFFFF000; // the cycle counter wraps during the frame
+    for (int edge = 0; edge < DHT11_NUM_EDGES; edge++)
+    {
+        if (edge)
+            cycles += frame.gaps_us[edge - 1] * FAKE_CPU_MHZ;
+        dht11_edges[edge] = cycles;
+    }
+    return dht11_decode(data);
+}
+
+void setUp()
+{
+    sensor_stats = {};
+    sensor_read_frame.reading = {};
+}
+
+void tearDown() {}
+
+void test_valid_frame()
+{
+    read_frame(make_frame(45, 0, 23, 4));
+    const sensor_stats_t &stats = get_sensor_stats();
+    TEST_ASSERT_EQUAL(1, stats.num_reads);
+    TEST_ASSERT_EQUAL(0, stats.num_timeouts);
+    TEST_ASSERT_EQUAL(0, stats.num_checksum_errors);
+    TEST_ASSERT_EQUAL(Q8_FROM_INT(45), sensor_read_frame.reading.humidity);
+    TEST_ASSERT_EQUAL(Q8_FROM_INT(23) + Q8_FROM_INT(4) / 10, sensor_read_frame.reading.temperature);
+}
+
+// sensors that go below zero set the top bit of the tenths
+void test_below_zero()
+{
+    read_frame(make_frame(80, 0, 3, 0x80 | 5));
+    TEST_ASSERT_EQUAL(0, get_sensor_stats().num_checksum_errors);
+    TEST_ASSERT_EQUAL(-(Q8_FROM_INT(3) + Q8_FROM_INT(5) / 10), sensor_read_frame.reading.temperature);
+}
+
+void test_bad_checksum()
+{
+    const uint8_t data[5] = {45, 0, 23, 0, 45 + 23 + 1};
+    read_frame(make_frame(data));
+    const sensor_stats_t &stats = get_sensor_stats();
+    TEST_ASSERT_EQUAL(1, stats.num_checksum_errors);
+    TEST_ASSERT_EQUAL(0, stats.num_timeouts);
+    TEST_ASSERT_EQUAL(0, sensor_read_frame.reading.humidity);
+}
+
+// a lost edge leaves the frame short: the driver waits it out and gives up at the timeout, it doesn't decode it
+void test_missing_edge()
+{
+    dht11_frame_t frame = make_frame(45, 0, 23, 0);
+    frame.num_edges = DHT11_NUM_EDGES - 1;
+    uint64_t start_us = fake_micros;
+    read_frame(frame);
+    const sensor_stats_t &stats = get_sensor_stats();
+    TEST_ASSERT_EQUAL(1, stats.num_timeouts);
+    TEST_ASSERT_EQUAL(0, stats.num_checksum_errors);
+    TEST_ASSERT_TRUE(fake_micros - start_us >= US_FROM_MS(DHT11_START_LOW_MS + DHT11_FRAME_TIMEOUT_MS));
+
+    // the next read starts over
+    read_frame(make_frame(45, 0, 23, 0));
+    TEST_ASSERT_EQUAL(1, get_sensor_stats().num_timeouts);
+    TEST_ASSERT_EQUAL(Q8_FROM_INT(45), sensor_read_frame.reading.humidity);
+}
+
+void test_no_answer()
+{
+    dht11_frame_t frame = make_frame(45, 0, 23, 0);
+    frame.num_edges = 0;
+    read_frame(frame);
+    TEST_ASSERT_EQUAL(1, get_sensor_stats().num_timeouts);
+    TEST_ASSERT_EQUAL(0, get_sensor_stats().num_checksum_errors);
+}
+
+// falling edge to falling edge: up to DHT11_BIT_THRESHOLD_US is a 0, above it a 1, above DHT11_BIT_MAX_US the frame
+// is broken. The datasheet's 0 and 1 sit well inside
+void test_bit_time_limits()
+{
+    uint8_t data[5];
+    dht11_frame_t frame = make_frame(0xFF, 0, 0, 0); // bits 0..7 are ones
+    TEST_ASSERT_TRUE(decode(frame, data));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, data[0]);
+
+    frame.gaps_us[1] = DHT11_BIT_THRESHOLD_US; // the first bit, now the longest a 0 can be
+    TEST_ASSERT_FALSE(decode(frame, data));
+    TEST_ASSERT_EQUAL_HEX8(0x7F, data[0]);
+    frame.gaps_us[1] = DHT11_BIT_THRESHOLD_US + 1;
+    TEST_ASSERT_TRUE(decode(frame, data));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, data[0]);
+
+    frame.gaps_us[1] = DHT11_BIT_MAX_US;
+    TEST_ASSERT_TRUE(decode(frame, data));
+    frame.gaps_us[1] = DHT11_BIT_MAX_US + 1;
+    TEST_ASSERT_FALSE(decode(frame, data));
+
+    // a 0 that is too short is still a 0; the response before the first bit isn't timed
+    frame = make_frame(0, 0, 0, 0);
+    frame.gaps_us[0] = 1000;
+    frame.gaps_us[40] = 1;
+    TEST_ASSERT_TRUE(decode(frame, data));
+
+    // and through the whole read, a bit over the limit counts as bad data
+    frame = make_frame(45, 0, 23, 0);
+    frame.gaps_us[20] = DHT11_BIT_MAX_US + 1;
+    read_frame(frame);
+    TEST_ASSERT_EQUAL(1, get_sensor_stats().num_checksum_errors);
+    TEST_ASSERT_EQUAL(0, get_sensor_stats().num_timeouts);
+}
+
+int main(int, char **)
+{
+    fake_micros = US_FROM_MS(1000);
+    therm_conf.sensor_type = SENSOR_TYPE_DHT11;
+    setup_sensor();
+    sched.remove_task<sensor_read_task>(0);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_valid_frame);
+    RUN_TEST(test_below_zero);
+    RUN_TEST(test_bad_checksum);
+    RUN_TEST(test_missing_edge);
+    RUN_TEST(test_no_answer);
+    RUN_TEST(test_bit_time_limits);
+    return UNITY_END();
+}
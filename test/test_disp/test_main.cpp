@@ -0,0 +1,222 @@
+// display golden images: disp.cc renders representative states into the fake SSD1306 framebuffer and sends them
+// over the fake I2C bus to an emulated controller. What ends up in the controller's display RAM is compared against
+// the PBM images in golden/. A mismatch writes <name>.actual.pbm next to the golden image; run with
+// THERM_UPDATE_GOLDEN=1 to accept the new rendering. The readouts come out of GFX's fonts (tools/gen_glyphs.py), so
+// the images that show them get recorded where the library is installed. Render time and bytes per frame are
+// printed along the way:
+//   pio test -e native -f test_disp -v
+
+#include <unity.h>
+#include <chrono>
+#include <string>
+
+#include "../../src/tasks.cc"
+#include "../../src/disp.cc"
+#include "fake_ssd1306.h"
+
+#define PBM_HEADER "P4\n128 64\n"
+#define PBM_SIZE (sizeof(PBM_HEADER) - 1 + SCREEN_WIDTH * SCREEN_HEIGHT / 8)
+#define CONTRAST_BYTES 4 // address, control byte, SSD1306_SETCONTRAST and its argument: the bright mode, not a frame
+
+ThermState therm_state;
+fake_ssd1306_panel_t panel;
+
+std::string golden_dir()
+{
+    std::string file = __FILE__;
+    return file.substr(0, file.find_last_of('/') + 1) + "golden/";
+}
+
+// the panel's display RAM as a PBM image, like /screen.pbm shows the framebuffer
+std::string panel_pbm()
+{
+    std::string pbm = PBM_HEADER;
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        for (int x = 0; x < SCREEN_WIDTH; x += 8)
+        {
+            uint8_t bits = 0;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                if (!panel.pixel(x + bit, y))
+                    bits |= 0x80 >> bit;
+            }
+            pbm += (char)bits;
+        }
+    }
+    return pbm;
+}
+
+std::string screen_pbm()
+{
+    std::string pbm = PBM_HEADER;
+    uint8_t rows[8 * SCREEN_WIDTH / 8];
+    for (int page = 0; page < DISP_NUM_PAGES; page++)
+    {
+        get_screen_pbm_rows(page, rows);
+        pbm.append((const char *)rows, sizeof(rows));
+    }
+    return pbm;
+}
+
+bool read_file(const std::string &path, std::string &contents)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    char buf[PBM_SIZE + 1];
+    size_t len = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+    contents.assign(buf, len);
+    return true;
+}
+
+void write_file(const std::string &path, const std::string &contents)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    TEST_ASSERT_NOT_NULL(file);
+    fwrite(contents.data(), 1, contents.size(), file);
+    fclose(file);
+}
+
+// renders the current state, sends the frame, and checks what the panel shows against golden/<name>.pbm
+void check_frame(const char *name)
+{
+    fake_i2c_stats_t bus_before = fake_i2c_stats;
+    uint32_t frames_before = get_disp_stats().num_frames;
+    uint8_t contrast_before = panel.contrast;
+
+    auto start = std::chrono::steady_clock::now();
+    update_screen();
+    double render_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    // the first chunk goes out right away, the rest a chunk per scheduler pass
+    refresh_display();
+    while (is_disp_flushing())
+    {
+        sched.run(0);
+    }
+
+    const disp_stats_t &stats = get_disp_stats();
+    uint32_t frame_bytes = stats.num_frames > frames_before ? stats.last_frame_bytes : 0;
+    printf("%-20s  %9.1f  %11u  %12u  %8.2f\n", name, render_us, frame_bytes,
+           fake_i2c_stats.num_transactions - bus_before.num_transactions, (fake_i2c_stats.bus_us - bus_before.bus_us) / 1000.0);
+    // the disp stats count the same bytes the bus carried
+    uint32_t other_bytes = panel.contrast != contrast_before ? CONTRAST_BYTES : 0;
+    TEST_ASSERT_EQUAL_UINT64(fake_i2c_stats.num_bytes - bus_before.num_bytes - other_bytes, frame_bytes);
+
+    // everything drawn made it to the panel, and /screen.pbm shows the same
+    TEST_ASSERT_EQUAL_MEMORY(display.getBuffer(), panel.ram, sizeof(panel.ram));
+    std::string actual = panel_pbm();
+    TEST_ASSERT_TRUE(actual == screen_pbm());
+
+    std::string golden_path = golden_dir() + name + ".pbm", golden;
+    if (getenv("THERM_UPDATE_GOLDEN"))
+    {
+        write_file(golden_path, actual);
+        return;
+    }
+    if (!read_file(golden_path, golden))
+    {
+        write_file(golden_dir() + name + ".actual.pbm", actual);
+        TEST_FAIL_MESSAGE(("no " + golden_path + " yet, check " + name + ".actual.pbm and record it with THERM_UPDATE_GOLDEN=1").c_str());
+    }
+    if (golden == actual)
+        return;
+    write_file(golden_dir() + name + ".actual.pbm", actual);
+    TEST_FAIL_MESSAGE(("doesn't match " + golden_path + ", see " + name + ".actual.pbm").c_str());
+}
+
+void set_state(float cur_temp, float tgt_temp, float cur_hum)
+{
+    therm_state.cur_temp = cur_temp;
+    therm_state.tgt_temp = tgt_temp;
+    therm_state.cur_hum = cur_hum;
+}
+
+void set_icons(bool heat, bool fan, bool presence, bool wifi, bool mqtt, bool local_mode)
+{
+    therm_state.heat_relay = heat;
+    therm_state.fan_relay = fan;
+    therm_state.presence = presence;
+    therm_state.wifi_connected = wifi;
+    therm_state.mqtt_connected = mqtt;
+    therm_state.local_mode = local_mode;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// the tests build on each other's screen, like the frames of a running unit
+
+void test_boot_screen()
+{
+    printf("frame                 render us  frame bytes  transactions  bus ms\n");
+    check_frame("boot");
+}
+
+void test_heating()
+{
+    set_state(68.4f, 70.0f, 45.6f);
+    set_icons(true, true, false, true, true, false);
+    check_frame("heating");
+}
+
+// only the setpoint changes: a partial frame
+void test_setpoint_change()
+{
+    therm_state.tgt_temp = 71.0f;
+    check_frame("setpoint_change");
+}
+
+void test_local_mode_3_digits()
+{
+    set_state(101.5f, 99.0f, 100.0f);
+    set_icons(false, false, true, true, false, true);
+    check_frame("local_mode_3_digits");
+}
+
+void test_history()
+{
+    set_icons(false, false, false, true, true, false);
+    for (int sample = 0; sample < 140; sample++)
+    {
+        therm_state.cur_temp = 68.5f + 2.5f * sinf(sample / 12.0f);
+        therm_state.tgt_temp = (sample / 40) % 2 ? 70.0f : 67.0f;
+        therm_state.heat_relay = therm_state.cur_temp < therm_state.tgt_temp;
+        therm_state.fan_relay = sample % 30 < 4;
+        track_history_relays();
+        history_sample_task();
+    }
+    set_disp_screen(SCREEN_HISTORY);
+    check_frame("history");
+}
+
+// new samples within the scale scroll the chart instead of redrawing it
+void test_history_scroll()
+{
+    for (int sample = 0; sample < 6; sample++)
+    {
+        therm_state.cur_temp = 69.0f + sample * 0.25f;
+        therm_state.heat_relay = sample < 3;
+        track_history_relays();
+        history_sample_task();
+    }
+    check_frame("history_scroll");
+}
+
+int main(int, char **)
+{
+    fake_i2c_attach(DISP_I2C_ADDRESS, &panel);
+    init_disp();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_boot_screen);
+    RUN_TEST(test_heating);
+    RUN_TEST(test_setpoint_change);
+    RUN_TEST(test_local_mode_3_digits);
+    RUN_TEST(test_history);
+    RUN_TEST(test_history_scroll);
+    return UNITY_END();
+}
@@ -0,0 +1,143 @@
+// numeric readout redraw: copying pre-rendered glyphs out of flash (glyphs.h) against the way the readouts were
+// drawn before, through GFX: the whole widget printed with FreeMonoBold24pt7b / FreeMonoBold12pt7b into a canvas,
+// then drawBitmap()ed into the framebuffer pixel by pixel. Both have to produce the same pixels, so a cell from the
+// wrong font or off the baseline shows up here. Timings are host nanoseconds, so only the ratio carries over to the
+// ESP8266. See the numbers with
+//   pio test -e native -f test_disp_bench -v
+
+#include <unity.h>
+#include <chrono>
+
+#include "../../src/tasks.cc"
+#include "../../src/disp.cc"
+#include <Fonts/FreeMonoBold12pt7b.h>
+#include <Fonts/FreeMonoBold24pt7b.h>
+
+#define BENCH_RENDERS 20000 // per widget and path
+
+typedef std::chrono::steady_clock bench_clock;
+
+ThermState therm_state;
+
+const char *value_widget_labels[] = {"Inside:", "Set:", "Hum:"};
+
+// the widget as it used to be drawn, text baseline and all
+void render_value_widget_gfx(const value_widget_t &widget, const char *label)
+{
+    const glyph_set_t &glyphs = *widget.glyphs;
+    int16_t height = 8 * (1 + glyphs.num_pages);
+    GFXcanvas1 canvas(widget.width, height);
+    canvas.setTextColor(WHITE);
+    canvas.setCursor(0, 0);
+    canvas.print(label);
+
+    float value = *widget.value;
+    char text[4] = "??";
+    if (!isnan(value))
+    {
+        int truncated = value;
+        snprintf(text, sizeof(text), "%d", truncated % 100);
+
+        int bar_width = widget.width * (value - truncated);
+        if (bar_width > 0)
+            canvas.fillRect(0, height - 2, bar_width, 2, WHITE);
+        if (truncated >= 100)
+            canvas.fillRect(0, widget.marker_y, widget.marker_width, widget.marker_height, WHITE);
+    }
+    if (&glyphs == &big_glyphs)
+    {
+        canvas.setFont(&FreeMonoBold24pt7b);
+        canvas.setCursor(0, 42);
+    }
+    else
+    {
+        canvas.setFont(&FreeMonoBold12pt7b);
+        canvas.setCursor(0, 26);
+    }
+    canvas.print(text);
+
+    display.drawBitmap(widget.x, widget.y, canvas.getBuffer(), widget.width, height, WHITE, BLACK);
+    mark_dirty(widget.x, widget.y, widget.width, height);
+}
+
+// a value for every render, so that no two in a row show the same thing
+float bench_value(int idx)
+{
+    return 60.0f + (idx % 500) * 0.083f;
+}
+
+void setUp()
+{
+    display.clearDisplay();
+}
+
+void tearDown() {}
+
+void test_glyph_blit_matches_gfx()
+{
+    uint8_t gfx_frame[SCREEN_WIDTH * DISP_NUM_PAGES];
+    for (float value : {NAN, 0.0f, 7.5f, 42.25f, 68.9f, 99.99f, 104.5f})
+    {
+        therm_state.cur_temp = therm_state.tgt_temp = therm_state.cur_hum = value;
+
+        display.clearDisplay();
+        for (int idx = 0; idx < 3; idx++)
+            render_value_widget_gfx(value_widgets[idx], value_widget_labels[idx]);
+        memcpy(gfx_frame, display.getBuffer(), sizeof(gfx_frame));
+
+        display.clearDisplay();
+        draw_labels();
+        for (int idx = 0; idx < 3; idx++)
+            render_value_widget(value_widgets[idx]);
+        TEST_ASSERT_EQUAL_MEMORY(gfx_frame, display.getBuffer(), sizeof(gfx_frame));
+    }
+}
+
+void test_bench_redraw()
+{
+    double blit_ns[3], gfx_ns[3];
+    for (int widget_idx = 0; widget_idx < 3; widget_idx++)
+    {
+        const value_widget_t &widget = value_widgets[widget_idx];
+        float *value = (float *)widget.value;
+
+        auto start = bench_clock::now();
+        for (int idx = 0; idx < BENCH_RENDERS; idx++)
+        {
+            *value = bench_value(idx);
+            render_value_widget(widget);
+        }
+        blit_ns[widget_idx] = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / BENCH_RENDERS;
+
+        start = bench_clock::now();
+        for (int idx = 0; idx < BENCH_RENDERS; idx++)
+        {
+            *value = bench_value(idx);
+            render_value_widget_gfx(widget, value_widget_labels[widget_idx]);
+        }
+        gfx_ns[widget_idx] = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / BENCH_RENDERS;
+    }
+
+    printf("widget    glyphs ns    GFX ns  speedup\n");
+    for (int widget_idx = 0; widget_idx < 3; widget_idx++)
+    {
+        printf("%-8s  %9.1f  %8.1f  %6.1fx\n", value_widget_labels[widget_idx], blit_ns[widget_idx], gfx_ns[widget_idx],
+               gfx_ns[widget_idx] / blit_ns[widget_idx]);
+        TEST_ASSERT_TRUE(blit_ns[widget_idx] * 4 < gfx_ns[widget_idx]);
+    }
+
+    // the cells used to be built in RAM at boot; now they are flash, and RAM holds none of it
+    printf("glyph cells: %u bytes PROGMEM (big %u, small %u), 0 bytes RAM\n",
+           (unsigned)(sizeof(big_glyph_cells) + sizeof(small_glyph_cells)), (unsigned)sizeof(big_glyph_cells),
+           (unsigned)sizeof(small_glyph_cells));
+}
+
+int main(int, char **)
+{
+    init_disp();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_glyph_blit_matches_gfx);
+    RUN_TEST(test_bench_redraw);
+    return UNITY_END();
+}
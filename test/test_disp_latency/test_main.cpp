@@ -0,0 +1,234 @@
+// loop latency with the display on the bus: disp.cc on the simulated clock, with the fake Wire taking each
+// transaction's bus time at the configured clock. Knob input arrives from a simulated ISR at random times while
+// frames (including full-screen switches) go out. Measured, once with the chunked flush and once with every frame
+// sent in one go like display() did before:
+// - loop latency: from the ISR to the knob task starting, i.e. how long the loop was stuck in whatever it was doing
+// - input to photon: from the ISR to the end of the I2C transfer that shows its result (disp_stats), on average,
+//   at the 99th percentile (the upper bound of its histogram bucket, as /metrics reports it) and at worst
+// - the worst lateness of the 20 ms network polls, and the longest single pass of the loop
+//   pio test -e native -f test_disp_latency -v
+
+#include <unity.h>
+
+#include "../../src/tasks.cc"
+#include "../../src/disp.cc"
+#include "fake_ssd1306.h"
+
+#define SIM_SECONDS 60
+#define LOOP_PASS_US 5
+#define INPUT_MEAN_GAP_MS 150 // knob steps, at random intervals
+#define SCREEN_SWITCH_PERIOD_MS 2000 // full frames: main <-> history
+#define NETWORK_POLL_PERIOD_MS 20
+#define NETWORK_POLL_COST_US 40
+
+ThermState therm_state;
+fake_ssd1306_panel_t panel;
+
+struct latency_result_t
+{
+    uint32_t num_inputs;
+    uint32_t max_loop_latency_us;
+    uint64_t total_loop_latency_us;
+    uint32_t max_photon_us, avg_photon_us, p99_photon_ms;
+    uint32_t max_poll_lateness_us;
+    uint32_t max_pass_us;
+};
+
+latency_result_t result;
+uint64_t input_ts = 0; // when the pending input's ISR fired, 0 if none is pending
+bool chunked = true;
+
+// what knob_rotate_handler_task does, minus the MQTT report
+void knob_input_task()
+{
+    if (!input_ts)
+        return;
+    uint32_t latency_us = get_ts() - input_ts;
+    result.max_loop_latency_us = max(result.max_loop_latency_us, latency_us);
+    result.total_loop_latency_us += latency_us;
+    ++result.num_inputs;
+    uint32_t isr_cycles = input_ts * FAKE_CPU_MHZ;
+    input_ts = 0;
+
+    therm_state.tgt_temp += 0.25f;
+    refresh_display_for_input(isr_cycles);
+    if (!chunked)
+    {
+        while (is_disp_flushing())
+            disp_flush_task();
+    }
+}
+
+// refresh_display, with the whole frame going out before it returns
+void blocking_refresh_display()
+{
+    refresh_display();
+    while (is_disp_flushing())
+        disp_flush_task();
+}
+
+void screen_switch_task()
+{
+    set_disp_screen(get_disp_screen() == SCREEN_MAIN ? SCREEN_HISTORY : SCREEN_MAIN);
+}
+
+// the readout changes with every sensor reading
+void sensor_task()
+{
+    therm_state.cur_temp += 0.1f;
+    if (therm_state.cur_temp > 75)
+        therm_state.cur_temp = 65;
+}
+
+void network_poll_task()
+{
+    fake_advance_us(NETWORK_POLL_COST_US);
+}
+
+latency_result_t simulate(bool chunked_flush)
+{
+    chunked = chunked_flush;
+    result = {};
+    disp_stats = {};
+    input_ts = 0;
+
+    if (!chunked)
+    {
+        sched.remove_task<refresh_display>(0);
+        sched.add_or_update_task<blocking_refresh_display>(0, NULL, 0, 40, 0, 20);
+    }
+    sched.add_or_update_task<knob_input_task>(0, NULL, 0, 100, 0, 50);
+    sched.add_or_update_task<screen_switch_task>(0, NULL, 0, SCREEN_SWITCH_PERIOD_MS, SCREEN_SWITCH_PERIOD_MS);
+    sched.add_or_update_task<sensor_task>(0, NULL, 0, 1000, 0, 200);
+    sched.add_or_update_task<network_poll_task>(0, NULL, 0, NETWORK_POLL_PERIOD_MS, 0, NETWORK_POLL_PERIOD_MS / 2);
+    sched.add_or_update_task<network_poll_task>(1, NULL, 0, NETWORK_POLL_PERIOD_MS, 0, NETWORK_POLL_PERIOD_MS / 2);
+
+    uint64_t end_us = fake_micros + US_FROM_MS(SIM_SECONDS * 1000);
+    uint64_t next_input_us = fake_micros + US_FROM_MS(random(2 * INPUT_MEAN_GAP_MS));
+    while (fake_micros < end_us)
+    {
+        // the ISR fires at its time even if the loop is stuck in a transfer; the loop sees it when it comes around
+        if (fake_micros >= next_input_us)
+        {
+            if (!input_ts)
+                input_ts = next_input_us;
+            sched.notify_task<knob_input_task>(0);
+            next_input_us += US_FROM_MS(1 + random(2 * INPUT_MEAN_GAP_MS));
+        }
+        uint64_t pass_start_us = fake_micros;
+        sched.run(0);
+        result.max_pass_us = max<uint32_t>(result.max_pass_us, fake_micros - pass_start_us);
+        fake_advance_us(LOOP_PASS_US);
+    }
+
+    for (int id = 0; id < 2; id++)
+    {
+        scheduler::task_timing_t timing = {};
+        sched.get_task_timing<network_poll_task>(id, timing);
+        result.max_poll_lateness_us = max(result.max_poll_lateness_us, timing.max_lateness);
+    }
+    const disp_stats_t &stats = get_disp_stats();
+    result.max_photon_us = stats.max_latency_us;
+    result.avg_photon_us = stats.num_latencies ? stats.total_latency_us / stats.num_latencies : 0;
+    result.p99_photon_ms = get_disp_latency_percentile_ms(99);
+
+    // input cut in ahead of frames going out, and none of it got lost: once everything is sent, the panel shows
+    // what the framebuffer holds
+    while (is_disp_flushing())
+        disp_flush_task();
+    TEST_ASSERT_EQUAL_MEMORY(display.getBuffer(), panel.ram, sizeof(panel.ram));
+
+    sched.remove_task<knob_input_task>(0);
+    sched.remove_task<screen_switch_task>(0);
+    sched.remove_task<sensor_task>(0);
+    sched.remove_task<network_poll_task>(0);
+    sched.remove_task<network_poll_task>(1);
+    if (!chunked)
+    {
+        sched.remove_task<blocking_refresh_display>(0);
+        sched.add_or_update_task<refresh_display>(0, NULL, 0, 40, 0, 20);
+    }
+    return result;
+}
+
+void print_result(const char *name, const latency_result_t &result)
+{
+    printf("%-9s  %6u  %12.2f  %12.2f  %10.2f  %10u  %10.2f  %13.2f  %9.2f\n", name, result.num_inputs,
+           result.total_loop_latency_us / 1000.0 / max(result.num_inputs, 1u), result.max_loop_latency_us / 1000.0,
+           result.avg_photon_us / 1000.0, result.p99_photon_ms, result.max_photon_us / 1000.0,
+           result.max_poll_lateness_us / 1000.0, result.max_pass_us / 1000.0);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_chunked_flush_latency()
+{
+    latency_result_t chunked_result = simulate(true);
+    latency_result_t blocking_result = simulate(false);
+
+    printf("I2C at %lu Hz, %d s, knob input every ~%d ms, full frames every %d ms\n", (unsigned long)DISP_I2C_CLOCK_HZ,
+           SIM_SECONDS, INPUT_MEAN_GAP_MS, SCREEN_SWITCH_PERIOD_MS);
+    printf("flush      inputs  avg loop ms   max loop ms  avg ISR-to-  p99 ISR-to-  max ISR-to-  max poll late  max pass\n");
+    printf("                                              I2C-end ms  I2C-end ms  I2C-end ms   ms             ms\n");
+    print_result("chunked", chunked_result);
+    print_result("blocking", blocking_result);
+
+    // no pass holds the loop for longer than the up to DISP_INPUT_MAX_SYNC_BYTES an input sends right away (two
+    // chunks), which is what the loop latency comes down to
+    TEST_ASSERT_LESS_THAN(6000, chunked_result.max_pass_us);
+    TEST_ASSERT_LESS_THAN(blocking_result.max_loop_latency_us / 4, chunked_result.max_loop_latency_us);
+    TEST_ASSERT_LESS_THAN(blocking_result.max_poll_lateness_us, chunked_result.max_poll_lateness_us);
+    // and input doesn't show up any later for it. What it changes goes ahead of the rest of a frame going out, so
+    // it doesn't wait for a full frame either
+    TEST_ASSERT_LESS_THAN(blocking_result.avg_photon_us + 1000, chunked_result.avg_photon_us);
+    TEST_ASSERT_LESS_OR_EQUAL(20, chunked_result.p99_photon_ms);
+    TEST_ASSERT_LESS_THAN(20000, chunked_result.max_photon_us);
+}
+
+// a knob turn on the history screen switches back to the main screen, like knob.cc does. That's a full frame, which
+// the refresh task sends a chunk per pass: the input only hands it over
+void test_input_screen_switch()
+{
+    set_disp_screen(SCREEN_HISTORY);
+    while (is_screen_switch_pending() || is_disp_flushing())
+    {
+        sched.run(0);
+        fake_advance_us(LOOP_PASS_US);
+    }
+
+    uint64_t bytes_before = get_disp_stats().bytes_sent;
+    uint32_t frames_before = get_disp_stats().num_frames;
+    therm_state.tgt_temp += 0.25f;
+    set_disp_screen(SCREEN_MAIN);
+    refresh_display_for_input(fake_micros * FAKE_CPU_MHZ);
+    TEST_ASSERT_EQUAL_UINT64(bytes_before, get_disp_stats().bytes_sent);
+
+    // the next pass renders the main screen and sends its first chunk
+    fake_advance_us(LOOP_PASS_US);
+    sched.run(0);
+    TEST_ASSERT_TRUE(is_disp_flushing());
+    TEST_ASSERT_LESS_OR_EQUAL(DISP_I2C_MAX_CHUNK + 10, get_disp_stats().bytes_sent - bytes_before);
+    while (is_disp_flushing())
+    {
+        fake_advance_us(LOOP_PASS_US);
+        sched.run(0);
+    }
+    TEST_ASSERT_EQUAL(frames_before + 1, get_disp_stats().num_frames);
+    TEST_ASSERT_EQUAL_MEMORY(display.getBuffer(), panel.ram, sizeof(panel.ram));
+}
+
+int main(int, char **)
+{
+    fake_i2c_attach(DISP_I2C_ADDRESS, &panel);
+    init_disp();
+    therm_state.cur_temp = 68.0f;
+    therm_state.tgt_temp = 70.0f;
+    therm_state.cur_hum = 40.0f;
+
+    UNITY_BEGIN();
+    RUN_TEST(test_chunked_flush_latency);
+    RUN_TEST(test_input_screen_switch);
+    return UNITY_END();
+}
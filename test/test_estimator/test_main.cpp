@@ -0,0 +1,303 @@
+// the temperature estimator on a replayed DHT11 trace, through the whole reading path (process_sensor_reading: F
+// conversion, outlier filter, estimator, adaptive read period). The room heats at +8 F/h while the furnace runs and
+// cools at -2 F/h otherwise; the relay switches where the trend changes, and tells the sensor like control.cc does.
+// The DHT11 reports it in whole degrees C with a little noise. Scored after the first SETTLE_MIN minutes, over a few noise seeds:
+// - temperature: RMS and worst error of cur_temp against the room, and the same for the mean of the last 10
+//   readings that cur_temp used to be
+// - rate: RMS and range of the cur_temp_rate error, from RATE_SETTLE_MIN after a switch
+// - lookahead: the local thermostat acts on cur_temp plus 3 minutes of cur_temp_rate (capped), scored against the
+//   room 3 minutes later, next to cur_temp on its own
+//   pio test -e native -f test_estimator -v
+
+#include <unity.h>
+
+#include "../../src/tasks.cc"
+#include "../../src/filter.cc"
+#include "../../src/estimator.cc"
+#include "../../src/sensor.cc"
+#include "../../src/dht11.cc"
+#include "../../src/sht3x.cc"
+#include "../../src/bme280.cc"
+
+#define START_TEMP_F 66.0f
+#define HEAT_RATE_F_PER_H 8.0f
+#define COOL_RATE_F_PER_H -2.0f
+#define SETTLE_MIN 10      // not scored: the estimator starts from one reading
+#define RATE_SETTLE_MIN 10 // after a switch, for the rate
+#define LOOKAHEAD_MIN 3    // LOCAL_MODE_LOOKAHEAD_MIN
+#define LOOKAHEAD_MAX_F 0.5f // LOCAL_MODE_LOOKAHEAD_MAX_F
+#define OLD_WINDOW 10      // NUM_SAMPLES_FOR_TEMP_AVG
+#define NUM_SEEDS 8
+
+ThermConfig::ThermConfig() {}
+ThermConfig::~ThermConfig() {}
+ThermConfig therm_conf;
+ThermState therm_state;
+
+bool is_disp_flushing()
+{
+    return false;
+}
+
+void send_mqtt_state_cur_temp() {}
+
+struct segment_t
+{
+    int minutes;
+    bool heat;
+};
+
+// off, two furnace cycles, off
+const segment_t segments[] = {{20, false}, {30, true}, {60, false}, {30, true}, {60, false}};
+#define NUM_SEGMENTS (int)(sizeof(segments) / sizeof(segments[0]))
+
+struct room_t
+{
+    float temp;     // F
+    bool heat;      // relay
+    float rate;     // F/h
+    uint64_t last_switch_us;
+};
+
+// the room at ts_us, from the start of the trace
+room_t room_at(uint64_t ts_us)
+{
+    room_t room = {START_TEMP_F, false, 0, 0};
+    uint64_t segment_start_us = 0;
+    for (int idx = 0; idx < NUM_SEGMENTS; idx++)
+    {
+        uint64_t segment_us = (uint64_t)segments[idx].minutes * 60 * 1000000;
+        room.heat = segments[idx].heat;
+        room.rate = room.heat ? HEAT_RATE_F_PER_H : COOL_RATE_F_PER_H;
+        room.last_switch_us = segment_start_us;
+        uint64_t in_segment_us = min(ts_us - segment_start_us, segment_us);
+        room.temp += room.rate * in_segment_us / 3600e6f;
+        if (ts_us < segment_start_us + segment_us || idx == NUM_SEGMENTS - 1)
+            break;
+        segment_start_us += segment_us;
+    }
+    return room;
+}
+
+// the first relay switch after ts_us, or never
+uint64_t next_switch_us(uint64_t ts_us)
+{
+    uint64_t segment_end_us = 0;
+    for (int idx = 0; idx < NUM_SEGMENTS - 1; idx++)
+    {
+        segment_end_us += (uint64_t)segments[idx].minutes * 60 * 1000000;
+        if (segment_end_us > ts_us && segments[idx + 1].heat != segments[idx].heat)
+            return segment_end_us;
+    }
+    return UINT64_MAX;
+}
+
+uint64_t trace_us()
+{
+    uint64_t total_us = 0;
+    for (const segment_t &segment : segments)
+        total_us += (uint64_t)segment.minutes * 60 * 1000000;
+    return total_us;
+}
+
+// roughly normal, from the shim's deterministic random()
+float noise(float sigma)
+{
+    float sum = 0;
+    for (int idx = 0; idx < 4; idx++)
+        sum += random(1000) / 1000.0f - 0.5f;
+    return sum * sigma * 1.73f;
+}
+
+// an error figure: RMS and range
+struct score_error_t
+{
+    double sum_sq;
+    int num;
+    float min, max;
+
+    void add(float error)
+    {
+        sum_sq += error * error;
+        min = num ? std::min(min, error) : error;
+        max = num ? std::max(max, error) : error;
+        ++num;
+    }
+    float rms() const { return sqrt(sum_sq / std::max(num, 1)); }
+    float worst() const { return std::max(-min, max); }
+};
+
+struct score_t
+{
+    int num_readings;
+    score_error_t temp, old_temp, rate, lookahead, hold;
+};
+
+// when the reading after the one at ts_us is due. A relay switch in between reschedules it
+uint64_t next_reading_us(uint64_t start_us, uint64_t ts_us)
+{
+    uint64_t next_us = ts_us + US_FROM_MS(sensor_read_period_ms), switch_us = next_switch_us(ts_us);
+    if (switch_us >= next_us)
+        return next_us;
+    fake_micros = start_us + switch_us;
+    therm_state.heat_relay = room_at(switch_us).heat;
+    sensor_relays_changed();
+    return switch_us + US_FROM_MS(sensor_read_period_ms);
+}
+
+score_t replay(float noise_c, unsigned long seed)
+{
+    randomSeed(seed);
+    therm_conf.sensor_type = SENSOR_TYPE_DHT11;
+    setup_sensor();
+    sched.remove_task<sensor_read_task>(0);
+    therm_state.cur_temp = therm_state.cur_temp_rate = NAN;
+
+    score_t score = {};
+    float old_window[OLD_WINDOW];
+    int old_count = 0;
+
+    uint64_t start_us = fake_micros, end_us = trace_us();
+    for (uint64_t ts_us = 0; ts_us < end_us; ts_us = next_reading_us(start_us, ts_us))
+    {
+        fake_micros = start_us + ts_us;
+        room_t room = room_at(ts_us);
+        therm_state.heat_relay = room.heat;
+
+        sensor_reading_t reading;
+        float temp_c = (room.temp - 32) * 5 / 9 + noise(noise_c);
+        reading.temperature = Q8_FROM_INT(lroundf(temp_c));
+        reading.humidity = Q8_FROM_INT(40);
+        process_sensor_reading(reading);
+        ++score.num_readings;
+
+        old_window[old_count++ % OLD_WINDOW] = Q8_TO_FLOAT(reading.temperature * 9 / 5 + Q8_FROM_INT(32));
+        if (ts_us < US_FROM_MS(SETTLE_MIN * 60 * 1000) || isnan(therm_state.cur_temp))
+            continue;
+
+        score.temp.add(therm_state.cur_temp - room.temp);
+        float old_temp = 0;
+        for (int idx = 0; idx < min(old_count, OLD_WINDOW); idx++)
+            old_temp += old_window[idx];
+        score.old_temp.add(old_temp / min(old_count, OLD_WINDOW) - room.temp);
+
+        // what the local thermostat acts on, against where the room really is by then; and without the lookahead
+        float room_ahead = room_at(ts_us + US_FROM_MS(LOOKAHEAD_MIN * 60 * 1000)).temp;
+        float lookahead = constrain(therm_state.cur_temp_rate * LOOKAHEAD_MIN / 60, -LOOKAHEAD_MAX_F, LOOKAHEAD_MAX_F);
+        score.lookahead.add(therm_state.cur_temp + lookahead - room_ahead);
+        score.hold.add(therm_state.cur_temp - room_ahead);
+
+        if (ts_us - room.last_switch_us >= US_FROM_MS(RATE_SETTLE_MIN * 60 * 1000))
+            score.rate.add(therm_state.cur_temp_rate - room.rate);
+    }
+    return score;
+}
+
+void print_errors(const char *name, int num_readings, const score_t &score)
+{
+    printf("%-5s  %8d  %5.2f  %5.2f  %5.2f  %5.2f  %5.2f  %5.1f..%4.1f  %5.2f  %5.2f  %5.2f  %5.2f\n", name, num_readings,
+           score.temp.rms(), score.temp.worst(), score.old_temp.rms(), score.old_temp.worst(), score.rate.rms(),
+           score.rate.min, score.rate.max, score.lookahead.rms(), score.lookahead.worst(), score.hold.rms(),
+           score.hold.worst());
+}
+
+// the worst of each figure over a few seeds, whichever seed it came from
+score_t replay_seeds(float noise_c)
+{
+    printf("DHT11 noise %.2f C\n", noise_c);
+    printf("                  temp F        old mean F    rate F/h            lookahead F   no lookahead F\n");
+    printf("seed   readings   rms    max    rms    max    rms    error        rms    max    rms    max\n");
+    score_t worst = {};
+    auto worse = [](score_error_t &worst, const score_error_t &error) {
+        worst.sum_sq = std::max(worst.sum_sq, error.sum_sq / error.num);
+        worst.num = 1;
+        worst.min = std::min(worst.min, error.min);
+        worst.max = std::max(worst.max, error.max);
+    };
+    for (unsigned long seed = 1; seed <= NUM_SEEDS; seed++)
+    {
+        score_t score = replay(noise_c, seed);
+        char name[8];
+        snprintf(name, sizeof(name), "%lu", seed);
+        print_errors(name, score.num_readings, score);
+        worse(worst.temp, score.temp);
+        worse(worst.old_temp, score.old_temp);
+        worse(worst.rate, score.rate);
+        worse(worst.lookahead, score.lookahead);
+        worse(worst.hold, score.hold);
+    }
+    print_errors("worst", 0, worst);
+    return worst;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// the DHT11's own noise, before it rounds to whole degrees C. With next to none the readings are a staircase, the
+// hard case: they stay put for as long as the temperature takes to cross to the next degree. With more they flap
+// between neighbouring steps, which averages out
+void test_replay_dht11_staircase()
+{
+    score_t worst = replay_seeds(0.05f);
+    TEST_ASSERT_TRUE(worst.temp.rms() < 0.35f);
+    TEST_ASSERT_TRUE(worst.temp.worst() < 1.0f);
+    TEST_ASSERT_TRUE(worst.temp.rms() < worst.old_temp.rms());
+    TEST_ASSERT_TRUE(worst.rate.rms() < 2.5f);
+    TEST_ASSERT_TRUE(worst.lookahead.rms() < worst.hold.rms());
+}
+
+void test_replay_dht11_noisy()
+{
+    score_t worst = replay_seeds(0.2f);
+    TEST_ASSERT_TRUE(worst.temp.rms() < 0.3f);
+    TEST_ASSERT_TRUE(worst.temp.worst() < 1.0f);
+    TEST_ASSERT_TRUE(worst.temp.rms() < worst.old_temp.rms());
+    TEST_ASSERT_TRUE(worst.rate.rms() < 1.5f);
+    TEST_ASSERT_TRUE(worst.lookahead.rms() < worst.hold.rms());
+}
+
+void next_read_visitor(const scheduler::task_info_t &info, void *ctx)
+{
+    if (info.func_ptr == (void *)sensor_read_task)
+        *(sched_ts_t *)ctx = info.next_ts;
+}
+
+// the furnace coming on doesn't wait for the next reading, up to a minute away, to speed the reads up
+void test_relay_switch_speeds_up_reads()
+{
+    therm_conf.sensor_type = SENSOR_TYPE_DHT11;
+    setup_sensor();
+    therm_state.heat_relay = therm_state.fan_relay = false;
+    sensor_reading_t reading = {Q8_FROM_INT(21), Q8_FROM_INT(40)};
+    for (int idx = 0; idx < 20; idx++)
+    {
+        process_sensor_reading(reading);
+        fake_advance_us(US_FROM_MS(sensor_read_period_ms));
+    }
+    TEST_ASSERT_EQUAL(SENSOR_READ_PERIOD_MAX_MS, get_sensor_stats().read_period_ms);
+
+    therm_state.heat_relay = true;
+    sensor_relays_changed();
+    TEST_ASSERT_EQUAL(SENSOR_READ_PERIOD_MIN_MS, get_sensor_stats().read_period_ms);
+    sched_ts_t next_read_ts = 0;
+    sched.for_each_task(next_read_visitor, &next_read_ts);
+    TEST_ASSERT_TRUE(next_read_ts <= get_ts() + US_FROM_MS(SENSOR_READ_PERIOD_MIN_MS));
+
+    // and going off, it slows down again a step at a time
+    therm_state.heat_relay = false;
+    sensor_relays_changed();
+    TEST_ASSERT_LESS_OR_EQUAL(2 * SENSOR_READ_PERIOD_MIN_MS, get_sensor_stats().read_period_ms);
+    sched.remove_task<sensor_read_task>(0);
+}
+
+int main(int, char **)
+{
+    fake_micros = US_FROM_MS(1000);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_replay_dht11_staircase);
+    RUN_TEST(test_replay_dht11_noisy);
+    RUN_TEST(test_relay_switch_speeds_up_reads);
+    return UNITY_END();
+}
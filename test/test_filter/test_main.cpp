@@ -0,0 +1,244 @@
+// the DHT11 outlier filter on replayed traces. A trace is what the sensor would report every 5 s for a known room
+// temperature: whole degrees C (with a bit of noise, so it flaps between neighbouring steps), converted to F in Q8
+// like process_sensor_reading does, with the occasional corrupted reading that got past the checksum (a flipped bit
+// in the integer byte: +-8, 16 or 32 C). Each trace goes through filter_add, and through the float smoother the
+// filter replaced. Checked: every spike is rejected, real changes get through, and the output stays within a sensor
+// step of the truth. Then the cost per sample, in host TSC cycles where there is one (x86), host ns otherwise; on
+// the device it is therm_sensor_filter_cycles_max:
+//   pio test -e native -f test_filter -v
+
+#include <unity.h>
+#include <chrono>
+
+#include <Arduino.h>
+#include "../../src/filter.cc"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#define BENCH_UNIT "TSC cycles"
+#else
+#define BENCH_CYCLES() std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+#define BENCH_UNIT "ns"
+#endif
+
+#define TRACE_SAMPLE_S 5 // SENSOR_READ_PERIOD_MIN_MS
+#define TRACE_SAMPLES 720 // an hour
+#define TRACE_MAX_SAMPLES 1000
+#define SPIKE_PER_MILLE 20
+#define DHT11_NOISE_C 0.3f // before rounding to whole degrees
+#define MIN_THRESHOLD Q8_FROM_INT(2) // dht11_driver's min_outlier_temp
+#define OLD_WINDOW 10 // NUM_SAMPLES_FOR_TEMP_AVG
+#define BENCH_PASSES 200
+
+typedef float (*room_temp_fn)(int sample); // C
+
+struct trace_t
+{
+    const char *name;
+    room_temp_fn room_temp;
+    int step_sample; // where the room jumps, -1 if it doesn't
+};
+
+struct trace_result_t
+{
+    int num_spikes, spikes_passed;
+    int false_rejects;  // good readings taken for outliers, outside of a step
+    int step_delay;     // readings after the step until the first one at the new level gets through
+    float max_error, rms_error; // filtered output against the room, F
+    float old_max_error;        // the old smoother's output against the room, F
+};
+
+float room_steady(int)
+{
+    return 21.5f; // right on a rounding boundary: the worst case for flapping
+}
+
+// heating at +8 F/h for 20 minutes, then cooling at -2 F/h
+float room_heat_cool(int sample)
+{
+    float hours = sample * TRACE_SAMPLE_S / 3600.0f;
+    const float heat_hours = 1.0f / 3;
+    float temp_f = 66.0f + 8.0f * min(hours, heat_hours) - 2.0f * max(hours - heat_hours, 0.0f);
+    return (temp_f - 32) * 5 / 9;
+}
+
+// the unit gets moved to a warmer spot
+float room_step(int sample)
+{
+    return sample < TRACE_SAMPLES / 2 ? 20.2f : 23.4f;
+}
+
+const trace_t traces[] = {
+    {"steady", room_steady, -1},
+    {"heat_cool", room_heat_cool, -1},
+    {"step", room_step, TRACE_SAMPLES / 2},
+};
+
+float to_f(float temp_c)
+{
+    return temp_c * 9 / 5 + 32;
+}
+
+// roughly normal, from the shim's deterministic random()
+float noise(float sigma)
+{
+    float sum = 0;
+    for (int idx = 0; idx < 4; idx++)
+        sum += random(1000) / 1000.0f - 0.5f;
+    return sum * sigma * 1.73f;
+}
+
+// what the DHT11 reports for the trace, in F Q8 as process_sensor_reading converts it
+int record_trace(const trace_t &trace, q8_t *readings, bool *spikes)
+{
+    randomSeed(1);
+    for (int sample = 0; sample < TRACE_SAMPLES; sample++)
+    {
+        int temp_c = lroundf(trace.room_temp(sample) + noise(DHT11_NOISE_C));
+        spikes[sample] = random(1000) < SPIKE_PER_MILLE;
+        if (spikes[sample])
+            temp_c += (random(2) ? 1 : -1) << (3 + random(3));
+        readings[sample] = Q8_FROM_INT(temp_c) * 9 / 5 + Q8_FROM_INT(32);
+    }
+    return TRACE_SAMPLES;
+}
+
+// the smoother filter_add replaced (dht11.cc before): subtracts the running mean from a float sum
+struct old_smoother_t
+{
+    float window_sum = NAN;
+    int sample_count = 0;
+    float output = NAN;
+
+    void add(float temperature)
+    {
+        if (sample_count == 0)
+            window_sum = temperature;
+        else
+        {
+            while (sample_count >= OLD_WINDOW)
+            {
+                output = window_sum / sample_count;
+                window_sum -= output;
+                --sample_count;
+            }
+            window_sum += temperature;
+        }
+        ++sample_count;
+    }
+};
+
+trace_result_t replay(const trace_t &trace)
+{
+    q8_t readings[TRACE_MAX_SAMPLES];
+    bool spikes[TRACE_MAX_SAMPLES];
+    int num_samples = record_trace(trace, readings, spikes);
+
+    sample_filter_t filter;
+    filter_init(filter, MIN_THRESHOLD);
+    old_smoother_t old;
+    trace_result_t result = {};
+    result.step_delay = -1;
+    double sum_sq_error = 0;
+    int num_outputs = 0;
+    for (int sample = 0; sample < num_samples; sample++)
+    {
+        q8_t filtered;
+        bool ready = filter_add(filter, readings[sample], filtered);
+        old.add(Q8_TO_FLOAT(readings[sample]));
+        float room_f = to_f(trace.room_temp(sample));
+
+        // the estimator only sees readings that aren't outliers (process_sensor_reading)
+        bool accepted = ready && !filter.last_outlier;
+        if (spikes[sample])
+        {
+            ++result.num_spikes;
+            if (accepted)
+                ++result.spikes_passed;
+        }
+        else if (ready && !accepted)
+        {
+            if (trace.step_sample < 0 || sample < trace.step_sample)
+                ++result.false_rejects;
+        }
+        if (trace.step_sample >= 0 && sample >= trace.step_sample && result.step_delay < 0 && accepted)
+            result.step_delay = sample - trace.step_sample;
+
+        // the output lags a step by design; it is judged outside of one
+        bool settling = trace.step_sample >= 0 && sample >= trace.step_sample && sample < trace.step_sample + FILTER_WINDOW;
+        if (ready && !settling)
+        {
+            float error = fabsf(Q8_TO_FLOAT(filtered) - room_f);
+            result.max_error = max(result.max_error, error);
+            sum_sq_error += error * error;
+            ++num_outputs;
+        }
+        if (!isnan(old.output) && !settling)
+            result.old_max_error = max(result.old_max_error, fabsf(old.output - room_f));
+    }
+    result.rms_error = sqrt(sum_sq_error / max(num_outputs, 1));
+    return result;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_replay_traces()
+{
+    printf("trace       spikes  passed  false rejects  step delay  max err F  rms err F  old max err F\n");
+    for (const trace_t &trace : traces)
+    {
+        trace_result_t result = replay(trace);
+        printf("%-10s  %6d  %6d  %13d  %10d  %9.2f  %9.2f  %13.2f\n", trace.name, result.num_spikes, result.spikes_passed,
+               result.false_rejects, result.step_delay, result.max_error, result.rms_error, result.old_max_error);
+
+        TEST_ASSERT_GREATER_THAN(0, result.num_spikes);
+        TEST_ASSERT_EQUAL(0, result.spikes_passed);
+        // a sensor step (1.8 F) is within the threshold floor, so flapping between two steps is never an outlier
+        TEST_ASSERT_EQUAL(0, result.false_rejects);
+        // within a sensor step of the room, outside of a step change
+        TEST_ASSERT_TRUE(result.max_error < 1.8f);
+        // a real change gets through once it is half the window
+        if (trace.step_sample >= 0)
+        {
+            TEST_ASSERT_GREATER_OR_EQUAL(0, result.step_delay);
+            TEST_ASSERT_LESS_OR_EQUAL(FILTER_WINDOW / 2, result.step_delay);
+        }
+    }
+}
+
+void test_bench_filter()
+{
+    q8_t readings[TRACE_MAX_SAMPLES];
+    bool spikes[TRACE_MAX_SAMPLES];
+    int num_samples = record_trace(traces[1], readings, spikes);
+
+    sample_filter_t filter;
+    q8_t filtered, sink = 0;
+    uint64_t total = 0;
+    for (int pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        filter_init(filter, MIN_THRESHOLD);
+        uint64_t start = BENCH_CYCLES();
+        for (int sample = 0; sample < num_samples; sample++)
+        {
+            if (filter_add(filter, readings[sample], filtered))
+                sink += filtered;
+        }
+        total += BENCH_CYCLES() - start;
+    }
+    TEST_ASSERT_NOT_EQUAL(0, sink);
+    printf("filter_add: %.1f %s per sample (window %d, %d samples x %d passes), %u bytes of state\n",
+           (double)total / (num_samples * BENCH_PASSES), BENCH_UNIT, FILTER_WINDOW, num_samples, BENCH_PASSES,
+           (unsigned)sizeof(sample_filter_t));
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_replay_traces);
+    RUN_TEST(test_bench_filter);
+    return UNITY_END();
+}
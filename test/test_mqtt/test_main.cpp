@@ -0,0 +1,289 @@
+// heap and bytes of the MQTT publish path: mqtt.cc against the fake PubSubClient, with the ArduinoJson shim, which
+// takes memory like the library does. Every heap allocation on the host goes through the counting operator new
+// below, String's (std::string underneath: inline up to 15 characters, where the ESP8266 core's String keeps 11)
+// and DynamicJsonDocument's among them. For each message a running unit sends over and over, measured per publish:
+// - heap allocations, and the most heap in use on top of what was there before
+// - payload bytes, bytes on the wire (with the MQTT header and the topic), and the TCP writes they took
+// - host time
+// and checked: no allocations, compact JSON, and mqtt_stats agrees with what went out.
+// Also Home Assistant discovery, with the hash it keeps on flash (test/shims/LittleFS.h, in RAM): nothing on a
+// reconnect when the config is what HA already has, everything, and the new hash on flash, when it changed, and
+// everything again when HA asks with its birth message
+//   pio test -e native -f test_mqtt -v
+
+#include <unity.h>
+#include <chrono>
+#include <new>
+
+#include "../../src/tasks.cc"
+#include "../../src/psychro.cc"
+#include "../../src/mqtt.cc"
+
+#define NUM_PUBLISHES 100
+#define NUM_HA_ENTITIES (sizeof(ha_entities) / sizeof(ha_entities[0]))
+#define LOOP_PASS_MS 10
+
+struct heap_stats_t
+{
+    uint32_t num_allocs;
+    uint32_t in_use, peak;
+};
+
+heap_stats_t heap_stats;
+
+// each block carries its size in front, for the bytes in use
+#define HEAP_HEADER sizeof(max_align_t)
+
+void *operator new(size_t size)
+{
+    uint8_t *block = (uint8_t *)malloc(size + HEAP_HEADER);
+    if (!block)
+        throw std::bad_alloc();
+    *(size_t *)block = size;
+    heap_stats.num_allocs++;
+    heap_stats.in_use += size;
+    heap_stats.peak = max(heap_stats.peak, heap_stats.in_use);
+    fake_heap_in_use = heap_stats.in_use;
+    return block + HEAP_HEADER;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    if (!ptr)
+        return;
+    uint8_t *block = (uint8_t *)ptr - HEAP_HEADER;
+    heap_stats.in_use -= *(size_t *)block;
+    fake_heap_in_use = heap_stats.in_use;
+    free(block);
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { operator delete(ptr); }
+
+ThermConfig::ThermConfig() {}
+ThermConfig::~ThermConfig() {}
+ThermConfig therm_conf;
+ThermState therm_state;
+
+bool fan_on() { return true; }
+bool fan_off() { return true; }
+bool heat_on() { return true; }
+bool heat_off() { return true; }
+void update_target_temp(float) {}
+
+uint32_t get_disp_latency_percentile_ms(int percentile) { return percentile / 10; }
+
+const stall_record_t *get_last_stall(bool &from_previous_boot)
+{
+    from_previous_boot = false;
+    return NULL;
+}
+String get_last_stall_reset_reason() { return String(); }
+
+struct publish_t
+{
+    const char *name;
+    void (*send)();
+};
+
+// what goes out while the unit runs, as opposed to once per connection
+const publish_t publishes[] = {
+    {"relays", send_mqtt_state_relays},
+    {"presence", send_mqtt_state_presence},
+    {"cur_temp", send_mqtt_state_cur_temp},
+    {"setpoint", send_mqtt_state_target_temp},
+    {"sched", send_mqtt_sched_stats},
+};
+
+struct publish_cost_t
+{
+    float allocs;         // per publish
+    uint32_t peak_bytes;  // heap on top of what was in use before the publish
+    float payload_bytes, wire_bytes, tcp_writes; // per publish
+    float ns;
+};
+
+publish_cost_t measure(const publish_t &publish)
+{
+    publish.send(); // first-time setup, like static locals, doesn't count
+    fake_mqtt_stats = {};
+    heap_stats.num_allocs = 0;
+    heap_stats.peak = heap_stats.in_use;
+    uint32_t in_use_before = heap_stats.in_use;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int idx = 0; idx < NUM_PUBLISHES; idx++)
+        publish.send();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    TEST_ASSERT_EQUAL(NUM_PUBLISHES, fake_mqtt_stats.num_messages);
+    TEST_ASSERT_EQUAL(in_use_before, heap_stats.in_use);
+    publish_cost_t cost;
+    cost.allocs = (float)heap_stats.num_allocs / NUM_PUBLISHES;
+    cost.peak_bytes = heap_stats.peak - in_use_before;
+    cost.payload_bytes = (float)fake_mqtt_stats.payload_bytes / NUM_PUBLISHES;
+    cost.wire_bytes = (float)fake_mqtt_stats.wire_bytes / NUM_PUBLISHES;
+    cost.tcp_writes = (float)fake_mqtt_stats.num_tcp_writes / NUM_PUBLISHES;
+    cost.ns = ns / NUM_PUBLISHES;
+    return cost;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_publish_costs()
+{
+    printf("message   allocs  peak heap B  payload B  wire B  TCP writes  host ns\n");
+    for (const publish_t &publish : publishes)
+    {
+        publish_cost_t cost = measure(publish);
+        printf("%-8s  %6.1f  %11u  %9.1f  %6.1f  %10.1f  %7.0f\n", publish.name, cost.allocs, cost.peak_bytes,
+               cost.payload_bytes, cost.wire_bytes, cost.tcp_writes, cost.ns);
+    }
+}
+
+// the steady state path takes nothing from the heap, not even for a moment
+void test_publish_no_allocations()
+{
+    for (const publish_t &publish : publishes)
+    {
+        publish_cost_t cost = measure(publish);
+        TEST_ASSERT_EQUAL_FLOAT(0, cost.allocs);
+        TEST_ASSERT_EQUAL(0, cost.peak_bytes);
+    }
+}
+
+void test_compact_payloads()
+{
+    therm_state.fan_relay = 0;
+    therm_state.heat_relay = 1;
+    send_mqtt_state_relays();
+    TEST_ASSERT_EQUAL_STRING("stat/therm/therm-test/relays", fake_mqtt_last_topic);
+    TEST_ASSERT_EQUAL_STRING("{\"rl_fan\":\"off\",\"rl_heat\":\"on\"}", fake_mqtt_last_payload);
+
+    therm_state.tgt_temp = 70.5f;
+    send_mqtt_state_target_temp();
+    TEST_ASSERT_EQUAL_STRING("{\"set_temp\":70.5}", fake_mqtt_last_payload);
+}
+
+// the counters /metrics exports
+void test_mqtt_stats()
+{
+    const mqtt_stats_t &stats = get_mqtt_stats();
+    fake_mqtt_stats = {};
+    uint32_t num_before = stats.num_publishes;
+    uint64_t bytes_before = stats.payload_bytes;
+    for (const publish_t &publish : publishes)
+        publish.send();
+    TEST_ASSERT_EQUAL(fake_mqtt_stats.num_messages, stats.num_publishes - num_before);
+    TEST_ASSERT_EQUAL_UINT64(fake_mqtt_stats.payload_bytes, stats.payload_bytes - bytes_before);
+    TEST_ASSERT_EQUAL(0, stats.num_publish_failures);
+    TEST_ASSERT_EQUAL(FAKE_HEAP_SIZE - heap_stats.in_use, stats.min_free_heap);
+}
+
+// the broker restarted: the unit connects again, HA still has its config
+void test_ha_discovery_unchanged()
+{
+    mqtt_client.disconnect();
+    fake_mqtt_stats = {};
+    mqtt_connect();
+    TEST_ASSERT_TRUE(mqtt_client.connected());
+    TEST_ASSERT_EQUAL(0, fake_mqtt_stats.num_messages);
+
+    announce_devices_to_homeassistant(false);
+    TEST_ASSERT_EQUAL(0, fake_mqtt_stats.num_messages);
+}
+
+// the unit lost its relays: their entities are removed, and the hash on flash moves on once HA has got it all
+void test_ha_discovery_changed()
+{
+    uint32_t hash_before = read_ha_discovery_hash();
+    therm_conf.relays_available = false;
+    uint32_t hash = hash_ha_discovery();
+    TEST_ASSERT_NOT_EQUAL(hash_before, hash);
+
+    // nobody to tell
+    mqtt_client.disconnect();
+    fake_mqtt_stats = {};
+    announce_devices_to_homeassistant(false);
+    TEST_ASSERT_EQUAL(0, fake_mqtt_stats.num_messages);
+    TEST_ASSERT_EQUAL_HEX32(hash_before, read_ha_discovery_hash());
+
+    // on the next connection, then. The relays' configs go out empty, which removes them
+    mqtt_connect();
+    TEST_ASSERT_EQUAL(NUM_HA_ENTITIES, fake_mqtt_stats.num_messages);
+    TEST_ASSERT_EQUAL_STRING("homeassistant/binary_sensor/therm-test_fan/config", fake_mqtt_last_topic);
+    TEST_ASSERT_EQUAL_STRING("", fake_mqtt_last_payload);
+    TEST_ASSERT_TRUE(fake_mqtt_last_retained);
+    TEST_ASSERT_EQUAL_HEX32(hash, read_ha_discovery_hash());
+
+    fake_mqtt_stats = {};
+    announce_devices_to_homeassistant(false);
+    TEST_ASSERT_EQUAL(0, fake_mqtt_stats.num_messages);
+
+    // and back
+    therm_conf.relays_available = true;
+    announce_devices_to_homeassistant(false);
+    TEST_ASSERT_EQUAL(NUM_HA_ENTITIES, fake_mqtt_stats.num_messages);
+    TEST_ASSERT_NOT_EQUAL(0, strlen(fake_mqtt_last_payload));
+    TEST_ASSERT_EQUAL_HEX32(hash_before, read_ha_discovery_hash());
+}
+
+// HA restarted and lost the configs: its birth message gets them all again, whatever the hash says, within the
+// jitter that keeps every unit from answering at once
+void test_ha_birth_message()
+{
+    // only the task the birth message schedules runs
+    sched.remove_task<mqtt_connect>(0);
+    sched.remove_task<mqtt_update_task>(0);
+    sched.remove_task<send_mqtt_sched_stats>(0);
+    TEST_ASSERT_EQUAL(0, sched.get_num_tasks());
+
+    fake_mqtt_stats = {};
+    mqtt_client.fake_receive("homeassistant/status", "offline");
+    TEST_ASSERT_EQUAL(0, sched.get_num_tasks());
+
+    uint32_t hash = read_ha_discovery_hash();
+    uint64_t start_us = fake_micros;
+    mqtt_client.fake_receive("homeassistant/status", "online");
+    TEST_ASSERT_EQUAL(1, sched.get_num_tasks());
+    while (sched.get_num_tasks() && fake_micros - start_us <= US_FROM_MS(HA_DISCOVERY_JITTER_MS))
+    {
+        TEST_ASSERT_EQUAL(0, fake_mqtt_stats.num_messages);
+        fake_advance_us(US_FROM_MS(LOOP_PASS_MS));
+        sched.run(0);
+    }
+    TEST_ASSERT_EQUAL(0, sched.get_num_tasks());
+    TEST_ASSERT_EQUAL(NUM_HA_ENTITIES, fake_mqtt_stats.num_messages);
+    TEST_ASSERT_TRUE(fake_mqtt_last_retained);
+    TEST_ASSERT_EQUAL_HEX32(hash, read_ha_discovery_hash());
+}
+
+int main(int, char **)
+{
+    fake_micros = US_FROM_MS(1000);
+    therm_conf.host = "therm-test";
+    therm_conf.mqtt_server = "broker";
+    therm_conf.relays_available = true;
+    therm_state.cur_temp = 68.4f;
+    therm_state.cur_temp_rate = 0.5f;
+    therm_state.cur_hum = 41.0f;
+    therm_state.tgt_temp = 70.0f;
+
+    init_mqtt();
+    write_ha_discovery_hash(hash_ha_discovery()); // announced on an earlier boot
+    mqtt_connect();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_publish_costs);
+    RUN_TEST(test_publish_no_allocations);
+    RUN_TEST(test_compact_payloads);
+    RUN_TEST(test_mqtt_stats);
+    RUN_TEST(test_ha_discovery_unchanged);
+    RUN_TEST(test_ha_discovery_changed);
+    RUN_TEST(test_ha_birth_message);
+    return UNITY_END();
+}
@@ -0,0 +1,129 @@
+// the dew point table against the formula it stands for: dew_point() over the range the thermostat sees, next to the
+// Magnus formula with the same coefficients in double precision. Reported per humidity band: the ln(RH) table is
+// exact at whole percents and approximates in between, which is hardest where ln(RH) bends the most (dry air).
+// Also the cost of one call against the float formula:
+//   pio test -e native -f test_psychro -v
+
+#include <unity.h>
+#include <chrono>
+
+#include <Arduino.h>
+#include "../../src/psychro.cc"
+
+#define MIN_TEMP_F -20
+#define MAX_TEMP_F 120
+#define TEMP_STEP_F 0.25f
+#define HUM_STEP 0.125f // %RH, between the table's whole percents too
+#define BENCH_PASSES 20
+
+// Magnus, Sonntag 1990 over water: what ln_rh_table and MAGNUS_* are made from
+double magnus_dew_point_f(double temp_f, double hum)
+{
+    double temp_c = (temp_f - 32) * 5 / 9;
+    double gamma = log(hum / 100) + 17.62 * temp_c / (243.12 + temp_c);
+    return 243.12 * gamma / (17.62 - gamma) * 9 / 5 + 32;
+}
+
+struct band_t
+{
+    float min_hum, max_hum;
+    float max_error; // F
+    float error, rms, worst_temp, worst_hum; // measured
+};
+
+// psychro.h promises 0.05 F
+band_t bands[] = {
+    {1, 5, 0.05f},
+    {5, 100, 0.05f},
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_ln_rh_table()
+{
+    // whole percents are the table itself, within its Q12 rounding
+    for (int hum = 1; hum <= 100; hum++)
+        TEST_ASSERT_INT_WITHIN(1, lround(log(hum / 100.0) * 4096), ln_rh_q12(Q8_FROM_INT(hum)));
+}
+
+void test_dew_point_accuracy()
+{
+    printf("%%RH        max error F  rms F  at F    at %%RH  bound F\n");
+    for (band_t &band : bands)
+    {
+        double sum_sq = 0;
+        int num = 0;
+        for (float hum = band.min_hum; hum <= band.max_hum; hum += HUM_STEP)
+        {
+            for (float temp = MIN_TEMP_F; temp <= MAX_TEMP_F; temp += TEMP_STEP_F)
+            {
+                // what the integer version is given, Q8
+                q8_t temp_q8 = Q8_FROM_FLOAT(temp), hum_q8 = Q8_FROM_FLOAT(hum);
+                float error = Q8_TO_FLOAT(dew_point(temp_q8, hum_q8)) -
+                              magnus_dew_point_f(Q8_TO_FLOAT(temp_q8), Q8_TO_FLOAT(hum_q8));
+                sum_sq += error * error;
+                ++num;
+                if (fabsf(error) > band.error)
+                {
+                    band.error = fabsf(error);
+                    band.worst_temp = temp;
+                    band.worst_hum = hum;
+                }
+            }
+        }
+        band.rms = sqrt(sum_sq / num);
+        printf("%3.0f..%-3.0f  %11.3f  %5.3f  %6.2f  %6.3f  %7.2f\n", band.min_hum, band.max_hum, band.error, band.rms,
+               band.worst_temp, band.worst_hum, band.max_error);
+    }
+    for (const band_t &band : bands)
+        TEST_ASSERT_TRUE(band.error < band.max_error);
+}
+
+void test_bench_dew_point()
+{
+    volatile int32_t sink = 0;
+    volatile float float_sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    int num = 0;
+    for (int pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        for (int hum = 1; hum <= 100; hum++)
+        {
+            for (int temp = MIN_TEMP_F; temp <= MAX_TEMP_F; temp++)
+            {
+                sink = sink + dew_point(Q8_FROM_INT(temp), Q8_FROM_INT(hum));
+                ++num;
+            }
+        }
+    }
+    double table_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / num;
+
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        for (int hum = 1; hum <= 100; hum++)
+        {
+            for (int temp = MIN_TEMP_F; temp <= MAX_TEMP_F; temp++)
+            {
+                float temp_c = (temp - 32) * 5 / 9.0f;
+                float gamma = logf(hum / 100.0f) + 17.62f * temp_c / (243.12f + temp_c);
+                float_sink = float_sink + 243.12f * gamma / (17.62f - gamma);
+            }
+        }
+    }
+    double float_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / num;
+    // the host has an FPU, the ESP8266 doesn't: this only shows the table isn't the slow part
+    printf("dew_point: %.1f ns per call, float formula %.1f ns (host), table %u bytes\n", table_ns, float_ns,
+           (unsigned)sizeof(ln_rh_table));
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_ln_rh_table);
+    RUN_TEST(test_dew_point_accuracy);
+    RUN_TEST(test_bench_dew_point);
+    return UNITY_END();
+}
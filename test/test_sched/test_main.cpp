@@ -0,0 +1,134 @@
+// scheduler timebase: periodic tasks keep their nominal deadlines across the 32-bit micros() (~71.6 min) and
+// millis() (~49.7 day) wraps, don't drift when they run late, and skip deadlines instead of bursting after a stall.
+// the simulated clock is fast-forwarded to just before each wrap
+
+#include <unity.h>
+
+#include "../../src/tasks.cc"
+
+#define LOOP_PASS_US 100 // what every pass of the loop costs, so that time moves while nothing sleeps
+#define MICROS_WRAP_US (1ULL << 32)
+#define MILLIS_WRAP_US ((1ULL << 32) * 1000)
+
+int num_runs = 0;
+uint64_t run_ts[64];
+uint32_t task_busy_us = 0; // how long each run of periodic_task takes
+
+void periodic_task()
+{
+    if (num_runs < 64)
+        run_ts[num_runs] = get_ts();
+    ++num_runs;
+    fake_advance_us(task_busy_us);
+}
+
+// the loop, until the simulated clock reaches until_us
+void run_until(scheduler &sched, uint64_t until_us)
+{
+    while (fake_micros < until_us)
+    {
+        sched.run(1000);
+        fake_advance_us(LOOP_PASS_US);
+    }
+}
+
+void setUp()
+{
+    num_runs = 0;
+    task_busy_us = 0;
+}
+
+void tearDown() {}
+
+void check_periodic_across(uint64_t wrap_us, unsigned int period_ms)
+{
+    scheduler sched(8);
+    fake_micros = wrap_us - 5 * US_FROM_MS(period_ms) - 1234;
+    sched_ts_t start_ts = get_ts();
+    sched.add_or_update_task<periodic_task>(0, NULL, 0, period_ms, period_ms);
+
+    run_until(sched, wrap_us + 5 * US_FROM_MS(period_ms));
+
+    // one run per period on either side of the wrap, each on its nominal deadline (give or take one loop pass)
+    TEST_ASSERT_EQUAL(10, num_runs);
+    for (int idx = 0; idx < num_runs; idx++)
+    {
+        sched_ts_t deadline = start_ts + (idx + 1) * US_FROM_MS(period_ms);
+        TEST_ASSERT_GREATER_OR_EQUAL(deadline, run_ts[idx]);
+        TEST_ASSERT_LESS_OR_EQUAL(deadline + LOOP_PASS_US, run_ts[idx]);
+    }
+
+    scheduler::task_timing_t timing;
+    TEST_ASSERT_TRUE(sched.get_task_timing<periodic_task>(0, timing));
+    TEST_ASSERT_EQUAL(10, timing.num_runs);
+    TEST_ASSERT_EQUAL(0, timing.num_overruns);
+    TEST_ASSERT_LESS_OR_EQUAL(LOOP_PASS_US, timing.max_lateness);
+}
+
+void test_periodic_across_micros_wrap()
+{
+    check_periodic_across(MICROS_WRAP_US, 10);
+}
+
+void test_periodic_across_millis_wrap()
+{
+    check_periodic_across(MILLIS_WRAP_US, 1000);
+}
+
+void test_timebase_is_64_bit()
+{
+    fake_micros = MILLIS_WRAP_US + 42;
+    TEST_ASSERT_EQUAL_UINT64(MILLIS_WRAP_US + 42, get_ts());
+    TEST_ASSERT_EQUAL_UINT64((MILLIS_WRAP_US + 42) / 1000, get_ts_ms());
+}
+
+// a task that runs late, or takes a while, still gets rearmed relative to its previous deadline
+void test_rearm_does_not_drift()
+{
+    scheduler sched(8);
+    fake_micros = MICROS_WRAP_US - US_FROM_MS(100);
+    sched_ts_t start_ts = get_ts();
+    task_busy_us = 3000;
+    sched.add_or_update_task<periodic_task>(0, NULL, 0, 10, 10);
+
+    run_until(sched, start_ts + US_FROM_MS(500) + 1);
+
+    TEST_ASSERT_EQUAL(50, num_runs);
+    TEST_ASSERT_LESS_OR_EQUAL(start_ts + US_FROM_MS(500) + LOOP_PASS_US, run_ts[49]);
+}
+
+// after a stall, the missed deadlines are skipped and counted rather than run back to back
+void test_stall_skips_deadlines()
+{
+    scheduler sched(8);
+    fake_micros = MILLIS_WRAP_US - US_FROM_MS(25);
+    sched_ts_t start_ts = get_ts();
+    sched.add_or_update_task<periodic_task>(0, NULL, 0, 10, 10);
+
+    run_until(sched, start_ts + US_FROM_MS(15));
+    TEST_ASSERT_EQUAL(1, num_runs);
+
+    // the loop is blocked for 55 ms, until 70 ms
+    fake_advance_us(US_FROM_MS(55));
+    run_until(sched, start_ts + US_FROM_MS(95));
+
+    // one late run for the deadline at 20 ms, 30..70 ms are skipped, then 80 and 90 on time
+    TEST_ASSERT_EQUAL(4, num_runs);
+    scheduler::task_timing_t timing;
+    TEST_ASSERT_TRUE(sched.get_task_timing<periodic_task>(0, timing));
+    TEST_ASSERT_EQUAL(5, timing.num_overruns);
+    TEST_ASSERT_GREATER_OR_EQUAL(US_FROM_MS(50), timing.max_lateness);
+    TEST_ASSERT_GREATER_OR_EQUAL(start_ts + US_FROM_MS(80), run_ts[2]);
+    TEST_ASSERT_LESS_OR_EQUAL(start_ts + US_FROM_MS(80) + LOOP_PASS_US, run_ts[2]);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_timebase_is_64_bit);
+    RUN_TEST(test_periodic_across_micros_wrap);
+    RUN_TEST(test_periodic_across_millis_wrap);
+    RUN_TEST(test_rearm_does_not_drift);
+    RUN_TEST(test_stall_skips_deadlines);
+    return UNITY_END();
+}
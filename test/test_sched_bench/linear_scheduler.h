@@ -0,0 +1,168 @@
+#ifndef __LINEAR_SCHEDULER_H__
+#define __LINEAR_SCHEDULER_H__
+
+#include <arduino.h>
+
+// the scheduler before the deadline heap, kept as the baseline for the benchmark: a task array sorted by priority,
+// linear lookups and memmove reshuffles, and a run() that looks at every task on every pass
+class linear_scheduler
+{
+    struct task_t
+    {
+        void *func_ptr;
+        int id;
+        void *params;
+        int priority;
+
+        unsigned long next_ts;
+        unsigned int period;
+    };
+
+    task_t *tasks;
+    int num_tasks = 0, max_tasks;
+
+    int find_task(void *func, int id)
+    {
+        for (int i = 0; i < num_tasks; i++)
+        {
+            if (tasks[i].id == id && tasks[i].func_ptr == func)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void update_task(int task_idx, void *params, int priority, unsigned int period, unsigned int start_delay)
+    {
+        tasks[task_idx].params = params;
+        tasks[task_idx].period = period;
+        tasks[task_idx].priority = priority;
+        tasks[task_idx].next_ts = millis() + start_delay;
+
+        int direction_to_move = -1;
+        if ((task_idx == 0) || (tasks[task_idx - 1].priority <= priority))
+            direction_to_move = 0;
+
+        if (direction_to_move == 0)
+        {
+            if (task_idx < num_tasks - 1 && tasks[task_idx + 1].priority < priority)
+                direction_to_move = 1;
+        }
+
+        if (direction_to_move != 0)
+        {
+            int target_position = -1;
+            int other_task_idx = task_idx + direction_to_move;
+            for (; other_task_idx >= 0 && other_task_idx < num_tasks; other_task_idx += direction_to_move)
+            {
+                if ((tasks[other_task_idx].priority - priority) * direction_to_move >= 0)
+                {
+                    target_position = other_task_idx - direction_to_move;
+                    break;
+                }
+            }
+            if (other_task_idx < 0)
+            {
+                target_position = 0;
+            }
+            else if (other_task_idx == num_tasks)
+            {
+                target_position = num_tasks - 1;
+            }
+
+            task_t temp = tasks[task_idx];
+            if (direction_to_move > 0)
+            {
+                memmove(&tasks[task_idx], &tasks[task_idx + 1], (target_position - task_idx) * sizeof(task_t));
+            }
+            else
+            {
+                memmove(&tasks[target_position + 1], &tasks[target_position], (task_idx - target_position) * sizeof(task_t));
+            }
+            tasks[target_position] = temp;
+        }
+    }
+
+    void rearm_task(int task_idx)
+    {
+        tasks[task_idx].next_ts = millis() + tasks[task_idx].period;
+    }
+
+    bool remove_task(int task_idx)
+    {
+        if (task_idx >= 0 && task_idx < num_tasks)
+        {
+            memmove(&tasks[task_idx], &tasks[task_idx + 1], (num_tasks - task_idx - 1) * sizeof(task_t));
+            --num_tasks;
+            return true;
+        }
+        return false;
+    }
+
+public:
+    linear_scheduler(int max_tasks)
+    {
+        this->max_tasks = max_tasks;
+        tasks = new task_t[max_tasks];
+    }
+
+    ~linear_scheduler()
+    {
+        delete[] tasks;
+    }
+
+    bool add_or_update_task(void *func, int id, void *params, int priority, unsigned int period, unsigned int start_delay)
+    {
+        if (num_tasks >= max_tasks)
+            return false;
+
+        int task_idx = find_task(func, id);
+        if (task_idx < 0)
+        {
+            task_idx = num_tasks++;
+            tasks[task_idx].func_ptr = func;
+            tasks[task_idx].id = id;
+        }
+        update_task(task_idx, params, priority, period, start_delay);
+        return true;
+    }
+
+    bool remove_task(void *func, int id)
+    {
+        if (num_tasks == 0)
+            return false;
+        return remove_task(find_task(func, id));
+    }
+
+    void run(int notask_delay)
+    {
+        unsigned long ts = millis();
+        int num_tasks_run = 0;
+        for (int task_idx = 0; task_idx < num_tasks; task_idx++)
+        {
+            auto task = tasks[task_idx];
+            if (task.next_ts <= ts)
+            {
+                ((void (*)(void *))task.func_ptr)(task.params);
+
+                auto task2 = tasks[task_idx];
+                if (task.func_ptr == task2.func_ptr && task.id == task2.id && task.next_ts == task2.next_ts)
+                {
+                    if (task.period > 0)
+                        rearm_task(task_idx);
+                    else
+                        remove_task(task_idx);
+                }
+                yield();
+                ++num_tasks_run;
+            }
+        }
+        if (num_tasks_run == 0)
+        {
+            delay(notask_delay);
+        }
+    }
+};
+
+#endif // __LINEAR_SCHEDULER_H__
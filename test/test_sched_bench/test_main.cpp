@@ -0,0 +1,181 @@
+// scheduler microbenchmark: the deadline heap against the linear task table it replaced, at 20, 100 and 1000 tasks.
+// timings are host nanoseconds, so only the ratios carry over to the ESP8266. See the numbers with
+//   pio test -e native -f test_sched_bench -v
+
+#include <unity.h>
+#include <chrono>
+
+#include "../../src/tasks.cc"
+#include "linear_scheduler.h"
+
+#define BENCH_OPS 20000        // add / update / remove operations timed per configuration
+#define BENCH_IDLE_PASSES 20000 // run() passes with nothing due
+#define BENCH_BUSY_SECONDS 10   // simulated time, in 1 ms passes, with tasks coming due
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct bench_result_t
+{
+    double add_ns, update_ns, remove_ns; // per operation
+    double idle_pass_ns, busy_pass_ns;   // per run()
+    uint32_t task_runs;
+};
+
+uint32_t bench_task_runs = 0;
+
+void bench_task(void *)
+{
+    ++bench_task_runs;
+}
+
+double elapsed_ns(bench_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+// a spread of periods (50 ms .. 5 s) and priorities, the same for both schedulers
+unsigned int bench_period(int id)
+{
+    return 50 + (id * 7919) % 4950;
+}
+
+void setUp()
+{
+    fake_micros = 0;
+    bench_task_runs = 0;
+}
+
+void tearDown() {}
+
+template <typename Add, typename Remove, typename Run>
+bench_result_t bench(int num_tasks, Add add, Remove remove, Run run)
+{
+    bench_result_t result = {};
+    int rounds = max(1, BENCH_OPS / num_tasks);
+
+    double add_ns = 0, update_ns = 0, remove_ns = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        auto start = bench_clock::now();
+        for (int id = 0; id < num_tasks; id++)
+            add(id);
+        add_ns += elapsed_ns(start);
+
+        start = bench_clock::now();
+        for (int id = 0; id < num_tasks; id++)
+            add(id);
+        update_ns += elapsed_ns(start);
+
+        start = bench_clock::now();
+        for (int id = 0; id < num_tasks; id++)
+            remove(id);
+        remove_ns += elapsed_ns(start);
+    }
+    result.add_ns = add_ns / rounds / num_tasks;
+    result.update_ns = update_ns / rounds / num_tasks;
+    result.remove_ns = remove_ns / rounds / num_tasks;
+
+    for (int id = 0; id < num_tasks; id++)
+        add(id);
+
+    // every deadline is at least 50 ms out: the loop only has to find out that nothing is due
+    auto start = bench_clock::now();
+    for (int pass = 0; pass < BENCH_IDLE_PASSES; pass++)
+        run();
+    result.idle_pass_ns = elapsed_ns(start) / BENCH_IDLE_PASSES;
+
+    bench_task_runs = 0;
+    start = bench_clock::now();
+    for (int pass = 0; pass < BENCH_BUSY_SECONDS * 1000; pass++)
+    {
+        fake_advance_us(1000);
+        run();
+    }
+    result.busy_pass_ns = elapsed_ns(start) / (BENCH_BUSY_SECONDS * 1000);
+    result.task_runs = bench_task_runs;
+
+    for (int id = 0; id < num_tasks; id++)
+        remove(id);
+    return result;
+}
+
+bench_result_t bench_heap(int num_tasks)
+{
+    scheduler heap_sched(INITIAL_NUM_TASKS);
+    return bench(
+        num_tasks,
+        [&](int id)
+        { heap_sched.add_or_update_task<bench_task>(id, NULL, id % 4, bench_period(id), bench_period(id)); },
+        [&](int id)
+        { heap_sched.remove_task<bench_task>(id); },
+        [&]()
+        { heap_sched.run(0); });
+}
+
+bench_result_t bench_linear(int num_tasks)
+{
+    linear_scheduler linear_sched(num_tasks + 1);
+    return bench(
+        num_tasks,
+        [&](int id)
+        { linear_sched.add_or_update_task((void *)bench_task, id, NULL, id % 4, bench_period(id), bench_period(id)); },
+        [&](int id)
+        { linear_sched.remove_task((void *)bench_task, id); },
+        [&]()
+        { linear_sched.run(0); });
+}
+
+void print_result(int num_tasks, const char *name, const bench_result_t &result)
+{
+    printf("%5d  %-6s  %8.1f  %9.1f  %9.1f  %12.1f  %12.1f  %9u\n", num_tasks, name, result.add_ns, result.update_ns,
+           result.remove_ns, result.idle_pass_ns, result.busy_pass_ns, result.task_runs);
+}
+
+// at 100 tasks a pass is already cheaper with the heap, lookups only pull ahead further up
+void bench_size(int num_tasks, bool expect_faster_passes, bool expect_faster_ops)
+{
+    bench_result_t heap_result = bench_heap(num_tasks);
+    bench_result_t linear_result = bench_linear(num_tasks);
+    print_result(num_tasks, "heap", heap_result);
+    print_result(num_tasks, "linear", linear_result);
+
+    // both ran the same workload. The heap keeps periodic tasks on their nominal deadlines, the linear one
+    // rearms from whenever a task ran, so the counts differ a little
+    TEST_ASSERT_FLOAT_WITHIN(0.05 * linear_result.task_runs, linear_result.task_runs, heap_result.task_runs);
+    if (expect_faster_passes)
+    {
+        TEST_ASSERT_LESS_THAN(linear_result.idle_pass_ns, heap_result.idle_pass_ns);
+        TEST_ASSERT_LESS_THAN(linear_result.busy_pass_ns, heap_result.busy_pass_ns);
+    }
+    if (expect_faster_ops)
+    {
+        TEST_ASSERT_LESS_THAN(linear_result.add_ns, heap_result.add_ns);
+        TEST_ASSERT_LESS_THAN(linear_result.update_ns, heap_result.update_ns);
+        TEST_ASSERT_LESS_THAN(linear_result.remove_ns, heap_result.remove_ns);
+    }
+}
+
+void test_bench_20_tasks()
+{
+    bench_size(20, false, false);
+}
+
+void test_bench_100_tasks()
+{
+    bench_size(100, true, false);
+}
+
+void test_bench_1000_tasks()
+{
+    bench_size(1000, true, true);
+}
+
+int main()
+{
+    printf("tasks  impl      add ns  update ns  remove ns  idle pass ns  1 ms pass ns  task runs\n");
+    UNITY_BEGIN();
+    RUN_TEST(test_bench_20_tasks);
+    RUN_TEST(test_bench_100_tasks);
+    RUN_TEST(test_bench_1000_tasks);
+    return UNITY_END();
+}
@@ -0,0 +1,116 @@
+// CPU duty cycle of the main loop: the firmware's steady-state task set on the real scheduler and the simulated
+// clock, once with the old spinning loop() (run(0)) and once with the tickless one (run(MAX_IDLE_MS)).
+// delay() advances the clock and counts the time as idle, everything else is CPU time. The cost of each task is a
+// model of its work at 160 MHz, not a measurement; the periods and slacks are the ones the modules register.
+// See the numbers with
+//   pio test -e native -f test_sched_idle -v
+
+#include <unity.h>
+
+#include "../../src/tasks.cc"
+
+#define MAX_IDLE_MS 1000          // as in main.cpp
+#define LOOP_PASS_US 3            // loop() -> run() and back through the core, with nothing due
+#define SIM_SECONDS 120           // simulated time per configuration
+#define TICKLESS_MAX_DUTY_PCT 2.5 // what the tickless loop has to stay under
+
+// modelled CPU time of one run of each task, in us
+struct sim_task_t
+{
+    const char *name;
+    unsigned int period_ms, slack_ms;
+    uint32_t cost_us;
+};
+
+const sim_task_t sim_tasks[] = {
+    {"mqtt_update_task", 20, 10, 40},             // PubSubClient::loop() with nothing received
+    {"web_server_handle_client_task", 20, 10, 25}, // no client waiting
+    {"refresh_display", 40, 20, 350},              // render into the framebuffer, frame unchanged most of the time
+    {"mdns_update_task", 100, 50, 60},
+    {"knob_rotate_handler_task", 100, 50, 5},
+    {"sensor_read_task", 5000, 1000, 2500},        // shortest adaptive period; the conversion wait is a coroutine sleep
+    {"stall_check_task", 5000, 5000, 10},
+    {"monitor_local_mode_temperature", 10000, 2000, 80},
+    {"circulation_watcher_task", 60000, 10000, 20},
+    {"send_mqtt_sched_stats", 60000, 10000, 3000},
+    {"history_sample_task", 120000, 10000, 150},
+};
+#define NUM_SIM_TASKS (sizeof(sim_tasks) / sizeof(sim_tasks[0]))
+
+uint32_t sim_task_runs = 0;
+
+void sim_task(const sim_task_t *task)
+{
+    ++sim_task_runs;
+    fake_advance_us(task->cost_us);
+}
+
+struct duty_result_t
+{
+    double duty_pct;      // share of wall time the CPU was not idling
+    double passes_per_s;  // calls to run()
+    double wakeups_per_s; // passes that ran at least one task
+    uint32_t task_runs;
+};
+
+duty_result_t simulate(unsigned int max_idle_ms)
+{
+    scheduler sched(32);
+    sim_task_runs = 0;
+    fake_micros = 1000000;
+    fake_delayed_us = 0;
+    for (unsigned int idx = 0; idx < NUM_SIM_TASKS; idx++)
+    {
+        const sim_task_t &task = sim_tasks[idx];
+        sched.add_or_update_task<sim_task>(idx, &task, 0, task.period_ms, 0, task.slack_ms);
+    }
+
+    uint64_t start_us = fake_micros;
+    uint64_t end_us = start_us + US_FROM_MS(SIM_SECONDS * 1000);
+    while (fake_micros < end_us)
+    {
+        sched.run(max_idle_ms);
+        fake_advance_us(LOOP_PASS_US);
+    }
+
+    double elapsed_us = fake_micros - start_us;
+    duty_result_t result;
+    result.duty_pct = 100.0 * (elapsed_us - fake_delayed_us) / elapsed_us;
+    result.passes_per_s = sched.get_num_runs() * 1e6 / elapsed_us;
+    result.wakeups_per_s = sched.get_num_wakeups() * 1e6 / elapsed_us;
+    result.task_runs = sim_task_runs;
+    return result;
+}
+
+void print_result(const char *name, const duty_result_t &result)
+{
+    printf("%-10s  %8.2f  %12.0f  %10.1f  %9u\n", name, result.duty_pct, result.passes_per_s, result.wakeups_per_s, result.task_runs);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_tickless_idle_duty_cycle()
+{
+    duty_result_t spinning = simulate(0);
+    duty_result_t tickless = simulate(MAX_IDLE_MS);
+
+    printf("loop        duty %%  run() calls/s  wakeups/s  task runs\n");
+    print_result("run(0)", spinning);
+    print_result("run(1000)", tickless);
+
+    // the same work gets done, within the slack that lets tasks ride along with each other
+    TEST_ASSERT_UINT32_WITHIN(spinning.task_runs / 50, spinning.task_runs, tickless.task_runs);
+    TEST_ASSERT_TRUE(spinning.duty_pct > 99.0);
+    TEST_ASSERT_TRUE(tickless.duty_pct < TICKLESS_MAX_DUTY_PCT);
+    // no more loop passes than there are deadlines to meet, give or take the sub-ms remainders
+    TEST_ASSERT_TRUE(tickless.passes_per_s < 4 * tickless.wakeups_per_s);
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_tickless_idle_duty_cycle);
+    return UNITY_END();
+}
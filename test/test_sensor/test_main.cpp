@@ -0,0 +1,432 @@
+// the I2C sensor drivers (sht3x.cc, bme280.cc) through sensor_read_coro, against emulated chips on the fake bus:
+// trigger, conversion, polling while the chip is busy, CRC errors, missing or silent chips, waiting for display
+// frames, and the BME280 address probe. BME280 compensation is checked against the datasheet's floating point
+// formulas. Everything runs on the simulated clock:
+//   pio test -e native -f test_sensor -v
+
+#include <unity.h>
+
+#include "../../src/tasks.cc"
+#include "../../src/filter.cc"
+#include "../../src/estimator.cc"
+#include "../../src/sensor.cc"
+#include "../../src/dht11.cc"
+#include "../../src/sht3x.cc"
+#include "../../src/bme280.cc"
+
+#define LOOP_PASS_US 100
+#define READ_LIMIT_MS 200 // a read that takes longer than this is stuck
+
+ThermConfig::ThermConfig() {}
+ThermConfig::~ThermConfig() {}
+ThermConfig therm_conf;
+ThermState therm_state;
+
+bool disp_flushing = false;
+bool is_disp_flushing()
+{
+    return disp_flushing;
+}
+
+void send_mqtt_state_cur_temp() {}
+
+// SHT3x: a measure command starts a conversion; reads are NACKed until it is done, then return it once
+class fake_sht3x_t : public fake_i2c_device_t
+{
+public:
+    uint16_t raw_temp = 0x6666, raw_hum = 0x8000;
+    uint32_t conversion_us = 12500; // typical at high repeatability
+    bool corrupt_crc = false;
+    bool measuring = false;
+    uint64_t ready_us = 0;
+    int num_measure_commands = 0, num_resets = 0;
+
+    bool on_write(const uint8_t *data, size_t len, bool) override
+    {
+        if (len != 2)
+            return false;
+        uint16_t command = data[0] << 8 | data[1];
+        if (command == SHT3X_CMD_MEASURE)
+        {
+            ++num_measure_commands;
+            measuring = true;
+            ready_us = fake_micros + conversion_us;
+        }
+        else if (command == SHT3X_CMD_SOFT_RESET)
+        {
+            ++num_resets;
+            measuring = false;
+        }
+        return true;
+    }
+
+    size_t on_read(uint8_t *data, size_t len) override
+    {
+        if (!measuring || fake_micros < ready_us || len < 6)
+            return 0;
+        measuring = false;
+        uint8_t frame[6] = {(uint8_t)(raw_temp >> 8), (uint8_t)raw_temp, 0, (uint8_t)(raw_hum >> 8), (uint8_t)raw_hum, 0};
+        frame[2] = sht3x_crc(frame, 2) ^ (corrupt_crc ? 0x01 : 0);
+        frame[5] = sht3x_crc(frame + 3, 2);
+        memcpy(data, frame, sizeof(frame));
+        return sizeof(frame);
+    }
+};
+
+// BME280: a register file. A write sets the register pointer and writes the registers after it; a read goes on
+// from the pointer. Writing forced mode to ctrl_meas measures for conversion_us, with the status bit set meanwhile
+class fake_bme280_t : public fake_i2c_device_t
+{
+    uint8_t pointer = 0;
+    uint64_t ready_us = 0;
+
+    void finish_measurement()
+    {
+        if (!(regs[BME280_REG_STATUS] & BME280_STATUS_MEASURING) || fake_micros < ready_us)
+            return;
+        regs[BME280_REG_STATUS] &= ~BME280_STATUS_MEASURING;
+        regs[BME280_REG_CTRL_MEAS] &= ~0x03; // back to sleep
+        regs[0xFA] = adc_T >> 12;
+        regs[0xFB] = adc_T >> 4;
+        regs[0xFC] = adc_T << 4;
+        regs[0xFD] = adc_H >> 8;
+        regs[0xFE] = adc_H;
+    }
+
+public:
+    uint8_t regs[256] = {};
+    int32_t adc_T = 519888, adc_H = 30000;
+    uint32_t conversion_us = 5500;
+    int num_forced = 0;
+
+    fake_bme280_t(uint8_t chip_id = BME280_CHIP_ID)
+    {
+        regs[BME280_REG_CHIP_ID] = chip_id;
+        // dig_T1..3 from the datasheet's example, dig_H1..6 as read off a module
+        const uint16_t dig_T1 = 27504;
+        const int16_t dig_T2 = 26435, dig_T3 = -1000;
+        const uint8_t dig_H1 = 75, dig_H3 = 0;
+        const int16_t dig_H2 = 370, dig_H4 = 313, dig_H5 = 50;
+        const int8_t dig_H6 = 30;
+        uint8_t *calib = regs + BME280_REG_CALIB_T_P;
+        calib[0] = (uint8_t)dig_T1;
+        calib[1] = dig_T1 >> 8;
+        calib[2] = (uint8_t)dig_T2;
+        calib[3] = dig_T2 >> 8;
+        calib[4] = (uint8_t)dig_T3;
+        calib[5] = dig_T3 >> 8;
+        regs[BME280_REG_CALIB_H1] = dig_H1;
+        calib = regs + BME280_REG_CALIB_H;
+        calib[0] = (uint8_t)dig_H2;
+        calib[1] = dig_H2 >> 8;
+        calib[2] = dig_H3;
+        calib[3] = dig_H4 >> 4;
+        calib[4] = (dig_H4 & 0x0F) | (dig_H5 & 0x0F) << 4;
+        calib[5] = dig_H5 >> 4;
+        calib[6] = dig_H6;
+        regs[0xFA] = 0x80; // adc_T reads "skipped" until the first measurement
+    }
+
+    bool on_write(const uint8_t *data, size_t len, bool) override
+    {
+        if (len == 0)
+            return true;
+        pointer = data[0];
+        for (size_t pos = 1; pos < len; pos++, pointer++)
+        {
+            regs[pointer] = data[pos];
+            if (pointer == BME280_REG_CTRL_MEAS && (data[pos] & 0x03) == 0x01)
+            {
+                ++num_forced;
+                regs[BME280_REG_STATUS] |= BME280_STATUS_MEASURING;
+                ready_us = fake_micros + conversion_us;
+            }
+        }
+        return true;
+    }
+
+    size_t on_read(uint8_t *data, size_t len) override
+    {
+        finish_measurement();
+        for (size_t pos = 0; pos < len; pos++)
+            data[pos] = regs[(uint8_t)(pointer + pos)];
+        pointer += len;
+        return len;
+    }
+
+    // the datasheet's double precision compensation (section 8.1), C and %RH
+    void reference(double &temp, double &hum)
+    {
+        const uint8_t *calib = regs + BME280_REG_CALIB_T_P;
+        double dig_T1 = (uint16_t)(calib[1] << 8 | calib[0]), dig_T2 = (int16_t)(calib[3] << 8 | calib[2]),
+               dig_T3 = (int16_t)(calib[5] << 8 | calib[4]);
+        double var1 = (adc_T / 16384.0 - dig_T1 / 1024.0) * dig_T2;
+        double var2 = (adc_T / 131072.0 - dig_T1 / 8192.0) * (adc_T / 131072.0 - dig_T1 / 8192.0) * dig_T3;
+        double t_fine = (int32_t)(var1 + var2);
+        temp = (var1 + var2) / 5120.0;
+
+        calib = regs + BME280_REG_CALIB_H;
+        double dig_H1 = regs[BME280_REG_CALIB_H1], dig_H2 = (int16_t)(calib[1] << 8 | calib[0]), dig_H3 = calib[2],
+               dig_H4 = (int16_t)((int8_t)calib[3] * 16 | (calib[4] & 0x0F)),
+               dig_H5 = (int16_t)((int8_t)calib[5] * 16 | calib[4] >> 4), dig_H6 = (int8_t)calib[6];
+        double var_H = t_fine - 76800.0;
+        var_H = (adc_H - (dig_H4 * 64.0 + dig_H5 / 16384.0 * var_H)) *
+                (dig_H2 / 65536.0 * (1.0 + dig_H6 / 67108864.0 * var_H * (1.0 + dig_H3 / 67108864.0 * var_H)));
+        var_H = var_H * (1.0 - dig_H1 * var_H / 524288.0);
+        hum = constrain(var_H, 0.0, 100.0);
+    }
+};
+
+fake_sht3x_t sht3x;
+fake_bme280_t bme280, bme280_alt, bmp280(0x58);
+
+void use_driver(uint8_t sensor_type)
+{
+    therm_conf.sensor_type = sensor_type;
+    setup_sensor();
+    // reads are started by the tests
+    sched.remove_task<sensor_read_task>(0);
+}
+
+// one read, from the trigger to the coroutine finishing. Returns how long it took
+uint32_t read_once()
+{
+    uint64_t start_us = fake_micros, limit_us = fake_micros + US_FROM_MS(READ_LIMIT_MS);
+    sensor_read_task();
+    do
+    {
+        sched.run(0);
+        fake_advance_us(LOOP_PASS_US);
+    } while (sensor_read_frame.line != 0 && fake_micros < limit_us);
+    TEST_ASSERT_EQUAL(0, sensor_read_frame.line);
+    // a reading adapts the read period, which reschedules the periodic read
+    sched.remove_task<sensor_read_task>(0);
+    return fake_micros - start_us;
+}
+
+void setUp()
+{
+    memset(fake_i2c_devices, 0, sizeof(fake_i2c_devices));
+    sensor_stats = {};
+    sensor_read_frame.reading = {};
+    disp_flushing = false;
+    sht3x = fake_sht3x_t();
+    bme280 = fake_bme280_t();
+    bme280_alt = fake_bme280_t();
+}
+
+void tearDown() {}
+
+// the datasheet's example: 0xBEEF has the CRC 0x92
+void test_sht3x_crc()
+{
+    const uint8_t data[] = {0xBE, 0xEF};
+    TEST_ASSERT_EQUAL_HEX8(0x92, sht3x_crc(data, 2));
+}
+
+void test_sht3x_read()
+{
+    fake_i2c_attach(SHT3X_I2C_ADDRESS, &sht3x);
+    use_driver(SENSOR_TYPE_SHT3X);
+    TEST_ASSERT_TRUE(sensor_initialized);
+    TEST_ASSERT_EQUAL(1, sht3x.num_resets);
+
+    read_once();
+    TEST_ASSERT_EQUAL(1, sht3x.num_measure_commands);
+    // -45 + 175 * 0x6666 / 65535 = 25.0 C, 100 * 0x8000 / 65535 = 50.0 %RH
+    TEST_ASSERT_INT_WITHIN(1, Q8_FROM_INT(25), sensor_read_frame.reading.temperature);
+    TEST_ASSERT_INT_WITHIN(1, Q8_FROM_INT(50), sensor_read_frame.reading.humidity);
+    TEST_ASSERT_EQUAL(0, get_sensor_stats().num_timeouts + get_sensor_stats().num_checksum_errors);
+}
+
+// converting for longer than conversion_ms: the read is NACKed and polled again every poll_ms
+void test_sht3x_slow_conversion()
+{
+    fake_i2c_attach(SHT3X_I2C_ADDRESS, &sht3x);
+    use_driver(SENSOR_TYPE_SHT3X);
+    sht3x.conversion_us = US_FROM_MS(SHT3X_CONVERSION_MS + 3);
+
+    uint32_t nacks_before = fake_i2c_stats.num_nacks;
+    uint32_t read_us = read_once();
+    uint32_t num_polls = fake_i2c_stats.num_nacks - nacks_before;
+    TEST_ASSERT_TRUE(num_polls >= 1 && num_polls <= 2);
+    TEST_ASSERT_UINT32_WITHIN(US_FROM_MS(SHT3X_POLL_MS) + 1000, sht3x.conversion_us, read_us);
+    TEST_ASSERT_INT_WITHIN(1, Q8_FROM_INT(25), sensor_read_frame.reading.temperature);
+    TEST_ASSERT_EQUAL(0, get_sensor_stats().num_timeouts);
+}
+
+void test_sht3x_bad_crc()
+{
+    fake_i2c_attach(SHT3X_I2C_ADDRESS, &sht3x);
+    use_driver(SENSOR_TYPE_SHT3X);
+    sht3x.corrupt_crc = true;
+
+    read_once();
+    TEST_ASSERT_EQUAL(1, get_sensor_stats().num_checksum_errors);
+    TEST_ASSERT_EQUAL(0, sensor_read_frame.reading.temperature);
+}
+
+// a chip that never finishes: given up after timeout_ms
+void test_sht3x_stuck()
+{
+    fake_i2c_attach(SHT3X_I2C_ADDRESS, &sht3x);
+    use_driver(SENSOR_TYPE_SHT3X);
+    sht3x.conversion_us = US_FROM_MS(1000);
+
+    uint32_t read_us = read_once();
+    TEST_ASSERT_EQUAL(1, get_sensor_stats().num_timeouts);
+    TEST_ASSERT_TRUE(read_us >= US_FROM_MS(SHT3X_CONVERSION_MS + SHT3X_TIMEOUT_MS));
+    TEST_ASSERT_TRUE(read_us < US_FROM_MS(SHT3X_CONVERSION_MS + SHT3X_TIMEOUT_MS + 2 * SHT3X_POLL_MS));
+}
+
+// not on the bus: init fails, and every read tries it again and counts a timeout
+void test_sht3x_missing()
+{
+    use_driver(SENSOR_TYPE_SHT3X);
+    TEST_ASSERT_FALSE(sensor_initialized);
+
+    read_once();
+    TEST_ASSERT_EQUAL(1, get_sensor_stats().num_timeouts);
+
+    // plugged in later
+    fake_i2c_attach(SHT3X_I2C_ADDRESS, &sht3x);
+    read_once();
+    TEST_ASSERT_TRUE(sensor_initialized);
+    TEST_ASSERT_EQUAL(1, get_sensor_stats().num_timeouts);
+    TEST_ASSERT_INT_WITHIN(1, Q8_FROM_INT(25), sensor_read_frame.reading.temperature);
+}
+
+// bus transfers wait for the display frame going out
+void test_waits_for_display()
+{
+    fake_i2c_attach(SHT3X_I2C_ADDRESS, &sht3x);
+    use_driver(SENSOR_TYPE_SHT3X);
+
+    disp_flushing = true;
+    uint32_t transactions_before = fake_i2c_stats.num_transactions;
+    sensor_read_task();
+    uint64_t until_us = fake_micros + US_FROM_MS(10);
+    while (fake_micros < until_us)
+    {
+        sched.run(0);
+        fake_advance_us(LOOP_PASS_US);
+    }
+    TEST_ASSERT_EQUAL(transactions_before, fake_i2c_stats.num_transactions);
+    TEST_ASSERT_EQUAL(0, sht3x.num_measure_commands);
+
+    disp_flushing = false;
+    do
+    {
+        sched.run(0);
+        fake_advance_us(LOOP_PASS_US);
+    } while (sensor_read_frame.line != 0);
+    sched.remove_task<sensor_read_task>(0);
+    TEST_ASSERT_EQUAL(1, sht3x.num_measure_commands);
+    TEST_ASSERT_INT_WITHIN(1, Q8_FROM_INT(25), sensor_read_frame.reading.temperature);
+}
+
+// 0x76 first, 0x77 if there is nothing there. The address only changes once a chip answers with the right ID
+void test_bme280_probe()
+{
+    // nothing on the bus
+    bme280_address = BME280_I2C_ADDRESS;
+    TEST_ASSERT_FALSE(bme280_init());
+    TEST_ASSERT_EQUAL_HEX8(BME280_I2C_ADDRESS, bme280_address);
+
+    // SDO high
+    fake_i2c_attach(BME280_I2C_ADDRESS_ALT, &bme280_alt);
+    TEST_ASSERT_TRUE(bme280_init());
+    TEST_ASSERT_EQUAL_HEX8(BME280_I2C_ADDRESS_ALT, bme280_address);
+
+    // rewired to SDO low: the next init finds it at 0x76 again
+    fake_i2c_attach(BME280_I2C_ADDRESS_ALT, NULL);
+    fake_i2c_attach(BME280_I2C_ADDRESS, &bme280);
+    TEST_ASSERT_TRUE(bme280_init());
+    TEST_ASSERT_EQUAL_HEX8(BME280_I2C_ADDRESS, bme280_address);
+
+    // gone: the last address that worked stays
+    fake_i2c_attach(BME280_I2C_ADDRESS, NULL);
+    TEST_ASSERT_FALSE(bme280_init());
+    TEST_ASSERT_EQUAL_HEX8(BME280_I2C_ADDRESS, bme280_address);
+
+    // a BMP280 (no humidity) at 0x76 isn't taken for one, the BME280 at 0x77 is
+    fake_i2c_attach(BME280_I2C_ADDRESS, &bmp280);
+    fake_i2c_attach(BME280_I2C_ADDRESS_ALT, &bme280_alt);
+    TEST_ASSERT_TRUE(bme280_init());
+    TEST_ASSERT_EQUAL_HEX8(BME280_I2C_ADDRESS_ALT, bme280_address);
+}
+
+void test_bme280_read()
+{
+    fake_i2c_attach(BME280_I2C_ADDRESS, &bme280);
+    use_driver(SENSOR_TYPE_BME280);
+    TEST_ASSERT_TRUE(sensor_initialized);
+    TEST_ASSERT_EQUAL_HEX8(BME280_CTRL_HUM_X1, bme280.regs[BME280_REG_CTRL_HUM]);
+
+    // still measuring when the conversion time is up: polled until the status bit clears
+    bme280.conversion_us = US_FROM_MS(BME280_CONVERSION_MS + 3);
+    read_once();
+    TEST_ASSERT_EQUAL(1, bme280.num_forced);
+    TEST_ASSERT_EQUAL(0, get_sensor_stats().num_timeouts);
+
+    double temp, hum;
+    bme280.reference(temp, hum);
+    TEST_ASSERT_INT_WITHIN(4, Q8_FROM_FLOAT(temp), sensor_read_frame.reading.temperature); // 0.01 C + rounding
+    TEST_ASSERT_INT_WITHIN(Q8_ONE / 10, Q8_FROM_FLOAT(hum), sensor_read_frame.reading.humidity);
+}
+
+// the integer compensation against the floating point one, over the range a room gets to
+void test_bme280_compensation()
+{
+    fake_i2c_attach(BME280_I2C_ADDRESS, &bme280);
+    TEST_ASSERT_TRUE(bme280_init());
+    float max_temp_error = 0, max_hum_error = 0;
+    for (int32_t adc_T = 480000; adc_T <= 560000; adc_T += 4000)
+    {
+        for (int32_t adc_H = 20000; adc_H <= 40000; adc_H += 1000)
+        {
+            bme280.adc_T = adc_T;
+            bme280.adc_H = adc_H;
+            sensor_reading_t reading;
+            TEST_ASSERT_TRUE(bme280_trigger());
+            fake_advance_us(bme280.conversion_us);
+            TEST_ASSERT_EQUAL(SENSOR_OK, bme280_collect(reading, false));
+
+            double temp, hum;
+            bme280.reference(temp, hum);
+            max_temp_error = max(max_temp_error, fabsf(Q8_TO_FLOAT(reading.temperature) - (float)temp));
+            max_hum_error = max(max_hum_error, fabsf(Q8_TO_FLOAT(reading.humidity) - (float)hum));
+        }
+    }
+    printf("bme280 compensation against the datasheet's doubles: max error %.3f C, %.3f %%RH\n", max_temp_error, max_hum_error);
+    TEST_ASSERT_TRUE(max_temp_error < 0.015f);
+    TEST_ASSERT_TRUE(max_hum_error < 0.1f);
+}
+
+// a measurement that didn't happen reads as skipped, not as a temperature
+void test_bme280_skipped()
+{
+    fake_i2c_attach(BME280_I2C_ADDRESS, &bme280);
+    TEST_ASSERT_TRUE(bme280_init());
+    sensor_reading_t reading;
+    TEST_ASSERT_EQUAL(SENSOR_BAD_DATA, bme280_collect(reading, false));
+}
+
+int main(int, char **)
+{
+    fake_micros = US_FROM_MS(1000);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_sht3x_crc);
+    RUN_TEST(test_sht3x_read);
+    RUN_TEST(test_sht3x_slow_conversion);
+    RUN_TEST(test_sht3x_bad_crc);
+    RUN_TEST(test_sht3x_stuck);
+    RUN_TEST(test_sht3x_missing);
+    RUN_TEST(test_waits_for_display);
+    RUN_TEST(test_bme280_probe);
+    RUN_TEST(test_bme280_read);
+    RUN_TEST(test_bme280_compensation);
+    RUN_TEST(test_bme280_skipped);
+    return UNITY_END();
+}
@@ -0,0 +1,127 @@
+# generates glyphs.h: the characters the numeric readouts can show, pre-rendered into the SSD1306 memory layout
+# (pages of 8 rows, one byte per column, LSB on top) so the firmware can copy them out of flash as they are.
+# the bitmaps and metrics come straight out of Adafruit GFX's Fonts/FreeMonoBold24pt7b.h and FreeMonoBold12pt7b.h,
+# placed the way GFX's drawChar() places them with the cursor on the baseline, so the cells hold exactly the pixels
+# print() used to draw.
+#
+# runs before every build (extra_scripts in platformio.ini), against the GFX library the environment has installed,
+# and writes the header into the build directory. The native environment also gets the two font headers next to it,
+# so the tests can draw the reference with GFX. By hand, to look at the output:
+#   python tools/gen_glyphs.py ".pio/libdeps/d1_mini/Adafruit GFX Library" > glyphs.h
+
+import os
+import re
+import shutil
+import sys
+
+GLYPH_CHARS = "0123456789?-"
+
+# a glyph set, as laid out on screen: the widget's label takes its first page, the value the pages below it.
+# (prefix of the generated names, GFX font, cell width = the font's advance, cell height in pages, text baseline in
+# rows from the top of the widget)
+GLYPH_SETS = [
+    ("big", "FreeMonoBold24pt7b", 28, 5, 42),  # cur_temp, rows 8..47 of its widget
+    ("small", "FreeMonoBold12pt7b", 14, 3, 26),  # tgt_temp and cur_hum, rows 8..31
+]
+
+
+def read_font(gfx_dir, font):
+    """bitmap bytes, glyphs (offset, width, height, x advance, x offset, y offset) and first char of a GFX font"""
+    path = os.path.join(gfx_dir, "Fonts", font + ".h")
+    with open(path) as file:
+        text = re.sub(r"//[^\n]*", "", file.read())
+
+    def array(name):
+        match = re.search(name + r"\s*\[\]\s*PROGMEM\s*=\s*\{(.*?)\}\s*;", text, re.S)
+        if not match:
+            raise ValueError("%s: no %s" % (path, name))
+        return match.group(1)
+
+    bitmap = [int(value, 16) for value in re.findall(r"0x[0-9A-Fa-f]+", array(font + "Bitmaps"))]
+    glyphs = [tuple(int(value) for value in entry.split(","))
+              for entry in re.findall(r"\{([-\d\s,]+)\}", array(font + "Glyphs"))]
+    match = re.search(r"GFXfont\s+" + font + r"\s+PROGMEM\s*=\s*\{[^}]*?(0x[0-9A-Fa-f]+|\d+)\s*,\s*"
+                      r"(0x[0-9A-Fa-f]+|\d+)\s*,\s*(\d+)\s*\}", text, re.S)
+    if not match:
+        raise ValueError("%s: no %s" % (path, font))
+    return bitmap, glyphs, int(match.group(1), 0)
+
+
+def render_set(gfx_dir, glyph_set, out):
+    name, font, width, num_pages, baseline = glyph_set
+    bitmap, glyphs, first = read_font(gfx_dir, font)
+
+    out.append("// %s" % font)
+    out.append("#define %s_GLYPH_WIDTH %d" % (name.upper(), width))
+    out.append("#define %s_GLYPH_PAGES %d" % (name.upper(), num_pages))
+    out.append("const uint8_t %s_glyph_cells[GLYPH_NUM_CHARS * %s_GLYPH_PAGES * %s_GLYPH_WIDTH] PROGMEM = {"
+               % (name, name.upper(), name.upper()))
+    for ch in GLYPH_CHARS:
+        offset, glyph_width, glyph_height, x_advance, x_offset, y_offset = glyphs[ord(ch) - first]
+        if x_advance != width:
+            raise ValueError("%s '%c' advances %d, the cells are %d wide" % (font, ch, x_advance, width))
+
+        # like drawChar(): the bits run on from one row into the next, MSB first; pixel (x, y) of the glyph lands
+        # on column x_offset + x and row baseline + y_offset + y of the widget, whose first page is the label's
+        cell = [0] * (num_pages * width)
+        for idx in range(glyph_width * glyph_height):
+            if not bitmap[offset + idx // 8] & (0x80 >> (idx % 8)):
+                continue
+            col = x_offset + idx % glyph_width
+            row = baseline + y_offset + idx // glyph_width - 8
+            if col < 0 or col >= width or row < 0 or row >= 8 * num_pages:
+                raise ValueError("%s '%c' doesn't fit its cell" % (font, ch))
+            cell[(row // 8) * width + col] |= 1 << (row % 8)
+
+        out.append("    // '%c'" % ch)
+        for page in range(num_pages):
+            out.append("   " + "".join(" 0x%02x," % byte for byte in cell[page * width:(page + 1) * width]))
+    out.append("};")
+    out.append("")
+
+
+def generate(gfx_dir):
+    out = [
+        "#ifndef __GLYPHS_H__",
+        "#define __GLYPHS_H__",
+        "",
+        "// generated by tools/gen_glyphs.py from Adafruit GFX's fonts, don't edit.",
+        "// one cell per character: num_pages pages of width bytes, in the SSD1306 memory layout",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "#define GLYPH_CHARS \"%s\"" % GLYPH_CHARS,
+        "#define GLYPH_NUM_CHARS (sizeof(GLYPH_CHARS) - 1)",
+        "",
+    ]
+    for glyph_set in GLYPH_SETS:
+        render_set(gfx_dir, glyph_set, out)
+    out.append("#endif // __GLYPHS_H__")
+    return "\n".join(out) + "\n"
+
+
+def write_if_changed(path, text):
+    if os.path.isfile(path):
+        with open(path) as file:
+            if file.read() == text:
+                return
+    with open(path, "w") as file:
+        file.write(text)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        sys.exit("usage: %s <Adafruit GFX Library dir> > glyphs.h" % sys.argv[0])
+    sys.stdout.write(generate(sys.argv[1]))
+else:
+    Import("env")  # noqa: F821, provided by PlatformIO
+
+    gfx_dir = os.path.join(env.subst("$PROJECT_LIBDEPS_DIR"), env.subst("$PIOENV"), "Adafruit GFX Library")
+    gen_dir = os.path.join(env.subst("$BUILD_DIR"), "generated")
+    os.makedirs(os.path.join(gen_dir, "Fonts"), exist_ok=True)
+    write_if_changed(os.path.join(gen_dir, "glyphs.h"), generate(gfx_dir))
+    if env.subst("$PIOPLATFORM") == "native":
+        # only the fonts: the rest of GFX is test/shims/Adafruit_GFX.h
+        for glyph_set in GLYPH_SETS:
+            shutil.copy(os.path.join(gfx_dir, "Fonts", glyph_set[1] + ".h"), os.path.join(gen_dir, "Fonts"))
+    env.Append(CPPPATH=[gen_dir])